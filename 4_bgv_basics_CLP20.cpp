@@ -2,22 +2,266 @@
 // Licensed under the MIT license.
 
 #include "examples.h"
+#include "counter_rng.h"
+#include "noise_results.h"
+#include "scheme_comparison.h"
+#include "secret_distribution.h"
+#include "seal/util/ntt.h"
+#include "seal/util/polyarithsmallmod.h"
+#include "seal/util/uintarith.h"
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <unordered_map>
 
 using namespace std;
 using namespace seal;
 
-void example_bgv_basics()
+/*
+SEAL draws all key generation and encryption randomness from generators created by the factory set in the
+encryption parameters. This factory seeds the k-th generator created for a trial from the counter-based
+stream (run seed, trial, k), so each trial is reproducible on its own. The current trial is per thread.
+*/
+class TrialPRNGFactory : public UniformRandomGeneratorFactory
 {
-    print_example_banner("Example: BGV Basics");
+public:
+    TrialPRNGFactory(uint64_t run_seed) : UniformRandomGeneratorFactory(prng_seed_type{}), run_seed_(run_seed)
+    {
+    }
+
+    /* Start the random stream of the given trial on the calling thread */
+    void set_trial(uint64_t trial)
+    {
+        current_trial() = trial;
+        generators_created() = 0;
+    }
+
+protected:
+    shared_ptr<UniformRandomGenerator> create_impl(prng_seed_type) override
+    {
+        TrialRandomStream stream(run_seed_, current_trial(), trial_stream_id(stream_encryption, generators_created()++));
+        prng_seed_type seed;
+        for (auto &word : seed)
+        {
+            word = stream.next64();
+        }
+        return make_shared<Blake2xbPRNG>(seed);
+    }
+
+private:
+    static uint64_t &current_trial()
+    {
+        static thread_local uint64_t trial = KEYGEN_TRIAL;
+        return trial;
+    }
+
+    static uint32_t &generators_created()
+    {
+        static thread_local uint32_t count = 0;
+        return count;
+    }
+
+    uint64_t run_seed_;
+};
+
+/* Fill every slot of a batching matrix with an independent uniform message mod plain_modulus */
+void fill_slots_uniform(vector<uint64_t> &pod_matrix, TrialRandomStream &messages, uint64_t plain_modulus)
+{
+    for (auto &slot : pod_matrix)
+    {
+        slot = messages.uniform(plain_modulus);
+    }
+}
+
+/*
+A secret key with the given coefficients in {-1, 0, 1}, for KeyGenerator(context, secret_key). SEAL keeps the secret
+key in NTT form over all the primes of the key level, so the coefficients are reduced mod each prime and transformed,
+as KeyGenerator does for the keys it samples itself.
+*/
+SecretKey make_secret_key(const SEALContext &context, const vector<int> &coefficients)
+{
+    auto &key_context_data = *context.key_context_data();
+    auto &coeff_modulus = key_context_data.parms().coeff_modulus();
+    size_t coeff_count = key_context_data.parms().poly_modulus_degree();
+    size_t coeff_modulus_size = coeff_modulus.size();
+
+    SecretKey secret_key;
+    Plaintext &data = secret_key.data();
+    data.resize(coeff_count * coeff_modulus_size);
+    for (size_t i = 0; i < coeff_modulus_size; i++)
+    {
+        uint64_t modulus = coeff_modulus[i].value();
+        for (size_t j = 0; j < coeff_count; j++)
+        {
+            data[i * coeff_count + j] = coefficients[j] < 0 ? modulus - 1 : uint64_t(coefficients[j]);
+        }
+    }
+    util::RNSIter secret_iter(data.data(), coeff_count);
+    util::ntt_negacyclic_harvey(secret_iter, coeff_modulus_size, key_context_data.small_ntt_tables());
+    data.parms_id() = context.key_parms_id();
+    return secret_key;
+}
+
+/*
+Total coeff modulus bits at every level of the modulus chain, looked up by parms_id. The map is built once,
+before any trials, and only read afterwards, so lookups need no locking.
+*/
+unordered_map<parms_id_type, int> get_modulus_bits_by_parms_id(const SEALContext &context)
+{
+    unordered_map<parms_id_type, int> modulus_bits;
+    for (auto data = context.key_context_data(); data; data = data->next_context_data())
+    {
+        modulus_bits[data->parms_id()] = data->total_coeff_modulus_bit_count();
+    }
+    return modulus_bits;
+}
+
+/*
+As Decryptor::invariant_noise_budget, also returning log2 of the empirical variance of the n coefficients of the
+noise polynomial, as the HElib probes do. Each coefficient is a sample of the noise distribution, so one probe
+gives n samples rather than only the maximum. c(s) (times t under BFV, as SEAL does) is formed one prime at a time
+in NTT form from the ciphertext and the secret key, whose key level starts with the primes of the ciphertext, then
+CRT-composed and centered. The squares are summed in doubles scaled by 2^-scale, so they cannot overflow at any q.
+*/
+int invariant_noise_budget_and_variance(const SEALContext &context, const SecretKey &secret_key,
+    const Ciphertext &encrypted, double &log_variance)
+{
+    auto &context_data = *context.get_context_data(encrypted.parms_id());
+    auto &coeff_modulus = context_data.parms().coeff_modulus();
+    size_t coeff_count = context_data.parms().poly_modulus_degree();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    uint64_t plain_modulus = context_data.parms().plain_modulus().value();
+    auto ntt_tables = context_data.small_ntt_tables();
+
+    /* c(s) mod every prime, in coefficient form, one row per prime */
+    vector<uint64_t> noise(coeff_count * coeff_modulus_size);
+    vector<uint64_t> power(coeff_count);
+    vector<uint64_t> term(coeff_count);
+    for (size_t i = 0; i < coeff_modulus_size; i++)
+    {
+        uint64_t *row = noise.data() + i * coeff_count;
+        const uint64_t *secret = secret_key.data().data() + i * coeff_count;
+        copy(encrypted.data(0) + i * coeff_count, encrypted.data(0) + (i + 1) * coeff_count, row);
+        if (!encrypted.is_ntt_form())
+        {
+            util::ntt_negacyclic_harvey(row, ntt_tables[i]);
+        }
+        copy(secret, secret + coeff_count, power.begin());
+        for (size_t part = 1; part < encrypted.size(); part++)
+        {
+            if (part > 1)
+            {
+                util::dyadic_product_coeffmod(power.data(), secret, coeff_count, coeff_modulus[i], power.data());
+            }
+            copy(encrypted.data(part) + i * coeff_count, encrypted.data(part) + (i + 1) * coeff_count, term.begin());
+            if (!encrypted.is_ntt_form())
+            {
+                util::ntt_negacyclic_harvey(term.data(), ntt_tables[i]);
+            }
+            util::dyadic_product_coeffmod(term.data(), power.data(), coeff_count, coeff_modulus[i], term.data());
+            util::add_poly_coeffmod(row, term.data(), coeff_count, coeff_modulus[i], row);
+        }
+        util::inverse_ntt_negacyclic_harvey(row, ntt_tables[i]);
+        if (context_data.parms().scheme() == scheme_type::bfv)
+        {
+            util::multiply_poly_scalar_coeffmod(row, coeff_count, plain_modulus, coeff_modulus[i], row);
+        }
+    }
+
+    /* Compose, center, and keep the largest magnitude and the sum of squares */
+    context_data.rns_tool()->base_q()->compose_array(noise.data(), coeff_count, MemoryManager::GetPool());
+    const uint64_t *q = context_data.total_coeff_modulus();
+    int total_bits = context_data.total_coeff_modulus_bit_count();
+    int scale = max(0, total_bits - 500);
+    vector<uint64_t> negated(coeff_modulus_size);
+    vector<uint64_t> largest(coeff_modulus_size, 0);
+    double sum_of_squares = 0;
+    for (size_t j = 0; j < coeff_count; j++)
+    {
+        const uint64_t *value = noise.data() + j * coeff_modulus_size;
+        util::sub_uint(q, value, coeff_modulus_size, negated.data());
+        const uint64_t *magnitude = util::is_greater_than_uint(value, negated.data(), coeff_modulus_size) ?
+            negated.data() : value;
+        if (util::is_greater_than_uint(magnitude, largest.data(), coeff_modulus_size))
+        {
+            copy(magnitude, magnitude + coeff_modulus_size, largest.begin());
+        }
+        double scaled = 0;
+        for (size_t w = 0; w < coeff_modulus_size; w++)
+        {
+            scaled += ldexp(double(magnitude[w]), int(64 * w) - scale);
+        }
+        sum_of_squares += scaled * scaled;
+    }
+    log_variance = log2(sum_of_squares) + 2 * scale - log2(double(coeff_count));
+    int norm_bits = util::get_significant_bit_count_uint(largest.data(), coeff_modulus_size);
+    return max(0, total_bits - norm_bits - 1);
+}
+
+/*
+One run of the circuit under the given scheme (bgv or bfv). Everything but the scheme is the same for both: the
+parameters, the trial streams, the messages and the stages. The returned SchemeRun holds the noise budget, the latency
+and the ciphertext size of every stage and trial.
+*/
+SchemeRun run_bgv_basics(scheme_type scheme)
+{
+    string scheme_name = scheme == scheme_type::bfv ? "bfv" : "bgv";
 
     /* Set number of trials. */
     int trials = 1;
 
+    /* Trials first_trial, ..., first_trial + trials - 1 are run; trial i draws all of its randomness from (run_seed, i). */
+    uint64_t first_trial = 0;
+    uint64_t run_seed = 1;
+
     /* Set verbose to true for debugging. */
     bool verbose = false;
 
+    /*
+    Secret key distribution (see secret_distribution.h): secret_default lets KeyGenerator sample the secret, the
+    others are sampled from the run seed and passed to KeyGenerator. secret_hamming_weight is the number of nonzero
+    coefficients of a secret_sparse_ternary secret.
+    */
+    SecretDistribution secret_distribution = secret_default;
+    long secret_hamming_weight = 64;
+
+    /*
+    Set slot_packed to true to fill every slot of every plaintext with an independent uniform message mod
+    plain_modulus, instead of a single value in the first slot. The noise probes of the fresh, add, mult and modswitch
+    stages then also report the variance of the noise coefficients (invariant_noise_budget_and_variance).
+    */
+    bool slot_packed = false;
+
+    /*
+    The plaintext multiplication stage multiplies the fresh ciphertext by a fixed plaintext with uniform slots, and
+    the constant multiplication stage by a plaintext holding plain_modulus / 2 in every slot. Set cached_plaintext to
+    true to transform the plaintext multiplier to NTT form once and reuse it across trials; otherwise it is
+    transformed for every multiplication. BFV ciphertexts are not kept in NTT form, so under BFV the multiplier is
+    never cached.
+    */
+    bool cached_plaintext = true;
+
+    /*
+    The rotation stage rotates the rows of the fresh ciphertext by one slot. The multi-rotation stage rotates the
+    fresh ciphertext by each of 1, ..., rotation_count slots, each with its own Galois key so that every rotation is a
+    single key switch. SEAL 4.0 does not expose hoisted key switching, so this stage is the unhoisted baseline to
+    set against the hoisted rotations of the HElib harness. Its timing is per rotation and its noise is the mean
+    over the rotations.
+    */
+    int rotation_count = 8;
+
+    /* Set write_results to true to also write every trial to a binary results file (see noise_results.h). */
+    bool write_results = false;
+    string results_path = "bgv_basics_CLP20_results" + string(scheme == scheme_type::bfv ? "_bfv" : "") + ".bin";
+
     /* Select parameters appropriate for our experiment */
-    EncryptionParameters parms(scheme_type::bgv);
+    EncryptionParameters parms(scheme);
+    if (scheme == scheme_type::bfv)
+    {
+        cached_plaintext = false;
+    }
 
     size_t poly_modulus_degree = 4096;
     parms.set_poly_modulus_degree(poly_modulus_degree);
@@ -39,6 +283,10 @@ void example_bgv_basics()
 
     /* Use same plain_modulus as used in the BGV Basics example. */
     parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, 20));
+
+    /* Draw all randomness from the per-trial counter-based streams */
+    auto trial_prng = make_shared<TrialPRNGFactory>(run_seed);
+    parms.set_random_generator(trial_prng);
     SEALContext context(parms);
 
     /*
@@ -49,14 +297,41 @@ void example_bgv_basics()
     /* Also print exact plaintext modulus chosen. */
     auto &context_data = *context.key_context_data();
     std::cout << "|   plain_modulus: " << context_data.parms().plain_modulus().value() << std::endl;
+    uint64_t plain_modulus = context_data.parms().plain_modulus().value();
+    auto modulus_bits = get_modulus_bits_by_parms_id(context);
 
     /* Generate keys */
-    KeyGenerator keygen(context);
-    SecretKey secret_key = keygen.secret_key();
+    cout << "Run seed: " << run_seed << ", trials " << first_trial << " to " << first_trial + trials - 1 << endl;
+    trial_prng->set_trial(KEYGEN_TRIAL);
+    unique_ptr<KeyGenerator> keygen;
+    if (secret_distribution == secret_default)
+    {
+        keygen.reset(new KeyGenerator(context));
+    }
+    else
+    {
+        TrialRandomStream secret_stream(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_keys, 1));
+        keygen.reset(new KeyGenerator(context, make_secret_key(context, sample_ternary_secret(secret_distribution,
+            long(poly_modulus_degree), secret_hamming_weight, secret_stream))));
+    }
+    cout << "Secret key: " << secret_distribution_name(secret_distribution);
+    if (secret_distribution == secret_sparse_ternary)
+    {
+        cout << ", Hamming weight " << secret_hamming_weight;
+    }
+    cout << endl;
+    SecretKey secret_key = keygen->secret_key();
     PublicKey public_key;
-    keygen.create_public_key(public_key);
+    keygen->create_public_key(public_key);
     RelinKeys relin_keys;
-    keygen.create_relin_keys(relin_keys);
+    keygen->create_relin_keys(relin_keys);
+    vector<int> rotation_steps;
+    for (int step = 1; step <= rotation_count; step++)
+    {
+        rotation_steps.push_back(step);
+    }
+    GaloisKeys galois_keys;
+    keygen->create_galois_keys(rotation_steps, galois_keys);
     Encryptor encryptor(context, public_key);
     Evaluator evaluator(context);
     Decryptor decryptor(context, secret_key);
@@ -75,63 +350,223 @@ void example_bgv_basics()
     Ciphertext encrypted2;
     Ciphertext encrypted3;
     Ciphertext encrypted4;
+    Ciphertext encrypted5;
+    Ciphertext encrypted6;
+    Ciphertext encrypted7;
+
+    /* Plaintext multiplier with uniform slots, drawn once per run, and the constant multiplier */
+    vector<uint64_t> multiplier_matrix(slot_count, 0ULL);
+    TrialRandomStream multiplier_stream(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_messages, 1));
+    fill_slots_uniform(multiplier_matrix, multiplier_stream, plain_modulus);
+    Plaintext plain_multiplier;
+    batch_encoder.encode(multiplier_matrix, plain_multiplier);
+    Plaintext plain_multiplier_ntt = plain_multiplier;
+    if (cached_plaintext)
+    {
+        evaluator.transform_to_ntt_inplace(plain_multiplier_ntt, context.first_parms_id());
+    }
+    uint64_t constant = plain_modulus / 2;
+    Plaintext plain_constant;
+    batch_encoder.encode(vector<uint64_t>(slot_count, constant), plain_constant);
+
+    /* Optional per-trial binary output: one stage per noise probe below. SEAL has no noise estimate, so that column is NaN. */
+    vector<string> stage_names = {"fresh", "add", "mult", "modswitch", "pmult", "cmult", "rotate", "rotate_many"};
+    SchemeRun scheme_run(scheme_name, stage_names);
+    unique_ptr<NoiseResultsWriter> results_writer;
+    if (write_results)
+    {
+        NoiseResultsHeader header = make_noise_results_header("SEAL", "clp20", poly_modulus_degree,
+            context_data.parms().plain_modulus().value(), modulus_bits.at(context.first_parms_id()), stage_names,
+            first_trial);
+        results_writer.reset(new NoiseResultsWriter(results_path, header));
+    }
+    const double no_estimate = numeric_limits<double>::quiet_NaN();
+    chrono::steady_clock::time_point op_start;
+    double fresh_seconds, add_seconds, mult_seconds, modswitch_seconds, pmult_seconds, cmult_seconds, rotate_seconds, rotate_many_seconds;
 
     /* Holders for the running total of the observed noises in ciphertexts */
     double total_fresh_observed(0);
     double total_add_observed(0);
     double total_mult_observed(0);
     double total_modswitch_observed(0);
+    double total_pmult_observed(0);
+    double total_cmult_observed(0);
+    double total_rotate_observed(0);
+    double total_rotate_many_observed(0);
+
+    /* Holders for the running total of log2 of the noise coefficient variances (slot-packed mode only) */
+    double total_fresh_log_variance(0);
+    double total_add_log_variance(0);
+    double total_mult_log_variance(0);
+    double total_modswitch_log_variance(0);
+
+    /* Holders for the running total of the per-rotation latencies */
+    double total_rotate_seconds(0);
+    double total_rotate_many_seconds(0);
 
     /* Gather data */
     for (int i = 0; i < trials; i++)
     {
+         /* All randomness of this trial comes from (run_seed, trial) */
+         uint64_t trial = first_trial + i;
+         trial_prng->set_trial(trial);
 
          /*
          Here we create the following input plaintext matrices:
-            [ i,  0,  0,  0,  0,  0, ...,  0 ]
+            [ trial,  0,  0,  0,  0,  0, ...,  0 ]
             [ 0,  0,  0,  0,  0,  0, ...,  0 ]
 
-            [ i+1,  0,  0,  0,  0,  0, ...,  0 ]
+            [ trial+1,  0,  0,  0,  0,  0, ...,  0 ]
             [ 0,  0,  0,  0,  0,  0, ...,  0 ]
          */
          vector<uint64_t> pod_matrix1(slot_count, 0ULL);
-         pod_matrix1[0] = i;
+         pod_matrix1[0] = trial;
          vector<uint64_t> pod_matrix2(slot_count, 0ULL);
-         pod_matrix2[0] = i+1;
+         pod_matrix2[0] = trial+1;
+
+         if (slot_packed)
+         {
+             TrialRandomStream messages(run_seed, trial, trial_stream_id(stream_messages));
+             fill_slots_uniform(pod_matrix1, messages, plain_modulus);
+             fill_slots_uniform(pod_matrix2, messages, plain_modulus);
+         }
 
          /* Encode the matrices into plaintexts. */
          batch_encoder.encode(pod_matrix1, plain1);
          batch_encoder.encode(pod_matrix2, plain2);
 
          /* Encrypt the plaintexts into ciphertexts */
+         op_start = chrono::steady_clock::now();
          encryptor.encrypt(plain1, encrypted1);
+         fresh_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
          encryptor.encrypt(plain2, encrypted2);
 
          /* What is the noise growth after fresh encryption? */
-         auto fresh_noise = decryptor.invariant_noise_budget(encrypted1);
+         double fresh_log_variance = 0;
+         auto fresh_noise = slot_packed ?
+             invariant_noise_budget_and_variance(context, secret_key, encrypted1, fresh_log_variance) :
+             decryptor.invariant_noise_budget(encrypted1);
          total_fresh_observed += fresh_noise;
+         total_fresh_log_variance += fresh_log_variance;
+
+         /* Multiply encrypted1 by the plaintext multiplier and store in encrypted5. */
+         op_start = chrono::steady_clock::now();
+         evaluator.multiply_plain(encrypted1, cached_plaintext ? plain_multiplier_ntt : plain_multiplier, encrypted5);
+         pmult_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+
+         /* What is the noise growth after plaintext multiplication? */
+         auto pmult_noise = decryptor.invariant_noise_budget(encrypted5);
+         total_pmult_observed += pmult_noise;
+
+         /* Multiply encrypted1 by the constant and store in encrypted6. */
+         op_start = chrono::steady_clock::now();
+         evaluator.multiply_plain(encrypted1, plain_constant, encrypted6);
+         cmult_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+
+         /* What is the noise growth after constant multiplication? */
+         auto cmult_noise = decryptor.invariant_noise_budget(encrypted6);
+         total_cmult_observed += cmult_noise;
+
+         /* Rotate the rows of encrypted1 by one slot and store in encrypted7. */
+         op_start = chrono::steady_clock::now();
+         evaluator.rotate_rows(encrypted1, 1, galois_keys, encrypted7);
+         rotate_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+         total_rotate_seconds += rotate_seconds;
+
+         /* What is the noise growth after rotation? */
+         auto rotate_noise = decryptor.invariant_noise_budget(encrypted7);
+         total_rotate_observed += rotate_noise;
+         auto rotate_bytes = encrypted7.save_size(compr_mode_type::none);
+
+         /* Rotate encrypted1 by each of 1, ..., rotation_count slots. */
+         double rotate_many_noise = 0;
+         rotate_many_seconds = 0;
+         for (int step : rotation_steps)
+         {
+             op_start = chrono::steady_clock::now();
+             evaluator.rotate_rows(encrypted1, step, galois_keys, encrypted7);
+             rotate_many_seconds += chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+             rotate_many_noise += decryptor.invariant_noise_budget(encrypted7);
+         }
+         rotate_many_noise /= rotation_count;
+         rotate_many_seconds /= rotation_count;
+         total_rotate_many_observed += rotate_many_noise;
+         total_rotate_many_seconds += rotate_many_seconds;
 
          /* Add encrypted1 and encrypted2 together and store in encrypted3. */
+         op_start = chrono::steady_clock::now();
          evaluator.add(encrypted1, encrypted2, encrypted3);
+         add_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
 
          /* What is the noise growth after addition? */
-         auto add_noise = decryptor.invariant_noise_budget(encrypted3);
+         double add_log_variance = 0;
+         auto add_noise = slot_packed ?
+             invariant_noise_budget_and_variance(context, secret_key, encrypted3, add_log_variance) :
+             decryptor.invariant_noise_budget(encrypted3);
          total_add_observed += add_noise;
+         total_add_log_variance += add_log_variance;
 
          /* Multiply encrypted3 by encrypted2 and store in encrypted4. */
+         op_start = chrono::steady_clock::now();
          evaluator.multiply(encrypted3, encrypted2, encrypted4);
+         mult_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
 
          /* What is the noise growth after multiplication? */
-         auto mult_noise = decryptor.invariant_noise_budget(encrypted4);
+         double mult_log_variance = 0;
+         auto mult_noise = slot_packed ?
+             invariant_noise_budget_and_variance(context, secret_key, encrypted4, mult_log_variance) :
+             decryptor.invariant_noise_budget(encrypted4);
          total_mult_observed += mult_noise;
+         total_mult_log_variance += mult_log_variance;
+         auto mult_bytes = encrypted4.save_size(compr_mode_type::none);
 
          /* Modulus switch encrypted4 to next prime in the chain. */
+        op_start = chrono::steady_clock::now();
         evaluator.mod_switch_to_next_inplace(encrypted4);
+        modswitch_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+
+         if (i == 0)
+         {
+             cout << "after mod switch: bit size of q is " << modulus_bits.at(encrypted4.parms_id()) << endl;
+         }
 
          /* What is the noise growth after mod switch? */
-         auto modswitch_noise = decryptor.invariant_noise_budget(encrypted4);
+         double modswitch_log_variance = 0;
+         auto modswitch_noise = slot_packed ?
+             invariant_noise_budget_and_variance(context, secret_key, encrypted4, modswitch_log_variance) :
+             decryptor.invariant_noise_budget(encrypted4);
          total_modswitch_observed += modswitch_noise;
+         total_modswitch_log_variance += modswitch_log_variance;
+
+         /* Serialized sizes without compression: the bytes a ciphertext of each stage costs to store or send */
+         scheme_run.record(0, fresh_noise, fresh_seconds, double(encrypted1.save_size(compr_mode_type::none)));
+         scheme_run.record(1, add_noise, add_seconds, double(encrypted3.save_size(compr_mode_type::none)));
+         scheme_run.record(2, mult_noise, mult_seconds, double(mult_bytes));
+         scheme_run.record(3, modswitch_noise, modswitch_seconds, double(encrypted4.save_size(compr_mode_type::none)));
+         scheme_run.record(4, pmult_noise, pmult_seconds, double(encrypted5.save_size(compr_mode_type::none)));
+         scheme_run.record(5, cmult_noise, cmult_seconds, double(encrypted6.save_size(compr_mode_type::none)));
+         scheme_run.record(6, rotate_noise, rotate_seconds, double(rotate_bytes));
+         scheme_run.record(7, rotate_many_noise, rotate_many_seconds, double(encrypted7.save_size(compr_mode_type::none)));
+
+         if (results_writer)
+         {
+             results_writer->record(0, fresh_noise, no_estimate, fresh_seconds);
+             results_writer->record(1, add_noise, no_estimate, add_seconds);
+             results_writer->record(2, mult_noise, no_estimate, mult_seconds);
+             results_writer->record(3, modswitch_noise, no_estimate, modswitch_seconds);
+             results_writer->record(4, pmult_noise, no_estimate, pmult_seconds);
+             results_writer->record(5, cmult_noise, no_estimate, cmult_seconds);
+             results_writer->record(6, rotate_noise, no_estimate, rotate_seconds);
+             results_writer->record(7, rotate_many_noise, no_estimate, rotate_many_seconds);
+             results_writer->end_trial();
+         }
+
+    }
 
+    if (results_writer)
+    {
+        results_writer->close();
+        cout << "Per-trial results written to " << results_path << endl << endl;
     }
 
     /* Debugging: check that decryption is correct. */
@@ -150,22 +585,81 @@ void example_bgv_basics()
     auto mean_add_observed = total_add_observed / trials;
     auto mean_mult_observed = total_mult_observed / trials;
     auto mean_modswitch_observed = total_modswitch_observed / trials;
+    auto mean_pmult_observed = total_pmult_observed / trials;
+    auto mean_cmult_observed = total_cmult_observed / trials;
+    auto mean_rotate_observed = total_rotate_observed / trials;
+    auto mean_rotate_many_observed = total_rotate_many_observed / trials;
 
     /* Print out the results */
+    cout << "Scheme: " << scheme_name << endl << endl;
     cout << "After fresh encryption:" << endl;
     cout << "Mean noise budget observed: " << mean_fresh_observed  << endl;    
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_fresh_log_variance / trials << endl;
+    }
+    cout << endl;
+
+    cout << "After plaintext multiplication of the fresh ciphertext:" << endl;
+    cout << "Mean noise budget observed: " << mean_pmult_observed  << endl;
+    cout << endl;
+
+    cout << "After multiplication of the fresh ciphertext by " << constant << ":" << endl;
+    cout << "Mean noise budget observed: " << mean_cmult_observed  << endl;
+    cout << endl;
+
+    cout << "After rotation of the fresh ciphertext by one slot:" << endl;
+    cout << "Mean noise budget observed: " << mean_rotate_observed  << endl;
+    cout << "Mean seconds per rotation: " << total_rotate_seconds / trials << endl;
+    cout << endl;
+
+    cout << "After each of " << rotation_count << " rotations of the fresh ciphertext:" << endl;
+    cout << "Mean noise budget observed: " << mean_rotate_many_observed  << endl;
+    cout << "Mean seconds per rotation: " << total_rotate_many_seconds / trials << endl;
     cout << endl;
 
     cout << "After addition:" << endl;
     cout << "Mean noise budget observed: " << mean_add_observed  << endl;    
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_add_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After multiplication:" << endl;
     cout << "Mean noise budget observed: " << mean_mult_observed  << endl;    
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_mult_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After modulus switching:" << endl;
     cout << "Mean noise budget observed: " << mean_modswitch_observed  << endl;    
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_modswitch_log_variance / trials << endl;
+    }
     cout << endl;
 
+    return scheme_run;
+}
+
+void example_bgv_basics()
+{
+    print_example_banner("Example: BGV Basics");
+
+    /*
+    Set compare_schemes to true to run the circuit a second time under BFV, with identical parameters and trial
+    streams, and print the noise budget, latency and ciphertext size of every stage side by side.
+    */
+    bool compare_schemes = false;
+
+    vector<SchemeRun> runs;
+    runs.push_back(run_bgv_basics(scheme_type::bgv));
+    if (compare_schemes)
+    {
+        runs.push_back(run_bgv_basics(scheme_type::bfv));
+        print_scheme_comparison(runs);
+    }
 }
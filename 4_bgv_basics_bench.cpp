@@ -0,0 +1,162 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "examples.h"
+#include "bench_report.h"
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+using namespace seal;
+
+/*
+SEAL micro-benchmarks: the BGV primitives used by the noise experiments (key generation, encryption, addition,
+multiplication, relinearization, modulus switching, decryption and the noise probe) for each n from 2048 to 32768,
+with latency percentiles, throughput and bytes allocated per operation (see bench_report.h). The results are also
+written to bgv_bench_SEAL.json, which can be compared across builds with compare_bench.py.
+*/
+
+/*
+Count every heap allocation, so that run_benchmark can report bytes allocated per operation. SEAL serves its
+temporaries from memory pools, which take their memory from operator new but keep it for reuse, so an operation
+drawing from a warm pool would report almost no bytes. The pooled operations therefore go through
+run_pooled_benchmark, which counts their bytes in an untimed pass on a new pool (MemoryPoolHandle::New() passed to
+the encryptor and evaluator, or a new Decryptor, which allocates from a pool of its own, for decryption and the
+noise probe) and times them on that pool once warm.
+*/
+void* operator new(size_t size)
+{
+    bench_allocated_bytes.fetch_add(size, memory_order_relaxed);
+    if (void* pointer = malloc(size ? size : 1))
+    {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+/* Run all benchmarks for one poly_modulus_degree, appending to results */
+void bench_parameters(size_t poly_modulus_degree, long iterations, vector<BenchResult> &results)
+{
+    EncryptionParameters parms(scheme_type::bgv);
+    parms.set_poly_modulus_degree(poly_modulus_degree);
+    parms.set_coeff_modulus(CoeffModulus::BFVDefault(poly_modulus_degree));
+    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, 20));
+    SEALContext context(parms);
+    long n = long(poly_modulus_degree);
+
+    /* n = 2048 has a single prime, so no key switching and no modulus switching */
+    bool has_key_switching = context.using_keyswitching();
+
+    /* Key generation is slow at large n, so it gets fewer iterations */
+    long keygen_iterations = min(iterations, 3L);
+    results.push_back(run_benchmark("keygen", n, keygen_iterations, [] {}, [&] {
+        KeyGenerator keygen(context);
+        PublicKey public_key;
+        keygen.create_public_key(public_key);
+        if (has_key_switching)
+        {
+            RelinKeys relin_keys;
+            keygen.create_relin_keys(relin_keys);
+        }
+    }));
+    print_bench_result(results.back());
+
+    KeyGenerator keygen(context);
+    SecretKey secret_key = keygen.secret_key();
+    PublicKey public_key;
+    keygen.create_public_key(public_key);
+    RelinKeys relin_keys;
+    if (has_key_switching)
+    {
+        keygen.create_relin_keys(relin_keys);
+    }
+    Encryptor encryptor(context, public_key);
+    Evaluator evaluator(context);
+    BatchEncoder batch_encoder(context);
+
+    vector<uint64_t> pod_matrix(batch_encoder.slot_count(), 0ULL);
+    pod_matrix[0] = 1;
+    Plaintext plain;
+    batch_encoder.encode(pod_matrix, plain);
+    Ciphertext encrypted1;
+    Ciphertext encrypted2;
+    Ciphertext result;
+    encryptor.encrypt(plain, encrypted1);
+    encryptor.encrypt(plain, encrypted2);
+    Ciphertext product;
+    evaluator.multiply(encrypted1, encrypted2, product);
+    Ciphertext relinearized = product;
+    if (has_key_switching)
+    {
+        evaluator.relinearize_inplace(relinearized, relin_keys);
+    }
+
+    MemoryPoolHandle pool;
+    auto new_pool = [&] { pool = MemoryPoolHandle::New(); };
+    auto no_setup = [] {};
+    results.push_back(run_pooled_benchmark("encrypt", n, iterations, new_pool, no_setup,
+        [&] { encryptor.encrypt(plain, result, pool); }));
+    print_bench_result(results.back());
+
+    /* Addition takes no temporaries, so it has no pool */
+    results.push_back(run_benchmark("add", n, iterations, no_setup, [&] { evaluator.add(encrypted1, encrypted2, result); }));
+    print_bench_result(results.back());
+
+    results.push_back(run_pooled_benchmark("multiply", n, iterations, new_pool, no_setup,
+        [&] { evaluator.multiply(encrypted1, encrypted2, result, pool); }));
+    print_bench_result(results.back());
+
+    if (has_key_switching)
+    {
+        results.push_back(run_pooled_benchmark("relinearize", n, iterations, new_pool, [&] { result = product; },
+            [&] { evaluator.relinearize_inplace(result, relin_keys, pool); }));
+        print_bench_result(results.back());
+
+        results.push_back(run_pooled_benchmark("modswitch", n, iterations, new_pool, [&] { result = relinearized; },
+            [&] { evaluator.mod_switch_to_next_inplace(result, pool); }));
+        print_bench_result(results.back());
+    }
+
+    unique_ptr<Decryptor> decryptor;
+    auto new_decryptor = [&] { decryptor.reset(new Decryptor(context, secret_key)); };
+    Plaintext decrypted;
+    results.push_back(run_pooled_benchmark("decrypt", n, iterations, new_decryptor, no_setup,
+        [&] { decryptor->decrypt(relinearized, decrypted); }));
+    print_bench_result(results.back());
+
+    results.push_back(run_pooled_benchmark("noise_probe", n, iterations, new_decryptor, no_setup,
+        [&] { decryptor->invariant_noise_budget(relinearized); }));
+    print_bench_result(results.back());
+}
+
+void example_bgv_basics()
+{
+    print_example_banner("Example: BGV Basics (benchmarks)");
+
+    /* Set number of iterations per operation and the output file. */
+    long iterations = 20;
+    string json_path = "bgv_bench_SEAL.json";
+
+    vector<size_t> poly_modulus_degrees = { 2048, 4096, 8192, 16384, 32768 };
+
+    vector<BenchResult> results;
+    print_bench_header();
+    for (size_t poly_modulus_degree : poly_modulus_degrees)
+    {
+        bench_parameters(poly_modulus_degree, iterations, results);
+    }
+
+    write_bench_json(json_path, "SEAL", SEAL_VERSION, results);
+    cout << endl << "Results written to " << json_path << endl;
+}
@@ -2,23 +2,358 @@
 // Licensed under the MIT license.
 
 #include "examples.h"
+#include "circuit_kernel.h"
+#include "circuit_planner.h"
+#include "counter_rng.h"
+#include "memory_footprint.h"
+#include "noise_results.h"
+#include "scheme_comparison.h"
+#include "secret_distribution.h"
+#include "seal/util/ntt.h"
+#include "seal/util/polyarithsmallmod.h"
+#include "seal/util/uintarith.h"
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <unordered_map>
 
 using namespace std;
 using namespace seal;
 
-void example_bgv_basics()
+/*
+SEAL draws all key generation and encryption randomness from generators created by the factory set in the
+encryption parameters. This factory seeds the k-th generator created for a trial from the counter-based
+stream (run seed, trial, k), so each trial is reproducible on its own. The current trial is per thread.
+*/
+class TrialPRNGFactory : public UniformRandomGeneratorFactory
 {
-    print_example_banner("Example: BGV Basics");
+public:
+    TrialPRNGFactory(uint64_t run_seed) : UniformRandomGeneratorFactory(prng_seed_type{}), run_seed_(run_seed)
+    {
+    }
+
+    /* Start the random stream of the given trial on the calling thread */
+    void set_trial(uint64_t trial)
+    {
+        current_trial() = trial;
+        generators_created() = 0;
+    }
+
+protected:
+    shared_ptr<UniformRandomGenerator> create_impl(prng_seed_type) override
+    {
+        TrialRandomStream stream(run_seed_, current_trial(), trial_stream_id(stream_encryption, generators_created()++));
+        prng_seed_type seed;
+        for (auto &word : seed)
+        {
+            word = stream.next64();
+        }
+        return make_shared<Blake2xbPRNG>(seed);
+    }
+
+private:
+    static uint64_t &current_trial()
+    {
+        static thread_local uint64_t trial = KEYGEN_TRIAL;
+        return trial;
+    }
+
+    static uint32_t &generators_created()
+    {
+        static thread_local uint32_t count = 0;
+        return count;
+    }
+
+    uint64_t run_seed_;
+};
+
+/* Fill every slot of a batching matrix with an independent uniform message mod plain_modulus */
+void fill_slots_uniform(vector<uint64_t> &pod_matrix, TrialRandomStream &messages, uint64_t plain_modulus)
+{
+    for (auto &slot : pod_matrix)
+    {
+        slot = messages.uniform(plain_modulus);
+    }
+}
+
+/*
+A secret key with the given coefficients in {-1, 0, 1}, for KeyGenerator(context, secret_key). SEAL keeps the secret
+key in NTT form over all the primes of the key level, so the coefficients are reduced mod each prime and transformed,
+as KeyGenerator does for the keys it samples itself.
+*/
+SecretKey make_secret_key(const SEALContext &context, const vector<int> &coefficients)
+{
+    auto &key_context_data = *context.key_context_data();
+    auto &coeff_modulus = key_context_data.parms().coeff_modulus();
+    size_t coeff_count = key_context_data.parms().poly_modulus_degree();
+    size_t coeff_modulus_size = coeff_modulus.size();
+
+    SecretKey secret_key;
+    Plaintext &data = secret_key.data();
+    data.resize(coeff_count * coeff_modulus_size);
+    for (size_t i = 0; i < coeff_modulus_size; i++)
+    {
+        uint64_t modulus = coeff_modulus[i].value();
+        for (size_t j = 0; j < coeff_count; j++)
+        {
+            data[i * coeff_count + j] = coefficients[j] < 0 ? modulus - 1 : uint64_t(coefficients[j]);
+        }
+    }
+    util::RNSIter secret_iter(data.data(), coeff_count);
+    util::ntt_negacyclic_harvey(secret_iter, coeff_modulus_size, key_context_data.small_ntt_tables());
+    data.parms_id() = context.key_parms_id();
+    return secret_key;
+}
+
+/*
+Total coeff modulus bits at every level of the modulus chain, looked up by parms_id. The map is built once,
+before any trials, and only read afterwards, so lookups need no locking.
+*/
+unordered_map<parms_id_type, int> get_modulus_bits_by_parms_id(const SEALContext &context)
+{
+    unordered_map<parms_id_type, int> modulus_bits;
+    for (auto data = context.key_context_data(); data; data = data->next_context_data())
+    {
+        modulus_bits[data->parms_id()] = data->total_coeff_modulus_bit_count();
+    }
+    return modulus_bits;
+}
+
+/*
+As Decryptor::invariant_noise_budget, also returning log2 of the empirical variance of the n coefficients of the
+noise polynomial, as the HElib probes do. Each coefficient is a sample of the noise distribution, so one probe
+gives n samples rather than only the maximum. c(s) (times t under BFV, as SEAL does) is formed one prime at a time
+in NTT form from the ciphertext and the secret key, whose key level starts with the primes of the ciphertext, then
+CRT-composed and centered. The squares are summed in doubles scaled by 2^-scale, so they cannot overflow at any q.
+*/
+int invariant_noise_budget_and_variance(const SEALContext &context, const SecretKey &secret_key,
+    const Ciphertext &encrypted, double &log_variance)
+{
+    auto &context_data = *context.get_context_data(encrypted.parms_id());
+    auto &coeff_modulus = context_data.parms().coeff_modulus();
+    size_t coeff_count = context_data.parms().poly_modulus_degree();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    uint64_t plain_modulus = context_data.parms().plain_modulus().value();
+    auto ntt_tables = context_data.small_ntt_tables();
+
+    /* c(s) mod every prime, in coefficient form, one row per prime */
+    vector<uint64_t> noise(coeff_count * coeff_modulus_size);
+    vector<uint64_t> power(coeff_count);
+    vector<uint64_t> term(coeff_count);
+    for (size_t i = 0; i < coeff_modulus_size; i++)
+    {
+        uint64_t *row = noise.data() + i * coeff_count;
+        const uint64_t *secret = secret_key.data().data() + i * coeff_count;
+        copy(encrypted.data(0) + i * coeff_count, encrypted.data(0) + (i + 1) * coeff_count, row);
+        if (!encrypted.is_ntt_form())
+        {
+            util::ntt_negacyclic_harvey(row, ntt_tables[i]);
+        }
+        copy(secret, secret + coeff_count, power.begin());
+        for (size_t part = 1; part < encrypted.size(); part++)
+        {
+            if (part > 1)
+            {
+                util::dyadic_product_coeffmod(power.data(), secret, coeff_count, coeff_modulus[i], power.data());
+            }
+            copy(encrypted.data(part) + i * coeff_count, encrypted.data(part) + (i + 1) * coeff_count, term.begin());
+            if (!encrypted.is_ntt_form())
+            {
+                util::ntt_negacyclic_harvey(term.data(), ntt_tables[i]);
+            }
+            util::dyadic_product_coeffmod(term.data(), power.data(), coeff_count, coeff_modulus[i], term.data());
+            util::add_poly_coeffmod(row, term.data(), coeff_count, coeff_modulus[i], row);
+        }
+        util::inverse_ntt_negacyclic_harvey(row, ntt_tables[i]);
+        if (context_data.parms().scheme() == scheme_type::bfv)
+        {
+            util::multiply_poly_scalar_coeffmod(row, coeff_count, plain_modulus, coeff_modulus[i], row);
+        }
+    }
+
+    /* Compose, center, and keep the largest magnitude and the sum of squares */
+    context_data.rns_tool()->base_q()->compose_array(noise.data(), coeff_count, MemoryManager::GetPool());
+    const uint64_t *q = context_data.total_coeff_modulus();
+    int total_bits = context_data.total_coeff_modulus_bit_count();
+    int scale = max(0, total_bits - 500);
+    vector<uint64_t> negated(coeff_modulus_size);
+    vector<uint64_t> largest(coeff_modulus_size, 0);
+    double sum_of_squares = 0;
+    for (size_t j = 0; j < coeff_count; j++)
+    {
+        const uint64_t *value = noise.data() + j * coeff_modulus_size;
+        util::sub_uint(q, value, coeff_modulus_size, negated.data());
+        const uint64_t *magnitude = util::is_greater_than_uint(value, negated.data(), coeff_modulus_size) ?
+            negated.data() : value;
+        if (util::is_greater_than_uint(magnitude, largest.data(), coeff_modulus_size))
+        {
+            copy(magnitude, magnitude + coeff_modulus_size, largest.begin());
+        }
+        double scaled = 0;
+        for (size_t w = 0; w < coeff_modulus_size; w++)
+        {
+            scaled += ldexp(double(magnitude[w]), int(64 * w) - scale);
+        }
+        sum_of_squares += scaled * scaled;
+    }
+    log_variance = log2(sum_of_squares) + 2 * scale - log2(double(coeff_count));
+    int norm_bits = util::get_significant_bit_count_uint(largest.data(), coeff_modulus_size);
+    return max(0, total_bits - norm_bits - 1);
+}
+
+/*
+The deep circuit: the product tree of 8 fresh ciphertexts, expanded at compile time (see circuit_kernel.h). Its
+SEAL backend encrypts the plaintexts of the trial, multiplies with Evaluator::multiply and relinearizes the
+operands of the second and third multiplications, or, given a plan (see circuit_planner.h), switches down and
+relinearizes as the plan says. Every probe stores the invariant noise budget, log2 of the noise coefficient variance
+(slot-packed mode only), the time of the operation of its stage, the serialized size of the ciphertext and its parts
+and primes; evaluation_seconds adds up the time of all
+multiplications, relinearizations and modulus switches.
+*/
+typedef MulTree<3, 2> DeepCircuit;
+
+struct SEALDeepBackend
+{
+    typedef seal::Ciphertext Ciphertext;
+
+    Encryptor &encryptor;
+    Evaluator &evaluator;
+    Decryptor &decryptor;
+    const RelinKeys &relin_keys;
+    const vector<Plaintext> &plains;
+    const SEALContext &context;
+    const SecretKey &secret_key;
+    bool slot_packed;
+    const CircuitPlan *plan = nullptr;
+
+    double noise[DeepCircuit::stages];
+    double log_variance[DeepCircuit::stages];
+    double seconds[DeepCircuit::stages];
+    double bytes[DeepCircuit::stages];
+    long parts[DeepCircuit::stages];
+    long primes[DeepCircuit::stages];
+    double evaluation_seconds = 0;
+
+    SEALDeepBackend(Encryptor &encryptor, Evaluator &evaluator, Decryptor &decryptor, const RelinKeys &relin_keys,
+        const vector<Plaintext> &plains, const SEALContext &context, const SecretKey &secret_key, bool slot_packed)
+        : encryptor(encryptor), evaluator(evaluator), decryptor(decryptor), relin_keys(relin_keys), plains(plains),
+          context(context), secret_key(secret_key), slot_packed(slot_packed)
+    {
+    }
+
+    void encrypt(Ciphertext &out, int leaf)
+    {
+        encryptor.encrypt(plains[leaf], out);
+    }
+
+    void multiply(const Ciphertext &a, const Ciphertext &b, Ciphertext &out)
+    {
+        auto start = chrono::steady_clock::now();
+        evaluator.multiply(a, b, out);
+        evaluation_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    void multiply_inplace(Ciphertext &out, const Ciphertext &b)
+    {
+        auto start = chrono::steady_clock::now();
+        evaluator.multiply_inplace(out, b);
+        evaluation_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    template <int Level>
+    void probe(const Ciphertext &node, double operation_seconds)
+    {
+        log_variance[Level] = 0;
+        noise[Level] = slot_packed ? invariant_noise_budget_and_variance(context, secret_key, node, log_variance[Level]) :
+            decryptor.invariant_noise_budget(node);
+        seconds[Level] = operation_seconds;
+        bytes[Level] = double(node.save_size(compr_mode_type::none));
+        parts[Level] = long(node.size());
+        primes[Level] = long(node.coeff_modulus_size());
+    }
+
+    /* Without a plan, fresh ciphertexts have size 2 and products are relinearized before they are multiplied again */
+    template <int Level>
+    void prepare_operand(Ciphertext &node)
+    {
+        auto start = chrono::steady_clock::now();
+        if (plan)
+        {
+            const LevelPlan &decision = plan->levels[Level];
+            for (int k = 0; k < decision.drop_primes; k++)
+            {
+                evaluator.mod_switch_to_next_inplace(node);
+            }
+            if (decision.relinearize)
+            {
+                evaluator.relinearize_inplace(node, relin_keys);
+            }
+        }
+        else if (Level > 0)
+        {
+            evaluator.relinearize_inplace(node, relin_keys);
+        }
+        evaluation_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+};
+
+/*
+One run of the circuit under the given scheme (bgv or bfv). Everything but the scheme is the same for both: the
+parameters, the trial streams and the messages. The returned SchemeRun holds the noise budget, the latency and the
+ciphertext size of every stage and trial.
+*/
+SchemeRun run_bgv_deep(scheme_type scheme)
+{
+    string scheme_name = scheme == scheme_type::bfv ? "bfv" : "bgv";
 
     /* Set number of trials. */
     int trials = 10000;
 
+    /* Trials first_trial, ..., first_trial + trials - 1 are run; trial i draws all of its randomness from (run_seed, i). */
+    uint64_t first_trial = 0;
+    uint64_t run_seed = 1;
+
     /* Set verbose to true for debugging. */
     bool verbose = false;
 
+    /*
+    Secret key distribution (see secret_distribution.h): secret_default lets KeyGenerator sample the secret, the
+    others are sampled from the run seed and passed to KeyGenerator. secret_hamming_weight is the number of nonzero
+    coefficients of a secret_sparse_ternary secret.
+    */
+    SecretDistribution secret_distribution = secret_default;
+    long secret_hamming_weight = 64;
+
+    /*
+    Set slot_packed to true to fill every slot of every plaintext with an independent uniform message mod
+    plain_modulus, instead of a single value in the first slot. The noise probes then also report the variance of the
+    noise coefficients (invariant_noise_budget_and_variance).
+    */
+    bool slot_packed = false;
+
+    /* Set write_results to true to also write every trial to a binary results file (see noise_results.h). */
+    bool write_results = false;
+    string results_path = "bgv_basics_bgv_deep_results" + string(scheme == scheme_type::bfv ? "_bfv" : "") + ".bin";
+
+    /*
+    Set run_planned to true to also evaluate every trial with the relinearization and modulus-switching plan of
+    circuit_planner.h: the cheapest plan whose predicted failure probability stays below 2^log2_target_failure at
+    every node. It runs on the same fresh ciphertexts as the default circuit, and its noise budgets and its
+    speedup over the default circuit are reported at the end. The planner models BGV noise, so the plan is only run
+    under BGV.
+    */
+    bool run_planned = false;
+    double log2_target_failure = -40;
+
     /* Select parameters appropriate for our experiment:
        n < 16384 too small to support computation. */
-    EncryptionParameters parms(scheme_type::bgv);
+    EncryptionParameters parms(scheme);
+    if (scheme == scheme_type::bfv)
+    {
+        run_planned = false;
+    }
 
     size_t poly_modulus_degree = 16384;
     parms.set_poly_modulus_degree(poly_modulus_degree);
@@ -26,13 +361,21 @@ void example_bgv_basics()
     //size_t poly_modulus_degree = 32768;
     //parms.set_poly_modulus_degree(poly_modulus_degree);
 
+    //size_t poly_modulus_degree = 65536;
+    //parms.set_poly_modulus_degree(poly_modulus_degree);
+
     /*
-    Use BFVDefault coeff_modulus. 
+    Use BFVDefault coeff_modulus. It stops at n = 32768: for n = 65536 or 131072 use e.g.
+    CoeffModulus::Create(poly_modulus_degree, vector<int>(30, 59)) or vector<int>(60, 59).
     */
     parms.set_coeff_modulus(CoeffModulus::BFVDefault(poly_modulus_degree));
 
     /* Use same plain_modulus as used in the BGV Basics example. */
     parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, 20));
+
+    /* Draw all randomness from the per-trial counter-based streams */
+    auto trial_prng = make_shared<TrialPRNGFactory>(run_seed);
+    parms.set_random_generator(trial_prng);
     SEALContext context(parms);
 
     /*
@@ -43,14 +386,34 @@ void example_bgv_basics()
     /* Also print exact plaintext modulus chosen. */
     auto &context_data = *context.key_context_data();
     std::cout << "|   plain_modulus: " << context_data.parms().plain_modulus().value() << std::endl;
+    uint64_t plain_modulus = context_data.parms().plain_modulus().value();
+    auto modulus_bits = get_modulus_bits_by_parms_id(context);
 
     /* Generate keys */
-    KeyGenerator keygen(context);
-    SecretKey secret_key = keygen.secret_key();
+    cout << "Run seed: " << run_seed << ", trials " << first_trial << " to " << first_trial + trials - 1 << endl;
+    trial_prng->set_trial(KEYGEN_TRIAL);
+    unique_ptr<KeyGenerator> keygen;
+    if (secret_distribution == secret_default)
+    {
+        keygen.reset(new KeyGenerator(context));
+    }
+    else
+    {
+        TrialRandomStream secret_stream(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_keys, 1));
+        keygen.reset(new KeyGenerator(context, make_secret_key(context, sample_ternary_secret(secret_distribution,
+            long(poly_modulus_degree), secret_hamming_weight, secret_stream))));
+    }
+    cout << "Secret key: " << secret_distribution_name(secret_distribution);
+    if (secret_distribution == secret_sparse_ternary)
+    {
+        cout << ", Hamming weight " << secret_hamming_weight;
+    }
+    cout << endl;
+    SecretKey secret_key = keygen->secret_key();
     PublicKey public_key;
-    keygen.create_public_key(public_key);
+    keygen->create_public_key(public_key);
     RelinKeys relin_keys;
-    keygen.create_relin_keys(relin_keys);
+    keygen->create_relin_keys(relin_keys);
     Encryptor encryptor(context, public_key);
     Evaluator evaluator(context);
     Decryptor decryptor(context, secret_key);
@@ -63,29 +426,69 @@ void example_bgv_basics()
     size_t row_size = slot_count / 2;
 
     /* Construct plaintext and ciphertext objects */
-    Plaintext plain1;
-    Plaintext plain2;
-    Plaintext plain3;
-    Plaintext plain4;
-    Plaintext plain5;
-    Plaintext plain6;
-    Plaintext plain7;
-    Plaintext plain8;
-    Ciphertext encrypted1;
-    Ciphertext encrypted2;
-    Ciphertext encrypted3;
-    Ciphertext encrypted4;
-    Ciphertext encrypted5;
-    Ciphertext encrypted6;
-    Ciphertext encrypted7;
-    Ciphertext encrypted8;
-    Ciphertext encrypted9;
-    Ciphertext encrypted10;
-    Ciphertext encrypted11;
-    Ciphertext encrypted12;
-    Ciphertext encrypted13;
-    Ciphertext encrypted14;
-    Ciphertext encrypted15;
+    vector<Plaintext> plains(DeepCircuit::leaves);
+    DeepCircuit::Buffers<SEALDeepBackend> buffers;
+    SEALDeepBackend backend(encryptor, evaluator, decryptor, relin_keys, plains, context, secret_key, slot_packed);
+
+    /* The plan, with the default circuit (relinearize after levels 1 and 2) under the same model for comparison */
+    DeepCircuit::Buffers<SEALDeepBackend> planned_buffers;
+    SEALDeepBackend planned_backend(encryptor, evaluator, decryptor, relin_keys, plains, context, secret_key,
+        slot_packed);
+    CircuitPlan default_plan, plan;
+    if (run_planned)
+    {
+        PlannerModel model;
+        model.n = double(poly_modulus_degree);
+        model.t = double(plain_modulus);
+        model.secret_variance = secret_coefficient_variance(secret_distribution, long(poly_modulus_degree), secret_hamming_weight);
+        model.depth = DeepCircuit::stages - 1;
+        model.log2_target_failure = log2_target_failure;
+        const auto &key_moduli = context.key_context_data()->parms().coeff_modulus();
+        double log_q = 0;
+        for (size_t i = 0; i + 1 < key_moduli.size(); i++)
+        {
+            log_q += log2(double(key_moduli[i].value()));
+            model.log_digit = max(model.log_digit, log2(double(key_moduli[i].value())));
+            model.chain_log_q.push_back(log_q);
+        }
+        model.log_special = log2(double(key_moduli.back().value()));
+
+        vector<LevelPlan> relinearize_after_products(model.depth);
+        for (int level = 1; level < model.depth; level++)
+        {
+            relinearize_after_products[level].relinearize = true;
+        }
+        default_plan = evaluate_plan(model, relinearize_after_products);
+        plan = plan_circuit(model);
+        cout << "Default circuit:" << endl;
+        print_plan(default_plan);
+        if (!plan.feasible)
+        {
+            cout << "No plan keeps the predicted failure probability below 2^" << log2_target_failure
+                 << "; not running the planned circuit" << endl << endl;
+            run_planned = false;
+        }
+        else
+        {
+            cout << "Planned circuit (target 2^" << log2_target_failure << "):" << endl;
+            print_plan(plan);
+            cout << "Predicted speedup: " << default_plan.cost / plan.cost << endl << endl;
+            planned_backend.plan = &plan;
+        }
+    }
+
+    /* Optional per-trial binary output: one stage per noise probe below. SEAL has no noise estimate, so that column is NaN. */
+    vector<string> stage_names = {"fresh", "mult1", "mult2", "mult3"};
+    SchemeRun scheme_run(scheme_name, stage_names);
+    unique_ptr<NoiseResultsWriter> results_writer;
+    if (write_results)
+    {
+        NoiseResultsHeader header = make_noise_results_header("SEAL", "bgv_deep", poly_modulus_degree,
+            context_data.parms().plain_modulus().value(), modulus_bits.at(context.first_parms_id()), stage_names,
+            first_trial);
+        results_writer.reset(new NoiseResultsWriter(results_path, header));
+    }
+    const double no_estimate = numeric_limits<double>::quiet_NaN();
 
     /* Holders for the running total of the observed noises in ciphertexts */
     double total_fresh_observed(0);
@@ -93,90 +496,104 @@ void example_bgv_basics()
     double total_mult2_observed(0);
     double total_mult3_observed(0);
 
+    /* Holders for the running total of log2 of the noise coefficient variances (slot-packed mode only) */
+    double total_fresh_log_variance(0);
+    double total_mult1_log_variance(0);
+    double total_mult2_log_variance(0);
+    double total_mult3_log_variance(0);
+
+    /* Parts, primes and in-memory bytes of the probed ciphertexts, printed with the peak resident set */
+    FootprintTable footprints(stage_names);
+
+    /* Running totals of the planned circuit, and evaluation times of both circuits */
+    vector<double> total_planned_observed(DeepCircuit::stages, 0);
+    double min_planned_root_observed = numeric_limits<double>::infinity();
+    long planned_failures = 0;
+    double total_default_seconds = 0;
+    double total_planned_seconds = 0;
+
     /* Gather data */
     for (int i = 0; i < trials; i++)
     {
+         /* All randomness of this trial comes from (run_seed, trial) */
+         uint64_t trial = first_trial + i;
+         trial_prng->set_trial(trial);
 
          /*
          Here we create the input plaintext matrices 
-         encrypting i+1, ...., i+8 respectively in the first slot.
+         encrypting trial+1, ...., trial+8 respectively in the first slot,
+         and encode them into plaintexts.
          */
+         TrialRandomStream messages(run_seed, trial, trial_stream_id(stream_messages));
+         for (int leaf = 0; leaf < DeepCircuit::leaves; leaf++)
+         {
+             vector<uint64_t> pod_matrix(slot_count, 0ULL);
+             pod_matrix[0] = trial + 1 + leaf;
+             if (slot_packed)
+             {
+                 fill_slots_uniform(pod_matrix, messages, plain_modulus);
+             }
+             batch_encoder.encode(pod_matrix, plains[leaf]);
+         }
 
-         vector<uint64_t> pod_matrix1(slot_count, 0ULL);
-         pod_matrix1[0] = i+1;
-         vector<uint64_t> pod_matrix2(slot_count, 0ULL);
-         pod_matrix2[0] = i+2;
-         vector<uint64_t> pod_matrix3(slot_count, 0ULL);
-         pod_matrix3[0] = i+3;
-         vector<uint64_t> pod_matrix4(slot_count, 0ULL);
-         pod_matrix4[0] = i+4;
-         vector<uint64_t> pod_matrix5(slot_count, 0ULL);
-         pod_matrix5[0] = i+5;
-         vector<uint64_t> pod_matrix6(slot_count, 0ULL);
-         pod_matrix6[0] = i+6;
-         vector<uint64_t> pod_matrix7(slot_count, 0ULL);
-         pod_matrix7[0] = i+7;
-         vector<uint64_t> pod_matrix8(slot_count, 0ULL);
-         pod_matrix8[0] = i+8;
-
-         /* Encode the matrices into plaintexts. */
-         batch_encoder.encode(pod_matrix1, plain1);
-         batch_encoder.encode(pod_matrix2, plain2);
-         batch_encoder.encode(pod_matrix3, plain3);
-         batch_encoder.encode(pod_matrix4, plain4);
-         batch_encoder.encode(pod_matrix5, plain5);
-         batch_encoder.encode(pod_matrix6, plain6);
-         batch_encoder.encode(pod_matrix7, plain7);
-         batch_encoder.encode(pod_matrix8, plain8);
-
-         /* Encrypt the plaintexts into ciphertexts */
-         encryptor.encrypt(plain1, encrypted1);
-         encryptor.encrypt(plain2, encrypted2);
-         encryptor.encrypt(plain3, encrypted3);
-         encryptor.encrypt(plain4, encrypted4);
-         encryptor.encrypt(plain5, encrypted5);
-         encryptor.encrypt(plain6, encrypted6);
-         encryptor.encrypt(plain7, encrypted7);
-         encryptor.encrypt(plain8, encrypted8);
-
-         /* What is the noise growth after fresh encryption? */
-         auto fresh_noise = decryptor.invariant_noise_budget(encrypted1);
-         total_fresh_observed += fresh_noise;
-
-        /*  Multiply the ciphertexts pairwise and store the output in encrypted9, ... , encrypted12 */
-         evaluator.multiply(encrypted1, encrypted2, encrypted9);
-         evaluator.multiply(encrypted3, encrypted4, encrypted10);
-         evaluator.multiply(encrypted5, encrypted6, encrypted11);
-         evaluator.multiply(encrypted7, encrypted8, encrypted12);
+         /*
+         Encrypt the plaintexts, multiply the ciphertexts pairwise level by level (8 -> 4 -> 2 -> 1, relinearizing
+         between levels) and probe the first ciphertext of every level: straight-line code, expanded at compile time
+         */
+         DeepCircuit::run(backend, buffers);
 
-         /* What is the noise growth after first multiplication? */
-         auto mult1_noise = decryptor.invariant_noise_budget(encrypted9);
+         /* What is the noise growth after fresh encryption, and after each multiplication? */
+         auto fresh_noise = backend.noise[0];
+         auto mult1_noise = backend.noise[1];
+         auto mult2_noise = backend.noise[2];
+         auto mult3_noise = backend.noise[3];
+         total_fresh_observed += fresh_noise;
          total_mult1_observed += mult1_noise;
-
-        /* Relinearize */
-        evaluator.relinearize_inplace(encrypted9, relin_keys); 
-        evaluator.relinearize_inplace(encrypted10, relin_keys); 
-        evaluator.relinearize_inplace(encrypted11, relin_keys); 
-        evaluator.relinearize_inplace(encrypted12, relin_keys); 
-
-        /*  Multiply the ciphertexts pairwise and store the output in encrypted13, encrypted14 */
-         evaluator.multiply(encrypted9, encrypted10, encrypted13);
-         evaluator.multiply(encrypted11, encrypted12, encrypted14); 
-
-         /* What is the noise growth after second multiplication? */
-         auto mult2_noise = decryptor.invariant_noise_budget(encrypted13);
          total_mult2_observed += mult2_noise;
-
-        /* Relinearize */
-        evaluator.relinearize_inplace(encrypted13, relin_keys); 
-        evaluator.relinearize_inplace(encrypted14, relin_keys); 
-
-        /*  Multiply the ciphertexts encrypted13 and encrypted14 and stored in encrypted15 */
-         evaluator.multiply(encrypted13, encrypted14, encrypted15);
-
-         /* What is the noise growth after third multiplication? */
-         auto mult3_noise = decryptor.invariant_noise_budget(encrypted15);
          total_mult3_observed += mult3_noise;
+         total_fresh_log_variance += backend.log_variance[0];
+         total_mult1_log_variance += backend.log_variance[1];
+         total_mult2_log_variance += backend.log_variance[2];
+         total_mult3_log_variance += backend.log_variance[3];
+         for (int stage = 0; stage < DeepCircuit::stages; stage++)
+         {
+             scheme_run.record(stage, backend.noise[stage], backend.seconds[stage], backend.bytes[stage]);
+             footprints.record(stage, backend.parts[stage], backend.primes[stage],
+                 ciphertext_bytes(backend.parts[stage], backend.primes[stage], long(poly_modulus_degree)));
+         }
+
+         /* The planned circuit, on the same fresh ciphertexts: the trial's random stream starts again */
+         if (run_planned)
+         {
+             trial_prng->set_trial(trial);
+             planned_backend.evaluation_seconds = 0;
+             DeepCircuit::run(planned_backend, planned_buffers);
+             for (int stage = 0; stage < DeepCircuit::stages; stage++)
+             {
+                 total_planned_observed[stage] += planned_backend.noise[stage];
+             }
+             double root_noise = planned_backend.noise[DeepCircuit::stages - 1];
+             min_planned_root_observed = min(min_planned_root_observed, root_noise);
+             planned_failures += root_noise <= 0;
+             total_default_seconds += backend.evaluation_seconds;
+             total_planned_seconds += planned_backend.evaluation_seconds;
+         }
+         backend.evaluation_seconds = 0;
+
+         if (results_writer)
+         {
+             for (int stage = 0; stage < DeepCircuit::stages; stage++)
+             {
+                 results_writer->record(stage, backend.noise[stage], no_estimate, backend.seconds[stage]);
+             }
+             results_writer->end_trial();
+         }
+    }
+
+    if (results_writer)
+    {
+        results_writer->close();
+        cout << "Per-trial results written to " << results_path << endl << endl;
     }
 
     /* Debugging: check that decryption is correct. */
@@ -184,7 +601,7 @@ void example_bgv_basics()
     {
         cout << "Check correctness:" << endl;
         Plaintext decrypted_result;
-        decryptor.decrypt(encrypted15, decrypted_result);
+        decryptor.decrypt(buffers[DeepCircuit::root], decrypted_result);
         vector<uint64_t> pod_result;
         batch_encoder.decode(decrypted_result, pod_result);
         print_matrix(pod_result, row_size);
@@ -197,20 +614,77 @@ void example_bgv_basics()
     auto mean_mult3_observed = total_mult3_observed / trials;
 
     /* Print out the results */
+    cout << "Scheme: " << scheme_name << endl << endl;
     cout << "After fresh encryption:" << endl;
     cout << "Mean noise budget observed: " << mean_fresh_observed  << endl;    
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_fresh_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After first multiplication:" << endl;
     cout << "Mean noise budget observed: " << mean_mult1_observed  << endl;    
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_mult1_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After second multiplication:" << endl;
     cout << "Mean noise budget observed: " << mean_mult2_observed  << endl;    
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_mult2_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After third multiplication:" << endl;
     cout << "Mean noise budget observed: " << mean_mult3_observed  << endl;    
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_mult3_log_variance / trials << endl;
+    }
     cout << endl;
 
+    /* The global pool serves all of SEAL's allocations and never returns memory, so this is its high-water mark */
+    footprints.print(cout, size_t(MemoryManager::GetPool().alloc_byte_count()));
+
+    if (run_planned)
+    {
+        cout << "Planned circuit:" << endl;
+        for (int stage = 0; stage < DeepCircuit::stages; stage++)
+        {
+            cout << stage_names[stage] << ": mean noise budget observed " << total_planned_observed[stage] / trials
+                 << " (predicted " << plan.predicted_budget[stage] << ", default circuit predicted "
+                 << default_plan.predicted_budget[stage] << ")" << endl;
+        }
+        cout << "Minimum noise budget observed after the third multiplication: " << min_planned_root_observed
+             << ", decryption failures: " << planned_failures << " of " << trials << endl;
+        cout << "Mean evaluation time: default circuit " << total_default_seconds / trials * 1000 << " ms, planned "
+             << total_planned_seconds / trials * 1000 << " ms, speedup " << total_default_seconds / total_planned_seconds
+             << " (predicted " << default_plan.cost / plan.cost << ")" << endl;
+        cout << endl;
+    }
+
+    return scheme_run;
+}
+
+void example_bgv_basics()
+{
+    print_example_banner("Example: BGV Basics");
+
+    /*
+    Set compare_schemes to true to run the circuit a second time under BFV, with identical parameters and trial
+    streams, and print the noise budget, latency and ciphertext size of every stage side by side.
+    */
+    bool compare_schemes = false;
+
+    vector<SchemeRun> runs;
+    runs.push_back(run_bgv_deep(scheme_type::bgv));
+    if (compare_schemes)
+    {
+        runs.push_back(run_bgv_deep(scheme_type::bfv));
+        print_scheme_comparison(runs);
+    }
 }
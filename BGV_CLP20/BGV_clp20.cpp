@@ -8,11 +8,21 @@
 
 #include <iostream>
 #include <iomanip>
+#include <chrono>
+#include <memory>
 
 #include <helib/helib.h>
 #include <helib/binaryArith.h>
 #include <helib/intraSlot.h>
 
+#include "bgv_heuristics.h"
+#include "counter_rng.h"
+#include "drift_monitor.h"
+#include "modulus_cache.h"
+#include "noise_results.h"
+#include "secret_distribution.h"
+#include "sweep_coordinator.h"
+
 //#include "EncryptedArray.h"
 //#include "FHE.h"
 //#include "norms.h"
@@ -22,70 +32,222 @@ using namespace std;
 /*
 This function computes, for a given chain of operations, over a user-specified number of trials,
 an average observed noise growth in ciphertexts.
+Trials are numbered from first_trial, and trial i only depends on (run seed, i), so any range of
+trials of a run can be replayed on its own.
+A sweep work unit passes sweep_m, which replaces the m selected below, and statistics, which receives the
+statistics of every stage.
+*/
+void test_noise(int trials, long first_trial = 0, unsigned long sweep_m = 0, vector<StageStatistics>* statistics = nullptr);
+
+/*
+This function runs trials_per_config trials of every parameter set of Table 1 in worker processes, and prints
+the merged statistics of every stage (see common/sweep_coordinator.h).
 */
-void test_noise(int trials);
+void run_sweep_mode(long trials_per_config, unsigned workers);
 
 /* Helper functions */
-NTL::xdouble get_sum_of_squared_differences(NTL::xdouble mean, vector<NTL::xdouble> array, int size_of_array);
-NTL::xdouble get_standard_dev(NTL::xdouble mean, vector<NTL::xdouble> array, int trials);
-NTL::xdouble get_noise();
-NTL::xdouble get_noise_budget(helib::Ctxt encrypted, helib::SecKey secret_key);
-NTL::xdouble get_helib_estimated_noise_budget(helib::Ctxt encrypted);
+double get_sum_of_squared_differences(double mean, const vector<double>& array, int size_of_array);
+double get_standard_dev(double mean, const vector<double>& array, int trials);
+double log2_of_zz(const NTL::ZZ& value);
+double get_log2_noise(const helib::Ctxt& encrypted, const helib::SecKey& secret_key);
+double get_log2_q(const helib::Ctxt& encrypted);
+const helib::DoubleCRT& get_secret_key_power(const helib::SecKey& secret_key, const helib::IndexSet& primes, long power);
+void get_noise_poly(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, NTL::ZZX& noise_poly);
+double get_noise_budget(const helib::Ctxt& encrypted, const helib::SecKey& secret_key);
+double get_helib_estimated_noise_budget(const helib::Ctxt& encrypted);
+double get_noise_budget_and_variance(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, double& log_variance);
+void fill_slots_uniform(helib::Ptxt<helib::BGV>& plain, TrialRandomStream& messages, unsigned long p);
+void seed_ntl_for_trial(uint64_t run_seed, uint64_t trial, uint32_t stream);
+void import_secret_key(helib::SecKey& secret_key, const helib::Context& context, const vector<int>& coefficients);
 
-NTL::xdouble get_sum_of_squared_differences(NTL::xdouble mean, vector<NTL::xdouble> array, int size_of_array)
+/*
+Noise budgets are in bits (well under 1000), so all of the statistics below are plain doubles. The only
+multi-precision value is the noise itself, which is converted to log2 once, by log2_of_zz.
+*/
+double get_sum_of_squared_differences(double mean, const vector<double>& array, int size_of_array)
 {
-    NTL::xdouble sum_of_squared_differences(0);
-    NTL::xdouble temp(0);
-
-    for (int i=0; i<size_of_array; i++)
+    double sum_of_squared_differences = 0;
+    for (int i = 0; i < size_of_array; i++)
     {
-        temp = array[i] - mean;
-        temp = temp * temp;
-        sum_of_squared_differences += temp;
+        double difference = array[i] - mean;
+        sum_of_squared_differences += difference * difference;
     }
     return sum_of_squared_differences;
 }
 
-NTL::xdouble get_standard_dev(NTL::xdouble mean, vector<NTL::xdouble> array, int trials)
+double get_standard_dev(double mean, const vector<double>& array, int trials)
+{
+    double variance = get_sum_of_squared_differences(mean, array, trials) / (trials - 1);
+    return sqrt(variance);
+}
+
+/* log2 of a (possibly very large) integer, without overflow: NTL's log(ZZ) works from the exponent and leading bits */
+double log2_of_zz(const NTL::ZZ& value)
+{
+    return NTL::log(value) / log(2.0);
+}
+
+/*
+log2 q of the prime set of encrypted. There are only a few distinct prime sets per run, so the value is cached
+per prime set in log2_q_cache, which must be cleared whenever a new context is built.
+*/
+PrimeSetLog2Cache log2_q_cache;
+
+double get_log2_q(const helib::Ctxt& encrypted)
+{
+    const helib::IndexSet& primes = encrypted.getPrimeSet();
+    auto compute = [&]() { return encrypted.getContext().logOfProduct(primes)/log(2.0); };
+    if (primes.card() == 0 || primes.last() >= 64)
+    {
+        return compute();
+    }
+    uint64_t mask = 0;
+    for (long i = primes.first(); i <= primes.last(); i = primes.next(i))
+    {
+        mask |= uint64_t(1) << i;
+    }
+    return log2_q_cache.lookup(mask, compute);
+}
+
+/*
+Powers s, s^2, ... of the secret key over each prime set, in DoubleCRT form. SecKey::Decrypt copies the key, drops
+the extra primes and raises it to the power of each ciphertext part on every call; the noise probes instead compute
+the powers once per prime set. Must be cleared whenever a new key is generated.
+*/
+vector<pair<helib::IndexSet, vector<helib::DoubleCRT>>> secret_key_powers;
+
+const helib::DoubleCRT& get_secret_key_power(const helib::SecKey& secret_key, const helib::IndexSet& primes, long power)
+{
+    size_t entry = 0;
+    while (entry < secret_key_powers.size() && !(secret_key_powers[entry].first == primes))
+    {
+        entry++;
+    }
+    if (entry == secret_key_powers.size())
+    {
+        secret_key_powers.emplace_back(primes, vector<helib::DoubleCRT>());
+    }
+    vector<helib::DoubleCRT>& powers = secret_key_powers[entry].second;
+    while (long(powers.size()) < power)
+    {
+        if (powers.empty())
+        {
+            helib::DoubleCRT key = secret_key.sKeys.at(0);
+            key.removePrimes(key.getIndexSet() / primes);
+            powers.push_back(key);
+        }
+        else
+        {
+            helib::DoubleCRT next = powers.back();
+            next *= powers.front();
+            powers.push_back(next);
+        }
+    }
+    return powers[power - 1];
+}
+
+/*
+The noise polynomial c0 + c1 s + c2 s^2 + ... of encrypted, reduced centered mod q, as returned by SecKey::Decrypt.
+The sum is taken pointwise in evaluation form with the cached powers of the key, so the only transform is the final
+conversion to coefficients. Parts under an automorphism of the key (not key-switched) go through SecKey::Decrypt.
+*/
+void get_noise_poly(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, NTL::ZZX& noise_poly)
 {
-    NTL::xdouble trials_copy(trials);
-    NTL::xdouble denominator = trials_copy - 1;
-    NTL::xdouble sum_sq_diff = get_sum_of_squared_differences(mean, array, trials);
-    NTL::xdouble variance = sum_sq_diff / denominator;
-    NTL::xdouble std_dev = sqrt(variance);
-    return std_dev;
+    for (long i = 1; i < encrypted.partsSize(); i++)
+    {
+        const helib::SKHandle& handle = encrypted[i].skHandle;
+        if (handle.getPowerOfX() != 1 || handle.getSecretKeyID() != 0)
+        {
+            NTL::ZZX plaintext;
+            secret_key.Decrypt(plaintext, encrypted, noise_poly);
+            return;
+        }
+    }
+    helib::DoubleCRT sum = encrypted[0];
+    for (long i = 1; i < encrypted.partsSize(); i++)
+    {
+        helib::DoubleCRT term = encrypted[i];
+        term *= get_secret_key_power(secret_key, encrypted[i].getIndexSet(), encrypted[i].skHandle.getPowerOfS());
+        sum += term;
+    }
+    sum.toPoly(noise_poly);
 }
 
 /* Inspired by the HElib debugging function decryptAndPrint */
-NTL::xdouble get_noise(helib::Ctxt encrypted, helib::SecKey secret_key)
+double get_log2_noise(const helib::Ctxt& encrypted, const helib::SecKey& secret_key)
+{
+    NTL::ZZX noise_poly;
+    get_noise_poly(encrypted, secret_key, noise_poly);
+    return log2_of_zz(helib::largestCoeff(noise_poly));
+}
+
+double get_noise_budget(const helib::Ctxt& encrypted, const helib::SecKey& secret_key)
+{
+    double log_q = get_log2_q(encrypted);
+    return log_q - get_log2_noise(encrypted, secret_key) - 1;
+}
+
+double get_helib_estimated_noise_budget(const helib::Ctxt& encrypted)
+{
+    double log_helib_est_noise = log(encrypted.getNoiseBound())/log(2.0);
+    double log_q = get_log2_q(encrypted);
+    return log_q - log_helib_est_noise - 1;
+}
+
+/*
+As get_noise_budget, also returning log2 of the empirical variance of the n coefficients of the noise polynomial.
+Each coefficient is a sample of the noise distribution, so one probe gives n samples rather than only the maximum.
+*/
+double get_noise_budget_and_variance(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, double& log_variance)
+{
+    NTL::ZZX noise_poly;
+    NTL::ZZ sum_of_squares(0);
+    get_noise_poly(encrypted, secret_key, noise_poly);
+    for (long j = 0; j <= deg(noise_poly); j++)
+    {
+        sum_of_squares += sqr(coeff(noise_poly, j));
+    }
+    log_variance = log2_of_zz(sum_of_squares) - log2(double(encrypted.getContext().getPhiM()));
+    double log_q = get_log2_q(encrypted);
+    return log_q - log2_of_zz(helib::largestCoeff(noise_poly)) - 1;
+}
+
+/*
+Fill every slot of plain with an independent uniform message. The slots are sampled together as a uniform
+message polynomial mod p, so that slots of degree greater than one are uniform over their whole field.
+*/
+void fill_slots_uniform(helib::Ptxt<helib::BGV>& plain, TrialRandomStream& messages, unsigned long p)
 {
-    NTL::ZZX plaintext, noise_poly;
-    NTL::ZZ noise_zz;
-    NTL::xdouble noise;
-    secret_key.Decrypt(plaintext, encrypted, noise_poly);
-    noise_zz = helib::largestCoeff(noise_poly);
-    conv(noise, noise_zz);
-    return noise;
+    NTL::ZZX message_poly;
+    long phi_m = plain.getContext().getPhiM();
+    for (long j = 0; j < phi_m; j++)
+    {
+        SetCoeff(message_poly, j, long(messages.uniform(p)));
+    }
+    plain.decodeSetData(message_poly);
 }
 
-NTL::xdouble get_noise_budget(helib::Ctxt encrypted, helib::SecKey secret_key)
+/*
+HElib samples all encryption and key randomness from NTL's current (thread-local) random stream.
+Reseeding it from the counter-based stream for (run seed, trial) makes each trial reproducible.
+*/
+void seed_ntl_for_trial(uint64_t run_seed, uint64_t trial, uint32_t stream)
 {
-    NTL::xdouble noise, log_noise, log_q, noise_budget;
-    noise = get_noise(encrypted, secret_key);
-    log_noise = log(noise)/log(NTL::xdouble(2));
-    log_q = NTL::xdouble(encrypted.getContext().logOfProduct(encrypted.getPrimeSet())/log(2));
-    noise_budget = log_q - log_noise - 1;
-    return noise_budget;
+    unsigned char seed[32];
+    TrialRandomStream(run_seed, trial, stream).fill_bytes(seed, sizeof(seed));
+    NTL::SetSeed(seed, sizeof(seed));
 }
 
-NTL::xdouble get_helib_estimated_noise_budget(helib::Ctxt encrypted)
+/* Use coefficients as the secret key, in place of SecKey::GenSecKey; this also generates the public key */
+void import_secret_key(helib::SecKey& secret_key, const helib::Context& context, const vector<int>& coefficients)
 {
-    NTL::xdouble helib_est_noise, log_helib_est_noise, log_q, helib_est_noise_budget;
-    helib_est_noise = encrypted.getNoiseBound();
-    log_helib_est_noise = log(helib_est_noise)/log(NTL::xdouble(2));
-    log_q = NTL::xdouble(encrypted.getContext().logOfProduct(encrypted.getPrimeSet())/log(2));
-    helib_est_noise_budget = log_q - log_helib_est_noise - 1;
-    return helib_est_noise_budget;
+    NTL::ZZX secret_poly;
+    for (size_t j = 0; j < coefficients.size(); j++)
+    {
+        SetCoeff(secret_poly, j, coefficients[j]);
+    }
+    helib::DoubleCRT secret_dcrt(secret_poly, context, context.getCtxtPrimes() | context.getSpecialPrimes());
+    secret_key.ImportSecKey(secret_dcrt, helib::embeddingLargestCoeff(secret_poly, context.getZMStar()));
 }
 
 int main()
@@ -95,6 +257,8 @@ int main()
     {
         cout << "\n HElib noise budget experiments:" << endl << endl;
         cout << "  1. Observed Noise Test" << endl;
+        cout << "  2. Observed Noise Test (trial range)" << endl;
+        cout << "  3. Observed Noise Sweep (worker processes)" << endl;
         cout << "  0. Exit" << endl;
 
         int selection = 0;
@@ -121,6 +285,44 @@ int main()
             break;
         }
 
+        case 2: {
+            long first_trial;
+            int trials;
+            cout << "First trial: ";
+            if (!(cin >> first_trial) || (first_trial < 0))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            cout << "Trials: ";
+            if (!(cin >> trials) || (trials < 1))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            test_noise(trials, first_trial);
+            break;
+        }
+
+        case 3: {
+            long trials;
+            unsigned workers;
+            cout << "Trials per parameter set: ";
+            if (!(cin >> trials) || (trials < 1))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            cout << "Worker processes: ";
+            if (!(cin >> workers) || (workers < 1))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            run_sweep_mode(trials, workers);
+            break;
+        }
+
         case 0: 
             return 0;
 
@@ -133,18 +335,139 @@ int main()
     return 0;
 }
 
-void test_noise(int trials)
+void run_sweep_mode(long trials_per_config, unsigned workers)
+{
+    vector<unsigned long> ms = {4096, 8192, 16384, 32768};
+    vector<string> stage_names = {"fresh", "add", "mult", "modswitch", "pmult", "cmult", "rotate", "rotate_many"};
+
+    /*
+    Each work unit is a call of test_noise for trials_per_unit trials, which builds the context and keys of its
+    parameter set; larger units amortise that set-up, smaller ones lose less work when a worker dies.
+    */
+    long trials_per_unit = 250;
+    SweepOptions options;
+    options.workers = workers;
+    options.max_attempts = 3;
+    options.fault_rate = 0;     // set above 0 to kill workers at random and test the reassignment of their units
+
+    auto work = [&](const SweepUnit& unit) {
+        /* The output of test_noise in the workers would interleave with the coordinator's */
+        static bool quiet = false;
+        if (!quiet)
+        {
+            cout.flush();
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+            quiet = true;
+        }
+        vector<StageStatistics> statistics;
+        test_noise(int(unit.trials), long(unit.first_trial), ms[unit.config], &statistics);
+        cout.flush();
+        return statistics;
+    };
+
+    vector<SweepUnit> units = make_sweep_units(ms.size(), trials_per_config, trials_per_unit);
+    cout << "Sweep: " << ms.size() << " parameter sets, " << trials_per_config << " trials each, " << units.size()
+         << " work units, " << workers << " worker processes" << endl << endl;
+    auto sweep_start = chrono::steady_clock::now();
+    SweepResult result = run_sweep(units, ms.size(), work, options);
+    double sweep_seconds = chrono::duration<double>(chrono::steady_clock::now() - sweep_start).count();
+
+    for (size_t config = 0; config < ms.size(); config++)
+    {
+        cout << endl << "m = " << ms[config] << endl;
+        cout << setw(12) << "stage" << setw(10) << "trials" << setw(12) << "observed" << setw(12) << "std dev"
+             << setw(12) << "HElib est" << setw(14) << "seconds" << endl;
+        const vector<StageStatistics>& stages = result.configs[config];
+        for (size_t stage = 0; stage < stages.size() && stage < stage_names.size(); stage++)
+        {
+            if (stages[stage].observed.count == 0)
+            {
+                continue;
+            }
+            cout << setw(12) << stage_names[stage] << setw(10) << stages[stage].observed.count << fixed
+                 << setprecision(2) << setw(12) << stages[stage].observed.mean << setw(12)
+                 << stages[stage].observed.standard_deviation() << setw(12) << stages[stage].estimate.mean
+                 << setprecision(6) << setw(14) << stages[stage].seconds.mean << defaultfloat << endl;
+        }
+    }
+    cout << endl << "Sweep finished in " << sweep_seconds << " s, " << result.worker_deaths << " worker deaths";
+    if (!result.failed_units.empty())
+    {
+        cout << ", " << result.failed_units.size() << " work units failed (first: trials "
+             << units[result.failed_units[0]].first_trial << " of m = " << ms[units[result.failed_units[0]].config] << ")";
+    }
+    cout << endl << endl;
+}
+
+void test_noise(int trials, long first_trial, unsigned long sweep_m, vector<StageStatistics>* statistics)
 {
     /* Set verbose to true for debugging. */
     bool verbose = false;
 
-    NTL::xdouble trials_copy(trials);
+    /*
+    Set slot_packed to true to fill every slot of every plaintext with an independent uniform message mod p,
+    instead of a single value in slot 0. The noise probes then also report the variance of the noise coefficients.
+    */
+    bool slot_packed = false;
+
+    /*
+    The plaintext multiplication stage multiplies the fresh ciphertext by a fixed plaintext with centered uniform
+    coefficients, and the constant multiplication stage by the integer scalar 1024. HElib reduces a ZZ constant
+    mod p, and at p = 3 every centered value mod p is at most 1 and leaves the noise unchanged, so the scalar
+    is applied unreduced as a constant DoubleCRT: it scales the noise by 1024 (10 bits) and the message by
+    1024 mod p. Set cached_plaintext to true to encode the plaintext multiplier once, in DoubleCRT (NTT) form,
+    and reuse it across trials; otherwise it is re-encoded for every multiplication.
+    */
+    bool cached_plaintext = true;
+
+    /*
+    The rotation stage rotates the fresh ciphertext by one slot with ea.rotate. The multi-rotation stage applies the
+    automorphisms for 1, ..., rotation_count steps along the first dimension to the fresh ciphertext. Set
+    hoisted_rotations to true to share one key-switching decomposition of the ciphertext across all of them
+    (HElib's GeneralAutomorphPrecon); otherwise each automorphism is key switched on its own. Its timing is per
+    rotation, including the shared decomposition, and its noise is the mean over the rotations.
+    */
+    bool hoisted_rotations = true;
+    long rotation_count = 8;
+
+    /*
+    Set write_results to true to also write every trial to a binary results file (see common/noise_results.h). The
+    file is named after m and the first trial, e.g. BGV_clp20_results_m8192_t0.bin, so that the work units of a sweep,
+    each a run of its own, write files of their own.
+    */
+    bool write_results = false;
+    string results_prefix = "BGV_clp20_results";
+
+    /* Seed of the whole run: trial i draws all of its randomness from (run_seed, i) */
+    uint64_t run_seed = 1;
+
+    /*
+    Secret key distribution (see common/secret_distribution.h): secret_default uses SecKey::GenSecKey, the others
+    are sampled from the run seed and imported. secret_hamming_weight is the number of nonzero coefficients of a
+    secret_sparse_ternary secret. The predictions of the drift monitor follow the distribution.
+    */
+    SecretDistribution secret_distribution = secret_default;
+    long secret_hamming_weight = 64;
+
+    /*
+    Every report_every trials, print the throughput, the time remaining and the drift of the observed noise budgets
+    from the average-case prediction (see common/drift_monitor.h). Set abort_drift_bits above 0 to stop the run
+    once the drift of some stage is beyond that many bits.
+    */
+    long report_every = 100;
+    double abort_drift_bits = 0;
 
     /* Select parameters appropriate for our experiment */
     unsigned long m = 4096; // polynomial modulus n = 2048
     //unsigned long m = 8192; // polynomial modulus n = 4096
     //unsigned long m = 16384; // polynomial modulus n = 8192
     //unsigned long m = 32768; // polynomial modulus n = 16384
+    if (sweep_m != 0)
+    {
+        m = sweep_m;
+    }
     unsigned long p = 3;    // set plaintext modulus t = 3
     unsigned long s = 1;    // lower bound for number of plaintext slots
     
@@ -195,6 +518,7 @@ void test_noise(int trials)
                                .bits(bits)
                                .c(c)
                                .build();
+    log2_q_cache.clear();
 
 
     // Print the context.
@@ -202,8 +526,27 @@ void test_noise(int trials)
     std::cout << std::endl;
 
     /* Generate keys */
+    cout << "Run seed: " << run_seed << ", trials " << first_trial << " to " << first_trial + trials - 1 << endl << endl;
+    seed_ntl_for_trial(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_keys));
     helib::SecKey secret_key(context);
-    secret_key.GenSecKey();
+    if (secret_distribution == secret_default)
+    {
+        secret_key.GenSecKey();
+    }
+    else
+    {
+        TrialRandomStream secret_stream(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_keys, 1));
+        import_secret_key(secret_key, context, sample_ternary_secret(secret_distribution, context.getPhiM(),
+            secret_hamming_weight, secret_stream));
+    }
+    secret_key_powers.clear();
+    cout << "Secret key: " << secret_distribution_name(secret_distribution);
+    if (secret_distribution == secret_sparse_ternary)
+    {
+        cout << ", Hamming weight " << secret_hamming_weight;
+    }
+    cout << endl << endl;
+    helib::addSome1DMatrices(secret_key);
     const helib::PubKey& public_key = secret_key;
      
     /* Construct plaintext and ciphertext objects */
@@ -213,50 +556,149 @@ void test_noise(int trials)
     helib::Ctxt encrypted1(public_key);
     helib::Ctxt encrypted2(public_key);
     helib::Ctxt encrypted3(public_key);
+    helib::Ctxt encrypted4(public_key);
+    helib::Ctxt encrypted5(public_key);
+    helib::Ctxt encrypted6(public_key);
+
+    /* There are only sizeOfDimension(0) - 1 distinct non-trivial rotations along the first dimension */
+    rotation_count = min(rotation_count, ea.sizeOfDimension(0) - 1);
+
+    /*
+    Plaintext multiplier: a fixed polynomial with centered uniform coefficients mod p. The cached form is a DoubleCRT
+    over the ciphertext primes (the prime set of a fresh ciphertext), with its size, which HElib's noise estimate
+    needs, computed once.
+    */
+    NTL::ZZX multiplier_poly;
+    TrialRandomStream multiplier_stream(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_messages, 1));
+    for (long j = 0; j < context.getPhiM(); j++)
+    {
+        SetCoeff(multiplier_poly, j, long(multiplier_stream.uniform(p)) - long(p / 2));
+    }
+    helib::DoubleCRT multiplier_dcrt(multiplier_poly, context, context.getCtxtPrimes());
+    double multiplier_size = helib::embeddingLargestCoeff(multiplier_poly, context.getZMStar());
+    long constant = 1024;
+    NTL::ZZX constant_poly;
+    SetCoeff(constant_poly, 0, constant);
+    helib::DoubleCRT constant_dcrt(constant_poly, context, context.getCtxtPrimes());
+
+    /* Optional per-trial binary output: one stage per noise probe below */
+    unique_ptr<NoiseResultsWriter> results_writer;
+    string results_path = results_prefix + "_m" + to_string(m) + "_t" + to_string(first_trial) + ".bin";
+    if (write_results)
+    {
+        NoiseResultsHeader header = make_noise_results_header("HElib", "clp20", context.getPhiM(), p,
+            context.logOfProduct(context.getCtxtPrimes())/log(2), {"fresh", "add", "mult", "modswitch", "pmult", "cmult", "rotate", "rotate_many"}, first_trial);
+        results_writer.reset(new NoiseResultsWriter(results_path, header));
+    }
+
+    /* Every probe goes to the results file and to the statistics of a sweep work unit, as requested */
+    if (statistics)
+    {
+        statistics->assign(8, StageStatistics());
+    }
+    auto record_stage = [&](int stage, double noise, double helib_est, double seconds) {
+        if (results_writer)
+        {
+            results_writer->record(stage, noise, helib_est, seconds);
+        }
+        if (statistics)
+        {
+            (*statistics)[stage].add(noise, helib_est, seconds);
+        }
+    };
+    chrono::steady_clock::time_point op_start;
+    double fresh_seconds, add_seconds, mult_seconds, modswitch_seconds, pmult_seconds, cmult_seconds, rotate_seconds, rotate_many_seconds;
+
+    /*
+    Average-case predictions of [MP24] for the active parameters. The modulus switching prediction needs log2 q
+    after the switch, so it is set at the first switch. Rotations have no prediction and are not monitored.
+    */
+    DriftMonitor drift_monitor({"fresh", "add", "mult", "modswitch", "pmult", "cmult", "rotate", "rotate_many"},
+        trials, report_every, abort_drift_bits);
+    double n = context.getPhiM();
+    double secret_variance = secret_coefficient_variance(secret_distribution, n, secret_hamming_weight);
+    long double predicted_fresh_variance = variance_fresh(n, p, secret_variance);
+    long double predicted_add_variance = variance_add(predicted_fresh_variance, predicted_fresh_variance);
+    long double predicted_mult_variance = variance_mult(predicted_add_variance, predicted_fresh_variance, n, p);
+    drift_monitor.set_prediction(0, log2_alpha_bound_from_variance(predicted_fresh_variance, n));
+    drift_monitor.set_prediction(1, log2_alpha_bound_from_variance(predicted_add_variance, n));
+    drift_monitor.set_prediction(2, log2_alpha_bound_from_variance(predicted_mult_variance, n));
+    drift_monitor.set_prediction(4, log2_alpha_bound_from_variance(variance_plain_mult(predicted_fresh_variance, n, p), n));
+    drift_monitor.set_prediction(5, log2_alpha_bound_from_variance(variance_constant_mult(predicted_fresh_variance, constant), n));
 
     /* Holders for the running total of the observed noises in ciphertexts */
-    NTL::xdouble total_fresh_observed(0);
-    NTL::xdouble total_add_observed(0);
-    NTL::xdouble total_mult_observed(0);
-    NTL::xdouble total_modswitch_observed(0);
+    double total_fresh_observed(0);
+    double total_add_observed(0);
+    double total_mult_observed(0);
+    double total_modswitch_observed(0);
+    double total_pmult_observed(0);
+    double total_cmult_observed(0);
+    double total_rotate_observed(0);
+    double total_rotate_many_observed(0);
 
     /* Holders for the running total of the HElib estimated noises in ciphertexts */
-    NTL::xdouble total_fresh_helib_est(0);
-    NTL::xdouble total_add_helib_est(0);
-    NTL::xdouble total_mult_helib_est(0);
-    NTL::xdouble total_modswitch_helib_est(0);
+    double total_fresh_helib_est(0);
+    double total_add_helib_est(0);
+    double total_mult_helib_est(0);
+    double total_modswitch_helib_est(0);
+    double total_pmult_helib_est(0);
+    double total_cmult_helib_est(0);
+    double total_rotate_helib_est(0);
+    double total_rotate_many_helib_est(0);
+
+    /* Holders for the running total of the per-rotation latencies */
+    double total_rotate_seconds(0);
+    double total_rotate_many_seconds(0);
+
+    /* Holders for the running total of log2 of the noise coefficient variances (slot-packed mode only) */
+    double total_fresh_log_variance(0);
+    double total_add_log_variance(0);
+    double total_mult_log_variance(0);
+    double total_modswitch_log_variance(0);
 
     /* Holders for all the observed noises */
-    vector<NTL::xdouble> array_fresh_observed;
+    vector<double> array_fresh_observed;
     array_fresh_observed.reserve(trials);
-    vector<NTL::xdouble> array_add_observed;
+    vector<double> array_add_observed;
     array_add_observed.reserve(trials);
-    vector<NTL::xdouble> array_mult_observed;
+    vector<double> array_mult_observed;
     array_mult_observed.reserve(trials);
-    vector<NTL::xdouble> array_modswitch_observed;
+    vector<double> array_modswitch_observed;
     array_modswitch_observed.reserve(trials);
 
     /* Holders for all the HElib estimated noises */
-    vector<NTL::xdouble> array_fresh_helib_est;
+    vector<double> array_fresh_helib_est;
     array_fresh_helib_est.reserve(trials);
-    vector<NTL::xdouble> array_add_helib_est;
+    vector<double> array_add_helib_est;
     array_add_helib_est.reserve(trials);
-    vector<NTL::xdouble> array_mult_helib_est;
+    vector<double> array_mult_helib_est;
     array_mult_helib_est.reserve(trials);
-    vector<NTL::xdouble> array_modswitch_helib_est;
+    vector<double> array_modswitch_helib_est;
     array_modswitch_helib_est.reserve(trials);
 
     /* Gather noise data over user-specified number of trials */
     for (int i = 0; i < trials; i++)
     {
-        /* Encode the values i+1, i into plaintexts */
-        long value1 = i+1;
-        long value2 = i;      
+        /* All randomness of this trial comes from (run_seed, trial) */
+        long trial = first_trial + i;
+        seed_ntl_for_trial(run_seed, trial, trial_stream_id(stream_encryption));
+
+        /* Encode the values trial+1, trial into plaintexts */
+        long value1 = trial+1;
+        long value2 = trial;      
         plain1[0] = value1;
         plain2[0] = value2;
+        if (slot_packed)
+        {
+            TrialRandomStream messages(run_seed, trial, trial_stream_id(stream_messages));
+            fill_slots_uniform(plain1, messages, p);
+            fill_slots_uniform(plain2, messages, p);
+        }
 
         /* Encrypt the plaintexts into ciphertexts */
+        op_start = chrono::steady_clock::now();
         public_key.Encrypt(encrypted1, plain1);
+        fresh_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
         public_key.Encrypt(encrypted2, plain2);
 
 
@@ -266,8 +708,7 @@ void test_noise(int trials)
             {
 
                 // What actually is log q?
-                NTL::xdouble check_log_q;
-                check_log_q = NTL::xdouble(encrypted1.getContext().logOfProduct(encrypted1.getPrimeSet())/log(2));
+                double check_log_q = encrypted1.getContext().logOfProduct(encrypted1.getPrimeSet())/log(2);
                 std::cout << "Log q of fresh ciphertext:" << check_log_q << std::endl;
 
                 // Decrypt the modified ciphertext into a new plaintext
@@ -282,42 +723,140 @@ void test_noise(int trials)
         }
 
         /* What is the observed noise growth at the fresh encryption of ciphertexts? */
-        auto fresh_noise = get_noise_budget(encrypted1, secret_key);
+        double fresh_log_variance = 0;
+        auto fresh_noise = slot_packed ? get_noise_budget_and_variance(encrypted1, secret_key, fresh_log_variance) : get_noise_budget(encrypted1, secret_key);
         total_fresh_observed += fresh_noise;
+        total_fresh_log_variance += fresh_log_variance;
         array_fresh_observed.push_back(fresh_noise);
+        drift_monitor.record(0, fresh_noise, get_log2_q(encrypted1));
 
         /* What is the HElib estimated noise growth at the fresh encryption of ciphertexts? */
         auto fresh_helib_est = get_helib_estimated_noise_budget(encrypted1);
         total_fresh_helib_est += fresh_helib_est;
-        array_fresh_helib_est.push_back(total_fresh_helib_est);
+        array_fresh_helib_est.push_back(fresh_helib_est);
+
+        /* Multiply a copy of encrypted1 by the plaintext multiplier and store the output in encrypted4 */
+        encrypted4 = encrypted1;
+        op_start = chrono::steady_clock::now();
+        if (cached_plaintext)
+        {
+            encrypted4.multByConstant(multiplier_dcrt, multiplier_size);
+        }
+        else
+        {
+            encrypted4.multByConstant(multiplier_poly);
+        }
+        pmult_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+
+        /* What is the observed and HElib estimated noise growth after plaintext multiplication? */
+        auto pmult_noise = get_noise_budget(encrypted4, secret_key);
+        total_pmult_observed += pmult_noise;
+        drift_monitor.record(4, pmult_noise, get_log2_q(encrypted4));
+        auto pmult_helib_est = get_helib_estimated_noise_budget(encrypted4);
+        total_pmult_helib_est += pmult_helib_est;
+
+        /* Multiply a copy of encrypted1 by the scalar constant and store the output in encrypted5 */
+        encrypted5 = encrypted1;
+        op_start = chrono::steady_clock::now();
+        encrypted5.multByConstant(constant_dcrt, double(constant));
+        cmult_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+
+        /* What is the observed and HElib estimated noise growth after constant multiplication? */
+        auto cmult_noise = get_noise_budget(encrypted5, secret_key);
+        total_cmult_observed += cmult_noise;
+        drift_monitor.record(5, cmult_noise, get_log2_q(encrypted5));
+        auto cmult_helib_est = get_helib_estimated_noise_budget(encrypted5);
+        total_cmult_helib_est += cmult_helib_est;
+
+        /* Rotate a copy of encrypted1 by one slot and store the output in encrypted6 */
+        encrypted6 = encrypted1;
+        op_start = chrono::steady_clock::now();
+        ea.rotate(encrypted6, 1);
+        rotate_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+
+        /* What is the observed and HElib estimated noise growth after rotation? */
+        auto rotate_noise = get_noise_budget(encrypted6, secret_key);
+        total_rotate_observed += rotate_noise;
+        auto rotate_helib_est = get_helib_estimated_noise_budget(encrypted6);
+        total_rotate_helib_est += rotate_helib_est;
+        total_rotate_seconds += rotate_seconds;
+
+        /* Apply each of the rotation_count automorphisms to encrypted1, hoisted or one at a time */
+        double rotate_many_noise = 0;
+        double rotate_many_helib_est = 0;
+        rotate_many_seconds = 0;
+        shared_ptr<helib::GeneralAutomorphPrecon> precon;
+        if (hoisted_rotations)
+        {
+            op_start = chrono::steady_clock::now();
+            precon = helib::buildGeneralAutomorphPrecon(encrypted1, 0, ea);
+            rotate_many_seconds += chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+        }
+        for (long amount = 1; amount <= rotation_count; amount++)
+        {
+            op_start = chrono::steady_clock::now();
+            if (hoisted_rotations)
+            {
+                encrypted6 = *precon->automorph(amount);
+            }
+            else
+            {
+                encrypted6 = encrypted1;
+                encrypted6.smartAutomorph(context.getZMStar().genToPow(0, amount));
+            }
+            rotate_many_seconds += chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+
+            rotate_many_noise += get_noise_budget(encrypted6, secret_key);
+            rotate_many_helib_est += get_helib_estimated_noise_budget(encrypted6);
+        }
+        if (rotation_count > 0)
+        {
+            rotate_many_noise /= rotation_count;
+            rotate_many_helib_est /= rotation_count;
+            rotate_many_seconds /= rotation_count;
+        }
+        total_rotate_many_observed += rotate_many_noise;
+        total_rotate_many_helib_est += rotate_many_helib_est;
+        total_rotate_many_seconds += rotate_many_seconds;
 
         /* Compute the homomorphic addition of encrypted1 and encrypted2. Done in place, adding encrypted2 into encrypted1 */
+        op_start = chrono::steady_clock::now();
         encrypted1 += encrypted2;
+        add_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
 
         /* What is the observed noise growth after addition? */
-        auto add_noise = get_noise_budget(encrypted1, secret_key);
+        double add_log_variance = 0;
+        auto add_noise = slot_packed ? get_noise_budget_and_variance(encrypted1, secret_key, add_log_variance) : get_noise_budget(encrypted1, secret_key);
         total_add_observed += add_noise;
+        total_add_log_variance += add_log_variance;
         array_add_observed.push_back(add_noise);
+        drift_monitor.record(1, add_noise, get_log2_q(encrypted1));
 
         /* What is the HElib estimated noise growth after addition? */
         auto add_helib_est = get_helib_estimated_noise_budget(encrypted1);
         total_add_helib_est += add_helib_est;
-        array_add_helib_est.push_back(total_add_helib_est);
+        array_add_helib_est.push_back(add_helib_est);
 
         /* Compute the homomorphic multiplication of encrypted1 and encrypted2 and store the output in encrypted3 */
+        op_start = chrono::steady_clock::now();
         encrypted3.tensorProduct(encrypted1, encrypted2);
+        mult_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
 
         /* What is the observed noise growth after multiplication? */
-        auto mult_noise = get_noise_budget(encrypted3, secret_key);
+        double mult_log_variance = 0;
+        auto mult_noise = slot_packed ? get_noise_budget_and_variance(encrypted3, secret_key, mult_log_variance) : get_noise_budget(encrypted3, secret_key);
         total_mult_observed += mult_noise;
+        total_mult_log_variance += mult_log_variance;
         array_mult_observed.push_back(mult_noise);
+        drift_monitor.record(2, mult_noise, get_log2_q(encrypted3));
 
         /* What is the HElib estimated noise growth after multiplication? */
         auto mult_helib_est = get_helib_estimated_noise_budget(encrypted3);
         total_mult_helib_est += mult_helib_est;
-        array_mult_helib_est.push_back(total_mult_helib_est);
+        array_mult_helib_est.push_back(mult_helib_est);
 
         /* Modulus switch encrypted3 down to next modulus in chain */
+        modswitch_seconds = 0;
         if(is_not_2048)
         {
 
@@ -327,8 +866,18 @@ void test_noise(int trials)
                 cout << endl;
             }
 
+            double log_q_before_switch = get_log2_q(encrypted3);
+            op_start = chrono::steady_clock::now();
             helib::IndexSet natural_primes = encrypted3.naturalPrimeSet();
             encrypted3.modDownToSet(natural_primes);
+            modswitch_seconds = chrono::duration<double>(chrono::steady_clock::now() - op_start).count();
+
+            if (!drift_monitor.has_prediction(3))
+            {
+                long double predicted_modswitch_variance = variance_mod_switch(n, p, log_q_before_switch,
+                    get_log2_q(encrypted3), predicted_mult_variance, secret_variance);
+                drift_monitor.set_prediction(3, log2_alpha_bound_from_variance(predicted_modswitch_variance, n));
+            }
 
             if(i == 0)
             {
@@ -351,43 +900,125 @@ void test_noise(int trials)
         }
 
         /* What is the observed noise growth after modulus switching? */
-        auto modswitch_noise = get_noise_budget(encrypted3, secret_key);
+        double modswitch_log_variance = 0;
+        auto modswitch_noise = slot_packed ? get_noise_budget_and_variance(encrypted3, secret_key, modswitch_log_variance) : get_noise_budget(encrypted3, secret_key);
         total_modswitch_observed += modswitch_noise;
+        total_modswitch_log_variance += modswitch_log_variance;
         array_modswitch_observed.push_back(modswitch_noise);
+        drift_monitor.record(3, modswitch_noise, get_log2_q(encrypted3));
         
         /* What is the HElib estimated noise growth after modulus switching? */
         auto modswitch_helib_est = get_helib_estimated_noise_budget(encrypted3);
         total_modswitch_helib_est += modswitch_helib_est;
-        array_modswitch_helib_est.push_back(total_modswitch_helib_est);
+        array_modswitch_helib_est.push_back(modswitch_helib_est);
 
+        if (results_writer || statistics)
+        {
+            record_stage(0, fresh_noise, fresh_helib_est, fresh_seconds);
+            record_stage(1, add_noise, add_helib_est, add_seconds);
+            record_stage(2, mult_noise, mult_helib_est, mult_seconds);
+            if (is_not_2048)
+            {
+                record_stage(3, modswitch_noise, modswitch_helib_est, modswitch_seconds);
+            }
+            record_stage(4, pmult_noise, pmult_helib_est, pmult_seconds);
+            record_stage(5, cmult_noise, cmult_helib_est, cmult_seconds);
+            record_stage(6, rotate_noise, rotate_helib_est, rotate_seconds);
+            if (rotation_count > 0)
+            {
+                record_stage(7, rotate_many_noise, rotate_many_helib_est, rotate_many_seconds);
+            }
+            if (results_writer)
+            {
+                results_writer->end_trial();
+            }
+        }
+
+        if (!drift_monitor.end_trial())
+        {
+            cout << "Aborting the run after " << i + 1 << " trials" << endl << endl;
+            trials = i + 1;
+            break;
+        }
+    }
+
+    if (results_writer)
+    {
+        results_writer->close();
+        cout << "Per-trial results written to " << results_path << endl << endl;
     }
 
     /* Compute the mean of the observed noises */
-    auto mean_fresh_observed = total_fresh_observed / trials_copy;
-    auto mean_add_observed = total_add_observed / trials_copy;
-    auto mean_mult_observed = total_mult_observed / trials_copy;
-    auto mean_modswitch_observed = total_modswitch_observed / trials_copy;
+    auto mean_fresh_observed = total_fresh_observed / trials;
+    auto mean_add_observed = total_add_observed / trials;
+    auto mean_mult_observed = total_mult_observed / trials;
+    auto mean_modswitch_observed = total_modswitch_observed / trials;
+    auto mean_pmult_observed = total_pmult_observed / trials;
+    auto mean_cmult_observed = total_cmult_observed / trials;
+    auto mean_rotate_observed = total_rotate_observed / trials;
+    auto mean_rotate_many_observed = total_rotate_many_observed / trials;
 
     /* Compute the mean of the HElib estimated noises */
-    auto mean_fresh_helib_est = total_fresh_helib_est/ trials_copy;
-    auto mean_add_helib_est = total_add_helib_est / trials_copy;
-    auto mean_mult_helib_est = total_mult_helib_est / trials_copy;
-    auto mean_modswitch_helib_est = total_modswitch_helib_est / trials_copy;
+    auto mean_fresh_helib_est = total_fresh_helib_est/ trials;
+    auto mean_add_helib_est = total_add_helib_est / trials;
+    auto mean_mult_helib_est = total_mult_helib_est / trials;
+    auto mean_modswitch_helib_est = total_modswitch_helib_est / trials;
+    auto mean_pmult_helib_est = total_pmult_helib_est / trials;
+    auto mean_cmult_helib_est = total_cmult_helib_est / trials;
+    auto mean_rotate_helib_est = total_rotate_helib_est / trials;
+    auto mean_rotate_many_helib_est = total_rotate_many_helib_est / trials;
 
     /* Print out the results */
     cout << "After fresh encryption:" << endl;
     cout << "Mean noise budget observed: " << mean_fresh_observed  << endl;    
     cout << "Mean HElib estimated noise budget: " << mean_fresh_helib_est << endl;        
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_fresh_log_variance / trials << endl;
+    }
+    cout << endl;
+
+    cout << "After plaintext multiplication of the fresh ciphertext:" << endl;
+    cout << "Mean noise budget observed: " << mean_pmult_observed  << endl;
+    cout << "Mean HElib estimated noise budget: " << mean_pmult_helib_est << endl;
+    cout << endl;
+
+    cout << "After multiplication of the fresh ciphertext by " << constant << ":" << endl;
+    cout << "Mean noise budget observed: " << mean_cmult_observed  << endl;
+    cout << "Mean HElib estimated noise budget: " << mean_cmult_helib_est << endl;
     cout << endl;
 
+    cout << "After rotation of the fresh ciphertext by one slot:" << endl;
+    cout << "Mean noise budget observed: " << mean_rotate_observed  << endl;
+    cout << "Mean HElib estimated noise budget: " << mean_rotate_helib_est << endl;
+    cout << "Mean seconds per rotation: " << total_rotate_seconds / trials << endl;
+    cout << endl;
+
+    if (rotation_count > 0)
+    {
+        cout << "After each of " << rotation_count << (hoisted_rotations ? " hoisted" : "") << " rotations of the fresh ciphertext:" << endl;
+        cout << "Mean noise budget observed: " << mean_rotate_many_observed  << endl;
+        cout << "Mean HElib estimated noise budget: " << mean_rotate_many_helib_est << endl;
+        cout << "Mean seconds per rotation: " << total_rotate_many_seconds / trials << endl;
+        cout << endl;
+    }
+
     cout << "After addition:" << endl;
     cout << "Mean noise budget observed: " << mean_add_observed  << endl;
     cout << "Mean HElib estimated noise budget: " << mean_add_helib_est << endl;        
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_add_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After multiplication:" << endl;
     cout << "Mean noise budget observed: " << mean_mult_observed  << endl;  
     cout << "Mean HElib estimated noise budget: " << mean_mult_helib_est << endl;        
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_mult_log_variance / trials << endl;
+    }
     cout << endl;
 
     if(is_not_2048)
@@ -395,6 +1026,10 @@ void test_noise(int trials)
         cout << "After mod switch:" << endl;
         cout << "Mean noise budget observed: " << mean_modswitch_observed  << endl;    
         cout << "Mean HElib estimated noise budget: " << mean_modswitch_helib_est << endl;        
+        if (slot_packed)
+        {
+            cout << "Mean log2 noise coefficient variance observed: " << total_modswitch_log_variance / trials << endl;
+        }
         cout << endl;
     }
 
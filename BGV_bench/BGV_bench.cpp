@@ -0,0 +1,206 @@
+/*
+    HElib micro-benchmarks
+    Measures the BGV primitives used by the noise experiments (key generation, encryption, addition, tensor
+    product, relinearization, modulus switching, decryption and the noise probe) for each n from 2048 to 32768,
+    reporting latency percentiles, throughput and bytes allocated per operation (see common/bench_report.h).
+    Usage: BGV_bench [iterations] [output.json]
+    The JSON output can be compared across builds, e.g. before and after an HElib upgrade, with compare_bench.py.
+    This code requires the following changes to be made to HElib:
+        - make Ctxt::tensorProduct public so we can do homomorphic multiplication without automatically mod switching or relinearizing
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include <helib/helib.h>
+#include <helib/version.h>
+
+#include "bench_report.h"
+#include "modulus_cache.h"
+
+using namespace std;
+
+/* Count every heap allocation, so that run_benchmark can report bytes allocated per operation */
+void* operator new(size_t size)
+{
+    bench_allocated_bytes.fetch_add(size, memory_order_relaxed);
+    if (void* pointer = malloc(size ? size : 1))
+    {
+        return pointer;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+/* This function runs all benchmarks for one choice of m, appending to results */
+void bench_parameters(unsigned long m, long iterations, vector<BenchResult>& results);
+
+/* Helper functions */
+unsigned long get_bits_for_m(unsigned long m);
+double get_log2_q(const helib::Ctxt& encrypted);
+double get_noise_budget(const helib::Ctxt& encrypted, const helib::SecKey& secret_key);
+
+/* Number of bits in the modulus chain according to HE Standard, as in the other HElib harnesses */
+unsigned long get_bits_for_m(unsigned long m)
+{
+    if (m == 4096)
+    {
+        return 54;
+    }
+    else if (m == 8192)
+    {
+        return 109;
+    }
+    else if (m == 16384)
+    {
+        return 218;
+    }
+    else if (m == 32768)
+    {
+        return 438;
+    }
+    else
+    {
+        return 881;
+    }
+}
+
+/*
+log2 q of the prime set of encrypted. There are only a few distinct prime sets per run, so the value is cached
+per prime set in log2_q_cache, which must be cleared whenever a new context is built.
+*/
+PrimeSetLog2Cache log2_q_cache;
+
+double get_log2_q(const helib::Ctxt& encrypted)
+{
+    const helib::IndexSet& primes = encrypted.getPrimeSet();
+    auto compute = [&]() { return encrypted.getContext().logOfProduct(primes)/log(2.0); };
+    if (primes.card() == 0 || primes.last() >= 64)
+    {
+        return compute();
+    }
+    uint64_t mask = 0;
+    for (long i = primes.first(); i <= primes.last(); i = primes.next(i))
+    {
+        mask |= uint64_t(1) << i;
+    }
+    return log2_q_cache.lookup(mask, compute);
+}
+
+/* The noise probe of the other HElib harnesses */
+double get_noise_budget(const helib::Ctxt& encrypted, const helib::SecKey& secret_key)
+{
+    NTL::ZZX plaintext, noise_poly;
+    secret_key.Decrypt(plaintext, encrypted, noise_poly);
+    return get_log2_q(encrypted) - NTL::log(helib::largestCoeff(noise_poly))/log(2.0) - 1;
+}
+
+void bench_parameters(unsigned long m, long iterations, vector<BenchResult>& results)
+{
+    unsigned long p = 3;    // set plaintext modulus t = 3
+    unsigned long r = 1;    // Hensel lifting, default is 1
+    unsigned long c = 2;    // columns in key switching matrix, default is 2 or 3
+    unsigned long bits = get_bits_for_m(m);
+
+    helib::Context context = helib::ContextBuilder<helib::BGV>()
+                               .m(m)
+                               .p(p)
+                               .r(r)
+                               .bits(bits)
+                               .c(c)
+                               .build();
+    log2_q_cache.clear();
+    long n = context.getPhiM();
+
+    /* Key generation is slow at large n, so it gets fewer iterations */
+    long keygen_iterations = min(iterations, 3L);
+    results.push_back(run_benchmark("keygen", n, keygen_iterations, [] {}, [&] {
+        helib::SecKey key(context);
+        key.GenSecKey();
+    }));
+    print_bench_result(results.back());
+
+    helib::SecKey secret_key(context);
+    secret_key.GenSecKey();
+    const helib::PubKey& public_key = secret_key;
+
+    helib::Ptxt<helib::BGV> plain1(context);
+    helib::Ptxt<helib::BGV> plain2(context);
+    plain1[0] = 1;
+    plain2[0] = 2;
+    helib::Ctxt encrypted1(public_key);
+    helib::Ctxt encrypted2(public_key);
+    helib::Ctxt result(public_key);
+    public_key.Encrypt(encrypted1, plain1);
+    public_key.Encrypt(encrypted2, plain2);
+    helib::Ctxt product(public_key);
+    product.tensorProduct(encrypted1, encrypted2);
+    helib::Ctxt relinearized = product;
+    relinearized.reLinearize();
+
+    auto no_setup = [] {};
+    results.push_back(run_benchmark("encrypt", n, iterations, no_setup, [&] { public_key.Encrypt(result, plain1); }));
+    print_bench_result(results.back());
+
+    results.push_back(run_benchmark("add", n, iterations, [&] { result = encrypted1; }, [&] { result += encrypted2; }));
+    print_bench_result(results.back());
+
+    results.push_back(run_benchmark("tensor", n, iterations, no_setup, [&] { result.tensorProduct(encrypted1, encrypted2); }));
+    print_bench_result(results.back());
+
+    results.push_back(run_benchmark("relinearize", n, iterations, [&] { result = product; }, [&] { result.reLinearize(); }));
+    print_bench_result(results.back());
+
+    /* Switch down by one prime, as the fuzzer does; n = 2048 has too few primes for modulus switching */
+    helib::IndexSet lower_primes = relinearized.getPrimeSet();
+    lower_primes.remove(lower_primes.last());
+    if (lower_primes.card() > 0)
+    {
+        results.push_back(run_benchmark("modswitch", n, iterations, [&] { result = relinearized; },
+            [&] { result.modDownToSet(lower_primes); }));
+        print_bench_result(results.back());
+    }
+
+    helib::Ptxt<helib::BGV> decrypted(context);
+    results.push_back(run_benchmark("decrypt", n, iterations, no_setup, [&] { secret_key.Decrypt(decrypted, relinearized); }));
+    print_bench_result(results.back());
+
+    results.push_back(run_benchmark("noise_probe", n, iterations, no_setup, [&] { get_noise_budget(relinearized, secret_key); }));
+    print_bench_result(results.back());
+}
+
+int main(int argc, char* argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 20;
+    string json_path = argc > 2 ? argv[2] : "BGV_bench_HElib.json";
+    if (iterations < 1)
+    {
+        cout << "Usage: BGV_bench [iterations] [output.json]" << endl;
+        return 1;
+    }
+
+    /* m = 2n for n = 2048, ..., 32768 */
+    vector<unsigned long> ms = {4096, 8192, 16384, 32768, 65536};
+
+    vector<BenchResult> results;
+    print_bench_header();
+    for (unsigned long m : ms)
+    {
+        bench_parameters(m, iterations, results);
+    }
+
+    write_bench_json(json_path, "HElib", helib::version::asString, results);
+    cout << endl << "Results written to " << json_path << endl;
+    return 0;
+}
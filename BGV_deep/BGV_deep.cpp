@@ -4,15 +4,29 @@
     Some of this code is adapted SEAL/examples/examples.cpp at https://github.com/microsoft/SEAL commit ba2d578
     This code requires the following changes to be made to HElib:
         - make Ctxt::tensorProduct public so we can do homomorphic multiplication without automatically mod switching or relinearizing
+        - make Ctxt::parts and Ctxt::primeSet public so the nested-chain sweep can restrict fresh ciphertexts to a prefix of the chain
 */
 
 #include <iostream>
 #include <iomanip>
+#include <chrono>
+#include <memory>
 
 #include <helib/helib.h>
 #include <helib/binaryArith.h>
 #include <helib/intraSlot.h>
 
+#include "bgv_heuristics.h"
+#include "circuit_kernel.h"
+#include "circuit_planner.h"
+#include "counter_rng.h"
+#include "drift_monitor.h"
+#include "memory_footprint.h"
+#include "modulus_cache.h"
+#include "noise_results.h"
+#include "secret_distribution.h"
+#include "sweep_coordinator.h"
+
 //#include "EncryptedArray.h"
 //#include "FHE.h"
 //#include "norms.h"
@@ -22,70 +36,471 @@ using namespace std;
 /*
 This function computes, for a given chain of operations, over a user-specified number of trials,
 an average observed noise growth in ciphertexts.
+Trials are numbered from first_trial, and trial i only depends on (run seed, i), so any range of
+trials of a run can be replayed on its own.
+A sweep work unit passes sweep_m, which replaces the m selected below, and statistics, which receives the
+statistics of every stage.
+*/
+void test_noise(int trials, long first_trial = 0, unsigned long sweep_m = 0, vector<StageStatistics>* statistics = nullptr);
+
+/*
+This function runs trials_per_config trials of every parameter set of Table 2 in worker processes, and prints
+the merged statistics of every stage (see common/sweep_coordinator.h).
+*/
+void run_sweep_mode(long trials_per_config, unsigned workers);
+
+/*
+This function runs trials first_trial, ..., first_trial + trials - 1 of the deep circuit for several modulus chains
+at the same m, from one context and one set of keys built for the largest chain: every smaller chain is a view, a
+prefix of its primes. The keys are shared, so it runs in one process; disjoint trial ranges can run side by side.
 */
-void test_noise(int trials);
+void run_nested_chain_mode(int trials, long first_trial, unsigned long m);
 
 /* Helper functions */
-NTL::xdouble get_sum_of_squared_differences(NTL::xdouble mean, vector<NTL::xdouble> array, int size_of_array);
-NTL::xdouble get_standard_dev(NTL::xdouble mean, vector<NTL::xdouble> array, int trials);
-NTL::xdouble get_noise();
-NTL::xdouble get_noise_budget(helib::Ctxt encrypted, helib::SecKey secret_key);
-NTL::xdouble get_helib_estimated_noise_budget(helib::Ctxt encrypted);
+double get_sum_of_squared_differences(double mean, const vector<double>& array, int size_of_array);
+double get_standard_dev(double mean, const vector<double>& array, int trials);
+double log2_of_zz(const NTL::ZZ& value);
+double get_log2_noise(const helib::Ctxt& encrypted, const helib::SecKey& secret_key);
+double get_log2_q(const helib::Ctxt& encrypted);
+const helib::DoubleCRT& get_secret_key_power(const helib::SecKey& secret_key, const helib::IndexSet& primes, long power);
+bool is_over_first_key(const helib::Ctxt& encrypted);
+helib::DoubleCRT get_noise_dcrt(const helib::Ctxt& encrypted, const helib::SecKey& secret_key);
+void get_noise_poly(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, NTL::ZZX& noise_poly);
+double get_noise_budget(const helib::Ctxt& encrypted, const helib::SecKey& secret_key);
+double get_helib_estimated_noise_budget(const helib::Ctxt& encrypted);
+double get_noise_budget_and_variance(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, double& log_variance);
+double get_noise_budget_chunked(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, long block_size,
+    double& log_variance);
+size_t get_ciphertext_bytes(const helib::Ctxt& encrypted);
+void restrict_to_primes(helib::Ctxt& encrypted, const helib::IndexSet& primes);
+void print_stage_statistics(const vector<StageStatistics>& stages, const vector<string>& stage_names);
+void fill_slots_uniform(helib::Ptxt<helib::BGV>& plain, TrialRandomStream& messages, unsigned long p);
+void seed_ntl_for_trial(uint64_t run_seed, uint64_t trial, uint32_t stream);
+void import_secret_key(helib::SecKey& secret_key, const helib::Context& context, const vector<int>& coefficients);
+
+/*
+The deep circuit: the product tree of 8 fresh ciphertexts, expanded at compile time (see common/circuit_kernel.h).
+Its HElib backend encrypts the plaintexts of the trial and multiplies with Ctxt::tensorProduct, without
+relinearization or modulus switching unless it is given a plan (see common/circuit_planner.h). Every probe stores
+the observed noise budget, the HElib estimate, log2 of the noise coefficient variance (slot-packed mode only),
+log2 q, the time of the operation of its stage, and the parts, primes and bytes of the ciphertext;
+evaluation_seconds adds up the time of all multiplications, relinearizations and modulus switches.
+*/
+typedef MulTree<3, 2> DeepCircuit;
 
-NTL::xdouble get_sum_of_squared_differences(NTL::xdouble mean, vector<NTL::xdouble> array, int size_of_array)
+struct HElibDeepBackend
 {
-    NTL::xdouble sum_of_squared_differences(0);
-    NTL::xdouble temp(0);
+    typedef helib::Ctxt Ciphertext;
+
+    const helib::PubKey& public_key;
+    const helib::SecKey& secret_key;
+    const vector<helib::Ptxt<helib::BGV>>& plains;
+    bool slot_packed;
+    long probe_block = 0;                   // above 0, probe with get_noise_budget_chunked
+    const helib::IndexSet* view = nullptr;  // if set, fresh ciphertexts are restricted to these primes
+    const CircuitPlan* plan = nullptr;
+    vector<helib::IndexSet> prime_sets;     // the first 1, 2, ... ciphertext primes, for the plan's modulus switches
+    double evaluation_seconds = 0;
+
+    double noise[DeepCircuit::stages];
+    double helib_est[DeepCircuit::stages];
+    double log_variance[DeepCircuit::stages];
+    double log2_q[DeepCircuit::stages];
+    double seconds[DeepCircuit::stages];
+    long parts[DeepCircuit::stages];
+    long primes[DeepCircuit::stages];
+    size_t bytes[DeepCircuit::stages];
 
-    for (int i=0; i<size_of_array; i++)
+    HElibDeepBackend(const helib::SecKey& secret_key, const vector<helib::Ptxt<helib::BGV>>& plains, bool slot_packed)
+        : public_key(secret_key), secret_key(secret_key), plains(plains), slot_packed(slot_packed)
     {
-        temp = array[i] - mean;
-        temp = temp * temp;
-        sum_of_squared_differences += temp;
+    }
+
+    void encrypt(helib::Ctxt& out, int leaf)
+    {
+        public_key.Encrypt(out, plains[leaf]);
+        if (view)
+        {
+            restrict_to_primes(out, *view);
+        }
+    }
+
+    void multiply(const helib::Ctxt& a, const helib::Ctxt& b, helib::Ctxt& out)
+    {
+        auto start = chrono::steady_clock::now();
+        out.tensorProduct(a, b);
+        evaluation_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    void multiply_inplace(helib::Ctxt& out, const helib::Ctxt& b)
+    {
+        auto start = chrono::steady_clock::now();
+        helib::Ctxt a(out);
+        out.tensorProduct(a, b);
+        evaluation_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    template <int Level>
+    void probe(const helib::Ctxt& node, double operation_seconds)
+    {
+        log_variance[Level] = 0;
+        if (probe_block > 0)
+        {
+            noise[Level] = get_noise_budget_chunked(node, secret_key, probe_block, log_variance[Level]);
+        }
+        else
+        {
+            noise[Level] = slot_packed ? get_noise_budget_and_variance(node, secret_key, log_variance[Level]) : get_noise_budget(node, secret_key);
+        }
+        helib_est[Level] = get_helib_estimated_noise_budget(node);
+        log2_q[Level] = get_log2_q(node);
+        seconds[Level] = operation_seconds;
+        parts[Level] = node.partsSize();
+        primes[Level] = node.getPrimeSet().card();
+        bytes[Level] = get_ciphertext_bytes(node);
+    }
+
+    template <int Level>
+    void prepare_operand(helib::Ctxt& node)
+    {
+        if (!plan)
+        {
+            return;
+        }
+        auto start = chrono::steady_clock::now();
+        const LevelPlan& decision = plan->levels[Level];
+        if (decision.drop_primes > 0)
+        {
+            node.modDownToSet(prime_sets.at(plan->primes[Level] - decision.drop_primes - 1));
+        }
+        if (decision.relinearize)
+        {
+            node.reLinearize();
+        }
+        evaluation_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+};
+
+/*
+Noise budgets are in bits (well under 1000), so all of the statistics below are plain doubles. The only
+multi-precision value is the noise itself, which is converted to log2 once, by log2_of_zz.
+*/
+double get_sum_of_squared_differences(double mean, const vector<double>& array, int size_of_array)
+{
+    double sum_of_squared_differences = 0;
+    for (int i = 0; i < size_of_array; i++)
+    {
+        double difference = array[i] - mean;
+        sum_of_squared_differences += difference * difference;
     }
     return sum_of_squared_differences;
 }
 
-NTL::xdouble get_standard_dev(NTL::xdouble mean, vector<NTL::xdouble> array, int trials)
+double get_standard_dev(double mean, const vector<double>& array, int trials)
+{
+    double variance = get_sum_of_squared_differences(mean, array, trials) / (trials - 1);
+    return sqrt(variance);
+}
+
+/* log2 of a (possibly very large) integer, without overflow: NTL's log(ZZ) works from the exponent and leading bits */
+double log2_of_zz(const NTL::ZZ& value)
+{
+    return NTL::log(value) / log(2.0);
+}
+
+/*
+log2 q of the prime set of encrypted. There are only a few distinct prime sets per run, so the value is cached
+per prime set in log2_q_cache, which must be cleared whenever a new context is built.
+*/
+PrimeSetLog2Cache log2_q_cache;
+
+double get_log2_q(const helib::Ctxt& encrypted)
+{
+    const helib::IndexSet& primes = encrypted.getPrimeSet();
+    auto compute = [&]() { return encrypted.getContext().logOfProduct(primes)/log(2.0); };
+    if (primes.card() == 0 || primes.last() >= 64)
+    {
+        return compute();
+    }
+    uint64_t mask = 0;
+    for (long i = primes.first(); i <= primes.last(); i = primes.next(i))
+    {
+        mask |= uint64_t(1) << i;
+    }
+    return log2_q_cache.lookup(mask, compute);
+}
+
+/*
+Powers s, s^2, ... of the secret key over each prime set, in DoubleCRT form. SecKey::Decrypt copies the key, drops
+the extra primes and raises it to the power of each ciphertext part on every call; the noise probes instead compute
+the powers once per prime set. Must be cleared whenever a new key is generated.
+*/
+vector<pair<helib::IndexSet, vector<helib::DoubleCRT>>> secret_key_powers;
+
+const helib::DoubleCRT& get_secret_key_power(const helib::SecKey& secret_key, const helib::IndexSet& primes, long power)
 {
-    NTL::xdouble trials_copy(trials);
-    NTL::xdouble denominator = trials_copy - 1;
-    NTL::xdouble sum_sq_diff = get_sum_of_squared_differences(mean, array, trials);
-    NTL::xdouble variance = sum_sq_diff / denominator;
-    NTL::xdouble std_dev = sqrt(variance);
-    return std_dev;
+    size_t entry = 0;
+    while (entry < secret_key_powers.size() && !(secret_key_powers[entry].first == primes))
+    {
+        entry++;
+    }
+    if (entry == secret_key_powers.size())
+    {
+        secret_key_powers.emplace_back(primes, vector<helib::DoubleCRT>());
+    }
+    vector<helib::DoubleCRT>& powers = secret_key_powers[entry].second;
+    while (long(powers.size()) < power)
+    {
+        if (powers.empty())
+        {
+            helib::DoubleCRT key = secret_key.sKeys.at(0);
+            key.removePrimes(key.getIndexSet() / primes);
+            powers.push_back(key);
+        }
+        else
+        {
+            helib::DoubleCRT next = powers.back();
+            next *= powers.front();
+            powers.push_back(next);
+        }
+    }
+    return powers[power - 1];
+}
+
+/* Whether every part is over a power of the first secret key, rather than under an automorphism (not key-switched) */
+bool is_over_first_key(const helib::Ctxt& encrypted)
+{
+    for (long i = 1; i < encrypted.partsSize(); i++)
+    {
+        const helib::SKHandle& handle = encrypted[i].skHandle;
+        if (handle.getPowerOfX() != 1 || handle.getSecretKeyID() != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+c0 + c1 s + c2 s^2 + ... of a ciphertext that is_over_first_key, in DoubleCRT form. The sum is taken pointwise in
+evaluation form with the cached powers of the key.
+*/
+helib::DoubleCRT get_noise_dcrt(const helib::Ctxt& encrypted, const helib::SecKey& secret_key)
+{
+    helib::DoubleCRT sum = encrypted[0];
+    for (long i = 1; i < encrypted.partsSize(); i++)
+    {
+        helib::DoubleCRT term = encrypted[i];
+        term *= get_secret_key_power(secret_key, encrypted[i].getIndexSet(), encrypted[i].skHandle.getPowerOfS());
+        sum += term;
+    }
+    return sum;
+}
+
+/*
+The noise polynomial c0 + c1 s + c2 s^2 + ... of encrypted, reduced centered mod q, as returned by SecKey::Decrypt.
+The only transform is the final conversion of get_noise_dcrt to coefficients. Parts under an automorphism of the key
+go through SecKey::Decrypt.
+*/
+void get_noise_poly(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, NTL::ZZX& noise_poly)
+{
+    if (!is_over_first_key(encrypted))
+    {
+        NTL::ZZX plaintext;
+        secret_key.Decrypt(plaintext, encrypted, noise_poly);
+        return;
+    }
+    get_noise_dcrt(encrypted, secret_key).toPoly(noise_poly);
 }
 
 /* Inspired by the HElib debugging function decryptAndPrint */
-NTL::xdouble get_noise(helib::Ctxt encrypted, helib::SecKey secret_key)
+double get_log2_noise(const helib::Ctxt& encrypted, const helib::SecKey& secret_key)
+{
+    NTL::ZZX noise_poly;
+    get_noise_poly(encrypted, secret_key, noise_poly);
+    return log2_of_zz(helib::largestCoeff(noise_poly));
+}
+
+double get_noise_budget(const helib::Ctxt& encrypted, const helib::SecKey& secret_key)
+{
+    double log_q = get_log2_q(encrypted);
+    return log_q - get_log2_noise(encrypted, secret_key) - 1;
+}
+
+double get_helib_estimated_noise_budget(const helib::Ctxt& encrypted)
+{
+    double log_helib_est_noise = log(encrypted.getNoiseBound())/log(2.0);
+    double log_q = get_log2_q(encrypted);
+    return log_q - log_helib_est_noise - 1;
+}
+
+/*
+As get_noise_budget, also returning log2 of the empirical variance of the n coefficients of the noise polynomial.
+Each coefficient is a sample of the noise distribution, so one probe gives n samples rather than only the maximum.
+*/
+double get_noise_budget_and_variance(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, double& log_variance)
+{
+    NTL::ZZX noise_poly;
+    NTL::ZZ sum_of_squares(0);
+    get_noise_poly(encrypted, secret_key, noise_poly);
+    for (long j = 0; j <= deg(noise_poly); j++)
+    {
+        sum_of_squares += sqr(coeff(noise_poly, j));
+    }
+    log_variance = log2_of_zz(sum_of_squares) - log2(double(encrypted.getContext().getPhiM()));
+    double log_q = get_log2_q(encrypted);
+    return log_q - log2_of_zz(helib::largestCoeff(noise_poly)) - 1;
+}
+
+/*
+As get_noise_budget_and_variance, without the ZZX of the whole noise polynomial: n ZZ coefficients of log2 q bits,
+each its own heap object, plus the intermediates of toPoly. c(s) is still summed as a whole DoubleCRT, and taken out
+of it one prime at a time into rows of words, each prime dropped from the DoubleCRT once copied. The DoubleCRT and the
+rows together stay the size of one ciphertext part, as in get_noise_budget. Only the multi-precision part is bounded:
+the rows are CRT-composed, centered and reduced to the largest coefficient and the sum of squares block_size
+coefficients at a time, so block_size ZZ coefficients exist at once instead of n.
+*/
+double get_noise_budget_chunked(const helib::Ctxt& encrypted, const helib::SecKey& secret_key, long block_size,
+    double& log_variance)
+{
+    if (!is_over_first_key(encrypted))
+    {
+        return get_noise_budget_and_variance(encrypted, secret_key, log_variance);
+    }
+    const helib::Context& context = encrypted.getContext();
+    long n = context.getPhiM();
+    helib::DoubleCRT noise = get_noise_dcrt(encrypted, secret_key);
+    helib::IndexSet primes = noise.getIndexSet();
+    NTL::ZZ q = context.productOfPrimes(primes);
+
+    /* Residues of c(s) mod every prime q_i in coefficient form, and the CRT constants q / q_i and (q / q_i)^-1 mod q_i */
+    vector<vector<long>> residues;
+    vector<long> moduli;
+    vector<NTL::ZZ> q_hat;
+    vector<long> q_hat_inverse;
+    for (long i = primes.first(); i <= primes.last(); i = primes.next(i))
+    {
+        helib::IndexSet prime(i, i);
+        NTL::ZZX row;
+        noise.toPoly(row, prime, true);
+        residues.emplace_back(n, 0);
+        for (long j = 0; j <= deg(row); j++)
+        {
+            residues.back()[j] = NTL::conv<long>(coeff(row, j));
+        }
+        if (i != primes.last())
+        {
+            noise.removePrimes(prime);
+        }
+        long modulus = context.ithPrime(i);
+        moduli.push_back(modulus);
+        q_hat.push_back(q / modulus);
+        q_hat_inverse.push_back(NTL::InvMod(NTL::rem(q_hat.back(), modulus), modulus));
+    }
+
+    NTL::ZZ half_q = q / 2;
+    NTL::ZZ largest(0);
+    NTL::ZZ sum_of_squares(0);
+    NTL::ZZ term;
+    vector<NTL::ZZ> block(block_size);
+    for (long start = 0; start < n; start += block_size)
+    {
+        long count = min(block_size, n - start);
+        for (long j = 0; j < count; j++)
+        {
+            NTL::clear(block[j]);
+        }
+        for (size_t i = 0; i < moduli.size(); i++)
+        {
+            const long* row = residues[i].data() + start;
+            for (long j = 0; j < count; j++)
+            {
+                NTL::mul(term, q_hat[i], NTL::MulMod(row[j], q_hat_inverse[i], moduli[i]));
+                block[j] += term;
+            }
+        }
+        for (long j = 0; j < count; j++)
+        {
+            NTL::rem(block[j], block[j], q);
+            if (block[j] > half_q)
+            {
+                block[j] -= q;
+            }
+            NTL::abs(block[j], block[j]);
+            if (block[j] > largest)
+            {
+                largest = block[j];
+            }
+            NTL::sqr(term, block[j]);
+            sum_of_squares += term;
+        }
+    }
+    log_variance = log2_of_zz(sum_of_squares) - log2(double(n));
+    return get_log2_q(encrypted) - log2_of_zz(largest) - 1;
+}
+
+/* Bytes held by the parts of a ciphertext, each over its own prime set (see common/memory_footprint.h) */
+size_t get_ciphertext_bytes(const helib::Ctxt& encrypted)
+{
+    size_t bytes = 0;
+    for (long i = 0; i < encrypted.partsSize(); i++)
+    {
+        bytes += ciphertext_bytes(1, encrypted[i].getIndexSet().card(), encrypted.getContext().getPhiM());
+    }
+    return bytes;
+}
+
+/*
+A fresh ciphertext mod q' for q' a divisor of its q, by dropping primes without scaling (unlike modDownToSet).
+c0 + c1 s = m + t e mod q still holds mod q', and a public key mod q' is distributed as one generated mod q', so the
+result is distributed as a fresh encryption under a context whose chain is these primes.
+*/
+void restrict_to_primes(helib::Ctxt& encrypted, const helib::IndexSet& primes)
+{
+    helib::IndexSet dropped = encrypted.getPrimeSet() / primes;
+    for (helib::CtxtPart& part : encrypted.parts)
+    {
+        part.removePrimes(dropped);
+    }
+    encrypted.primeSet = primes;
+}
+
+/*
+Fill every slot of plain with an independent uniform message. The slots are sampled together as a uniform
+message polynomial mod p, so that slots of degree greater than one are uniform over their whole field.
+*/
+void fill_slots_uniform(helib::Ptxt<helib::BGV>& plain, TrialRandomStream& messages, unsigned long p)
 {
-    NTL::ZZX plaintext, noise_poly;
-    NTL::ZZ noise_zz;
-    NTL::xdouble noise;
-    secret_key.Decrypt(plaintext, encrypted, noise_poly);
-    noise_zz = helib::largestCoeff(noise_poly);
-    conv(noise, noise_zz);
-    return noise;
+    NTL::ZZX message_poly;
+    long phi_m = plain.getContext().getPhiM();
+    for (long j = 0; j < phi_m; j++)
+    {
+        SetCoeff(message_poly, j, long(messages.uniform(p)));
+    }
+    plain.decodeSetData(message_poly);
 }
 
-NTL::xdouble get_noise_budget(helib::Ctxt encrypted, helib::SecKey secret_key)
+/*
+HElib samples all encryption and key randomness from NTL's current (thread-local) random stream.
+Reseeding it from the counter-based stream for (run seed, trial) makes each trial reproducible.
+*/
+void seed_ntl_for_trial(uint64_t run_seed, uint64_t trial, uint32_t stream)
 {
-    NTL::xdouble noise, log_noise, log_q, noise_budget;
-    noise = get_noise(encrypted, secret_key);
-    log_noise = log(noise)/log(NTL::xdouble(2));
-    log_q = NTL::xdouble(encrypted.getContext().logOfProduct(encrypted.getPrimeSet())/log(2));
-    noise_budget = log_q - log_noise - 1;
-    return noise_budget;
+    unsigned char seed[32];
+    TrialRandomStream(run_seed, trial, stream).fill_bytes(seed, sizeof(seed));
+    NTL::SetSeed(seed, sizeof(seed));
 }
 
-NTL::xdouble get_helib_estimated_noise_budget(helib::Ctxt encrypted)
+/* Use coefficients as the secret key, in place of SecKey::GenSecKey; this also generates the public key */
+void import_secret_key(helib::SecKey& secret_key, const helib::Context& context, const vector<int>& coefficients)
 {
-    NTL::xdouble helib_est_noise, log_helib_est_noise, log_q, helib_est_noise_budget;
-    helib_est_noise = encrypted.getNoiseBound();
-    log_helib_est_noise = log(helib_est_noise)/log(NTL::xdouble(2));
-    log_q = NTL::xdouble(encrypted.getContext().logOfProduct(encrypted.getPrimeSet())/log(2));
-    helib_est_noise_budget = log_q - log_helib_est_noise - 1;
-    return helib_est_noise_budget;
+    NTL::ZZX secret_poly;
+    for (size_t j = 0; j < coefficients.size(); j++)
+    {
+        SetCoeff(secret_poly, j, coefficients[j]);
+    }
+    helib::DoubleCRT secret_dcrt(secret_poly, context, context.getCtxtPrimes() | context.getSpecialPrimes());
+    secret_key.ImportSecKey(secret_dcrt, helib::embeddingLargestCoeff(secret_poly, context.getZMStar()));
 }
 
 int main()
@@ -95,6 +510,9 @@ int main()
     {
         cout << "\n HElib noise budget experiments:" << endl << endl;
         cout << "  1. Observed Noise Test" << endl;
+        cout << "  2. Observed Noise Test (trial range)" << endl;
+        cout << "  3. Observed Noise Sweep (worker processes)" << endl;
+        cout << "  4. Observed Noise Sweep (nested modulus chains, shared keys)" << endl;
         cout << "  0. Exit" << endl;
 
         int selection = 0;
@@ -121,6 +539,70 @@ int main()
             break;
         }
 
+        case 2: {
+            long first_trial;
+            int trials;
+            cout << "First trial: ";
+            if (!(cin >> first_trial) || (first_trial < 0))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            cout << "Trials: ";
+            if (!(cin >> trials) || (trials < 1))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            test_noise(trials, first_trial);
+            break;
+        }
+
+        case 3: {
+            long trials;
+            unsigned workers;
+            cout << "Trials per parameter set: ";
+            if (!(cin >> trials) || (trials < 1))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            cout << "Worker processes: ";
+            if (!(cin >> workers) || (workers < 1))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            run_sweep_mode(trials, workers);
+            break;
+        }
+
+        case 4: {
+            unsigned long m;
+            long first_trial;
+            int trials;
+            cout << "m: ";
+            if (!(cin >> m) || (m < 2))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            cout << "First trial: ";
+            if (!(cin >> first_trial) || (first_trial < 0))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            cout << "Trials per modulus chain: ";
+            if (!(cin >> trials) || (trials < 1))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            run_nested_chain_mode(trials, first_trial, m);
+            break;
+        }
+
         case 0: 
             return 0;
 
@@ -133,17 +615,278 @@ int main()
     return 0;
 }
 
-void test_noise(int trials)
+void run_sweep_mode(long trials_per_config, unsigned workers)
 {
-    NTL::xdouble trials_copy(trials);
+    vector<unsigned long> ms = {8192, 16384, 32768};
+    vector<string> stage_names = {"fresh", "mult1", "mult2", "mult3"};
+
+    /*
+    Each work unit is a call of test_noise for trials_per_unit trials, which builds the context and keys of its
+    parameter set; larger units amortise that set-up, smaller ones lose less work when a worker dies.
+    */
+    long trials_per_unit = 250;
+    SweepOptions options;
+    options.workers = workers;
+    options.max_attempts = 3;
+    options.fault_rate = 0;     // set above 0 to kill workers at random and test the reassignment of their units
+
+    auto work = [&](const SweepUnit& unit) {
+        /* The output of test_noise in the workers would interleave with the coordinator's */
+        static bool quiet = false;
+        if (!quiet)
+        {
+            cout.flush();
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+            quiet = true;
+        }
+        vector<StageStatistics> statistics;
+        test_noise(int(unit.trials), long(unit.first_trial), ms[unit.config], &statistics);
+        cout.flush();
+        return statistics;
+    };
+
+    vector<SweepUnit> units = make_sweep_units(ms.size(), trials_per_config, trials_per_unit);
+    cout << "Sweep: " << ms.size() << " parameter sets, " << trials_per_config << " trials each, " << units.size()
+         << " work units, " << workers << " worker processes" << endl << endl;
+    auto sweep_start = chrono::steady_clock::now();
+    SweepResult result = run_sweep(units, ms.size(), work, options);
+    double sweep_seconds = chrono::duration<double>(chrono::steady_clock::now() - sweep_start).count();
+    size_t worker_peak = peak_child_rss_bytes();
+    size_t available = available_memory_bytes();
+
+    for (size_t config = 0; config < ms.size(); config++)
+    {
+        cout << endl << "m = " << ms[config] << endl;
+        print_stage_statistics(result.configs[config], stage_names);
+    }
+    cout << endl << "Sweep finished in " << sweep_seconds << " s, " << result.worker_deaths << " worker deaths";
+    if (!result.failed_units.empty())
+    {
+        cout << ", " << result.failed_units.size() << " work units failed (first: trials "
+             << units[result.failed_units[0]].first_trial << " of m = " << ms[units[result.failed_units[0]].config] << ")";
+    }
+    cout << endl;
+    cout << "Largest worker peak resident set: " << format_megabytes(worker_peak) << ", memory available: "
+         << format_megabytes(available);
+    if (worker_peak > 0 && available > 0)
+    {
+        cout << " (room for " << available / worker_peak << " workers)";
+    }
+    cout << endl << endl;
+}
+
+void print_stage_statistics(const vector<StageStatistics>& stages, const vector<string>& stage_names)
+{
+    cout << setw(12) << "stage" << setw(10) << "trials" << setw(12) << "observed" << setw(12) << "std dev"
+         << setw(12) << "HElib est" << setw(14) << "seconds" << endl;
+    for (size_t stage = 0; stage < stages.size() && stage < stage_names.size(); stage++)
+    {
+        if (stages[stage].observed.count == 0)
+        {
+            continue;
+        }
+        cout << setw(12) << stage_names[stage] << setw(10) << stages[stage].observed.count << fixed
+             << setprecision(2) << setw(12) << stages[stage].observed.mean << setw(12)
+             << stages[stage].observed.standard_deviation() << setw(12) << stages[stage].estimate.mean
+             << setprecision(6) << setw(14) << stages[stage].seconds.mean << defaultfloat << endl;
+    }
+}
+
+void run_nested_chain_mode(int trials, long first_trial, unsigned long m)
+{
+    /*
+    The chains of Table 2, all at one m. A chain built by HElib for fewer bits is not exactly a prefix of the
+    largest one (HElib sizes its primes, and the special primes, for the whole chain), so each view is the prefix
+    of the largest chain whose log2 q is closest to the bits asked for; its actual log2 q is printed with it.
+    */
+    vector<unsigned long> chain_bits = {54, 109, 218, 438};
+    unsigned long max_bits = *max_element(chain_bits.begin(), chain_bits.end());
+    unsigned long p = 3;
+    unsigned long r = 1;
+    unsigned long c = 2;
+    unsigned long k = 80;
+    unsigned long s = 1;
+    uint64_t run_seed = 1;
+    vector<string> stage_names = {"fresh", "mult1", "mult2", "mult3"};
+
+    /*
+    Set write_results to true to also write every trial of every chain to a binary results file (see
+    common/noise_results.h), one file per chain, with the log2 q of its view in the header.
+    */
+    bool write_results = false;
+
+    /* Check that choice of m is ok for the largest chain */
+    long check_m = helib::FindM(k, max_bits, c, p, r, s, m);
+    if (check_m != long(m))
+    {
+        cout << "Could not select m = " << m << ". Using m = " << check_m << " instead." << endl;
+        m = check_m;
+    }
+
+    /* One context and one key generation, for the largest chain */
+    auto setup_start = chrono::steady_clock::now();
+    helib::Context context = helib::ContextBuilder<helib::BGV>()
+                               .m(m)
+                               .p(p)
+                               .r(r)
+                               .bits(max_bits)
+                               .c(c)
+                               .build();
+    log2_q_cache.clear();
+    seed_ntl_for_trial(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_keys));
+    helib::SecKey secret_key(context);
+    secret_key.GenSecKey();
+    secret_key_powers.clear();
+    const helib::PubKey& public_key = secret_key;
+    double setup_seconds = chrono::duration<double>(chrono::steady_clock::now() - setup_start).count();
+
+    /* The prefixes of the chain */
+    vector<helib::IndexSet> prefixes;
+    vector<double> prefix_log2_q;
+    const helib::IndexSet& ctxt_primes = context.getCtxtPrimes();
+    helib::IndexSet prefix;
+    for (long i = ctxt_primes.first(); i <= ctxt_primes.last(); i = ctxt_primes.next(i))
+    {
+        prefix.insert(i);
+        prefixes.push_back(prefix);
+        prefix_log2_q.push_back(context.logOfProduct(prefix)/log(2.0));
+    }
+
+    vector<helib::Ptxt<helib::BGV>> plains(DeepCircuit::leaves, helib::Ptxt<helib::BGV>(context));
+    DeepCircuit::Buffers<HElibDeepBackend> buffers = DeepCircuit::make_buffers<HElibDeepBackend>(helib::Ctxt(public_key));
+    HElibDeepBackend backend(secret_key, plains, false);
 
+    cout << "Nested chains at m = " << m << ": one context and key generation in " << setup_seconds << " s" << endl;
+    cout << "Run seed: " << run_seed << ", trials " << first_trial << " to " << first_trial + trials - 1 << endl;
+    for (unsigned long bits : chain_bits)
+    {
+        size_t view = 0;
+        for (size_t k = 1; k < prefixes.size(); k++)
+        {
+            if (fabs(prefix_log2_q[k] - bits) < fabs(prefix_log2_q[view] - bits))
+            {
+                view = k;
+            }
+        }
+        backend.view = &prefixes[view];
+
+        unique_ptr<NoiseResultsWriter> results_writer;
+        string results_path = "BGV_deep_nested_" + to_string(bits) + "_results.bin";
+        if (write_results)
+        {
+            NoiseResultsHeader header = make_noise_results_header("HElib", "bgv_deep_nested", context.getPhiM(), p,
+                prefix_log2_q[view], stage_names, first_trial);
+            results_writer.reset(new NoiseResultsWriter(results_path, header));
+        }
+
+        /* Every chain runs the same trials, so the cells are paired */
+        vector<StageStatistics> statistics(DeepCircuit::stages);
+        for (int i = 0; i < trials; i++)
+        {
+            uint64_t trial = first_trial + i;
+            seed_ntl_for_trial(run_seed, trial, trial_stream_id(stream_encryption));
+            for (int leaf = 0; leaf < DeepCircuit::leaves; leaf++)
+            {
+                plains[leaf][0] = trial + 1 + leaf;
+            }
+            DeepCircuit::run(backend, buffers);
+            for (int stage = 0; stage < DeepCircuit::stages; stage++)
+            {
+                statistics[stage].add(backend.noise[stage], backend.helib_est[stage], backend.seconds[stage]);
+                if (results_writer)
+                {
+                    results_writer->record(stage, backend.noise[stage], backend.helib_est[stage], backend.seconds[stage]);
+                }
+            }
+            if (results_writer)
+            {
+                results_writer->end_trial();
+            }
+        }
+        if (results_writer)
+        {
+            results_writer->close();
+        }
+        cout << endl << "bits = " << bits << ": " << view + 1 << " of " << prefixes.size() << " primes, log2 q = "
+             << prefix_log2_q[view] << endl;
+        print_stage_statistics(statistics, stage_names);
+        if (results_writer)
+        {
+            cout << "Per-trial results written to " << results_path << endl;
+        }
+    }
+    cout << endl;
+}
+
+void test_noise(int trials, long first_trial, unsigned long sweep_m, vector<StageStatistics>* statistics)
+{
     /* Set verbose to true for debugging. */
     bool verbose = false;
 
+    /*
+    Set slot_packed to true to fill every slot of every plaintext with an independent uniform message mod p,
+    instead of a single value in slot 0. The noise probes then also report the variance of the noise coefficients.
+    */
+    bool slot_packed = false;
+
+    /*
+    Set write_results to true to also write every trial to a binary results file (see common/noise_results.h). The
+    file is named after m and the first trial, e.g. BGV_deep_results_m8192_t0.bin, so that the work units of a sweep,
+    each a run of its own, write files of their own.
+    */
+    bool write_results = false;
+    string results_prefix = "BGV_deep_results";
+
+    /*
+    Set run_planned to true to also evaluate every trial with the relinearization and modulus-switching plan of
+    common/circuit_planner.h: the cheapest plan whose predicted failure probability stays below 2^log2_target_failure
+    at every node. It runs on the same fresh ciphertexts as the default circuit, and its noise budgets and its
+    speedup over the default circuit are reported at the end.
+    */
+    bool run_planned = false;
+    double log2_target_failure = -40;
+
+    /*
+    Set noise_probe_block above 0 to probe the noise that many coefficients at a time (get_noise_budget_chunked)
+    rather than through a ZZX of the whole noise polynomial. The budgets are the same. The probe then holds
+    noise_probe_block ZZ coefficients instead of n; the word-sized residues of c(s), one ciphertext part, remain.
+    Whether a given m fits in a worker is read off the peak resident set of the memory footprint table printed at the
+    end of the run, with and without the flag.
+    */
+    long noise_probe_block = 0;
+
+    /* Seed of the whole run: trial i draws all of its randomness from (run_seed, i) */
+    uint64_t run_seed = 1;
+
+    /*
+    Secret key distribution (see common/secret_distribution.h): secret_default uses SecKey::GenSecKey, the others
+    are sampled from the run seed and imported. secret_hamming_weight is the number of nonzero coefficients of a
+    secret_sparse_ternary secret. The predictions of the drift monitor follow the distribution.
+    */
+    SecretDistribution secret_distribution = secret_default;
+    long secret_hamming_weight = 64;
+
+    /*
+    Every report_every trials, print the throughput, the time remaining and the drift of the observed noise budgets
+    from the average-case prediction (see common/drift_monitor.h). Set abort_drift_bits above 0 to stop the run
+    once the drift of some stage is beyond that many bits.
+    */
+    long report_every = 100;
+    double abort_drift_bits = 0;
+
     /* Select parameters appropriate for our experiment */
     unsigned long m = 8192; // polynomial modulus n = 4096
     //unsigned long m = 16384; // polynomial modulus n = 8192
     //unsigned long m = 32768; // polynomial modulus n = 16384
+    //unsigned long m = 65536; // polynomial modulus n = 32768
+    //unsigned long m = 131072; // polynomial modulus n = 65536, extrapolated bits (see below), untested
+    //unsigned long m = 262144; // polynomial modulus n = 131072, extrapolated bits (see below), untested
+    if (sweep_m != 0)
+    {
+        m = sweep_m;
+    }
     unsigned long p = 3;    // set plaintext modulus t = 3
     unsigned long s = 1;    // lower bound for number of plaintext slots
     
@@ -161,10 +904,19 @@ void test_noise(int trials)
     {
         bits = 218;
     }
-    else
+    else if (m == 32768)
     {
         bits = 438;
     }
+    else if (m == 65536)
+    {
+        bits = 881;
+    }
+    else
+    {
+        /* Beyond the HE Standard tables: its bits double with n, so we extrapolate */
+        bits = m == 131072 ? 1770 : 3540;
+    }
 
     /* Set other parameters to HElib defaults */
     unsigned long r = 1;    // Hensel lifting, default is 1
@@ -187,6 +939,7 @@ void test_noise(int trials)
                                .bits(bits)
                                .c(c)
                                .build();
+    log2_q_cache.clear();
 
 
     // Print the context.
@@ -194,151 +947,252 @@ void test_noise(int trials)
     std::cout << std::endl;
 
     /* Generate keys */
+    cout << "Run seed: " << run_seed << ", trials " << first_trial << " to " << first_trial + trials - 1 << endl << endl;
+    seed_ntl_for_trial(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_keys));
     helib::SecKey secret_key(context);
-    secret_key.GenSecKey();
+    if (secret_distribution == secret_default)
+    {
+        secret_key.GenSecKey();
+    }
+    else
+    {
+        TrialRandomStream secret_stream(run_seed, KEYGEN_TRIAL, trial_stream_id(stream_keys, 1));
+        import_secret_key(secret_key, context, sample_ternary_secret(secret_distribution, context.getPhiM(),
+            secret_hamming_weight, secret_stream));
+    }
+    secret_key_powers.clear();
+    cout << "Secret key: " << secret_distribution_name(secret_distribution);
+    if (secret_distribution == secret_sparse_ternary)
+    {
+        cout << ", Hamming weight " << secret_hamming_weight;
+    }
+    cout << endl << endl;
     const helib::PubKey& public_key = secret_key;
      
     /* Construct plaintext and ciphertext objects */
     const helib::EncryptedArray& ea = context.getEA();
-    helib::Ptxt<helib::BGV> plain1(context);
-    helib::Ptxt<helib::BGV> plain2(context);
-    helib::Ptxt<helib::BGV> plain3(context);
-    helib::Ptxt<helib::BGV> plain4(context);
-    helib::Ptxt<helib::BGV> plain5(context);
-    helib::Ptxt<helib::BGV> plain6(context);
-    helib::Ptxt<helib::BGV> plain7(context);
-    helib::Ptxt<helib::BGV> plain8(context);           
-    helib::Ctxt encrypted1(public_key);
-    helib::Ctxt encrypted2(public_key);
-    helib::Ctxt encrypted3(public_key);
-    helib::Ctxt encrypted4(public_key);
-    helib::Ctxt encrypted5(public_key);
-    helib::Ctxt encrypted6(public_key);
-    helib::Ctxt encrypted7(public_key);
-    helib::Ctxt encrypted8(public_key);
-    helib::Ctxt encrypted9(public_key);
-    helib::Ctxt encrypted10(public_key);
-    helib::Ctxt encrypted11(public_key);
-    helib::Ctxt encrypted12(public_key);
-    helib::Ctxt encrypted13(public_key);
-    helib::Ctxt encrypted14(public_key);
-    helib::Ctxt encrypted15(public_key);
+    vector<helib::Ptxt<helib::BGV>> plains(DeepCircuit::leaves, helib::Ptxt<helib::BGV>(context));
+    DeepCircuit::Buffers<HElibDeepBackend> buffers = DeepCircuit::make_buffers<HElibDeepBackend>(helib::Ctxt(public_key));
+    HElibDeepBackend backend(secret_key, plains, slot_packed);
+    backend.probe_block = noise_probe_block;
+
+    /* The plan, with the default circuit (no relinearization or modulus switching) under the same model for comparison */
+    DeepCircuit::Buffers<HElibDeepBackend> planned_buffers = DeepCircuit::make_buffers<HElibDeepBackend>(helib::Ctxt(public_key));
+    HElibDeepBackend planned_backend(secret_key, plains, slot_packed);
+    planned_backend.probe_block = noise_probe_block;
+    CircuitPlan default_plan, plan;
+    if (run_planned)
+    {
+        PlannerModel model;
+        model.n = context.getPhiM();
+        model.t = p;
+        model.secret_variance = secret_coefficient_variance(secret_distribution, context.getPhiM(), secret_hamming_weight);
+        model.depth = DeepCircuit::stages - 1;
+        model.log2_target_failure = log2_target_failure;
+        const helib::IndexSet& ctxt_primes = context.getCtxtPrimes();
+        helib::IndexSet primes;
+        for (long i = ctxt_primes.first(); i <= ctxt_primes.last(); i = ctxt_primes.next(i))
+        {
+            primes.insert(i);
+            planned_backend.prime_sets.push_back(primes);
+            model.chain_log_q.push_back(context.logOfProduct(primes)/log(2.0));
+        }
+        model.digits = c;
+        model.log_digit = model.chain_log_q.back() / c;
+        model.special_primes = context.getSpecialPrimes().card();
+        model.log_special = context.logOfProduct(context.getSpecialPrimes())/log(2.0);
+
+        default_plan = evaluate_plan(model, vector<LevelPlan>(model.depth));
+        plan = plan_circuit(model);
+        cout << "Default circuit:" << endl;
+        print_plan(default_plan);
+        if (!plan.feasible)
+        {
+            cout << "No plan keeps the predicted failure probability below 2^" << log2_target_failure
+                 << "; not running the planned circuit" << endl << endl;
+            run_planned = false;
+        }
+        else
+        {
+            cout << "Planned circuit (target 2^" << log2_target_failure << "):" << endl;
+            print_plan(plan);
+            cout << "Predicted speedup: " << default_plan.cost / plan.cost << endl << endl;
+            planned_backend.plan = &plan;
+        }
+    }
+
+    /* Optional per-trial binary output: one stage per noise probe below */
+    vector<string> stage_names = {"fresh", "mult1", "mult2", "mult3"};
+    unique_ptr<NoiseResultsWriter> results_writer;
+    string results_path = results_prefix + "_m" + to_string(m) + "_t" + to_string(first_trial) + ".bin";
+    if (write_results)
+    {
+        NoiseResultsHeader header = make_noise_results_header("HElib", "bgv_deep", context.getPhiM(), p,
+            context.logOfProduct(context.getCtxtPrimes())/log(2), stage_names, first_trial);
+        results_writer.reset(new NoiseResultsWriter(results_path, header));
+    }
+
+    /* Every probe goes to the results file and to the statistics of a sweep work unit, as requested */
+    if (statistics)
+    {
+        statistics->assign(DeepCircuit::stages, StageStatistics());
+    }
+    auto record_stage = [&](int stage, double noise, double helib_est, double seconds) {
+        if (results_writer)
+        {
+            results_writer->record(stage, noise, helib_est, seconds);
+        }
+        if (statistics)
+        {
+            (*statistics)[stage].add(noise, helib_est, seconds);
+        }
+    };
+
+    /* Average-case predictions of [MP24] for the active parameters, each stage squaring the previous one */
+    DriftMonitor drift_monitor(stage_names, trials, report_every, abort_drift_bits);
+    double n = context.getPhiM();
+    double secret_variance = secret_coefficient_variance(secret_distribution, n, secret_hamming_weight);
+    long double predicted_variance = variance_fresh(n, p, secret_variance);
+    for (int stage = 0; stage < DeepCircuit::stages; stage++)
+    {
+        drift_monitor.set_prediction(stage, log2_alpha_bound_from_variance(predicted_variance, n));
+        predicted_variance = variance_mult(predicted_variance, predicted_variance, n, p);
+    }
 
     /* Holders for the running total of the observed noises in ciphertexts */
-    NTL::xdouble total_fresh_observed(0);
-    NTL::xdouble total_mult1_observed(0);
-    NTL::xdouble total_mult2_observed(0);
-    NTL::xdouble total_mult3_observed(0);
+    double total_fresh_observed(0);
+    double total_mult1_observed(0);
+    double total_mult2_observed(0);
+    double total_mult3_observed(0);
 
     /* Holders for the running total of the HElib estimated noises in ciphertexts */
-    NTL::xdouble total_fresh_helib_est(0);
-    NTL::xdouble total_mult1_helib_est(0);
-    NTL::xdouble total_mult2_helib_est(0);
-    NTL::xdouble total_mult3_helib_est(0);
+    double total_fresh_helib_est(0);
+    double total_mult1_helib_est(0);
+    double total_mult2_helib_est(0);
+    double total_mult3_helib_est(0);
+
+    /* Running totals of the planned circuit, and evaluation times of both circuits */
+    vector<double> total_planned_observed(DeepCircuit::stages, 0);
+    double min_planned_root_observed = numeric_limits<double>::infinity();
+    long planned_failures = 0;
+    double total_default_seconds = 0;
+    double total_planned_seconds = 0;
+
+    /* Parts, primes and bytes of the probed ciphertexts, printed with the peak resident set */
+    FootprintTable footprints(stage_names);
+
+    /* Holders for the running total of log2 of the noise coefficient variances (slot-packed mode only) */
+    double total_fresh_log_variance(0);
+    double total_mult1_log_variance(0);
+    double total_mult2_log_variance(0);
+    double total_mult3_log_variance(0);
 
     /* Holders for all the observed noises */
-    vector<NTL::xdouble> array_fresh_observed;
+    vector<double> array_fresh_observed;
     array_fresh_observed.reserve(trials);
-    vector<NTL::xdouble> array_mult1_observed;
+    vector<double> array_mult1_observed;
     array_mult1_observed.reserve(trials);
-    vector<NTL::xdouble> array_mult2_observed;
+    vector<double> array_mult2_observed;
     array_mult2_observed.reserve(trials);
-    vector<NTL::xdouble> array_mult3_observed;
+    vector<double> array_mult3_observed;
     array_mult3_observed.reserve(trials);
 
     /* Holders for all the HElib estimated noises */
-    vector<NTL::xdouble> array_fresh_helib_est;
+    vector<double> array_fresh_helib_est;
     array_fresh_helib_est.reserve(trials);
-    vector<NTL::xdouble> array_mult1_helib_est;
+    vector<double> array_mult1_helib_est;
     array_mult1_helib_est.reserve(trials);
-    vector<NTL::xdouble> array_mult2_helib_est;
+    vector<double> array_mult2_helib_est;
     array_mult2_helib_est.reserve(trials);
-    vector<NTL::xdouble> array_mult3_helib_est;
+    vector<double> array_mult3_helib_est;
     array_mult3_helib_est.reserve(trials);
 
     /* Gather noise data over user-specified number of trials */
     for (int i = 0; i < trials; i++)
     {
-        /* Encode the values i+1, ..., i+8 into plaintexts */
-        long value1 = i+1;
-        long value2 = i+2;
-        long value3 = i+3;
-        long value4 = i+4;
-        long value5 = i+5;
-        long value6 = i+6;
-        long value7 = i+7;
-        long value8 = i+8;        
-        plain1[0] = value1;
-        plain2[0] = value2;
-        plain3[0] = value3;
-        plain4[0] = value4;
-        plain5[0] = value5;
-        plain6[0] = value6;
-        plain7[0] = value7;
-        plain8[0] = value8;
-
-        /* Encrypt the plaintexts into ciphertexts */
-        public_key.Encrypt(encrypted1, plain1);
-        public_key.Encrypt(encrypted2, plain2);
-        public_key.Encrypt(encrypted3, plain3);
-        public_key.Encrypt(encrypted4, plain4);
-        public_key.Encrypt(encrypted5, plain5);
-        public_key.Encrypt(encrypted6, plain6);
-        public_key.Encrypt(encrypted7, plain7);
-        public_key.Encrypt(encrypted8, plain8);
-
-        /* What is the observed noise growth at the fresh encryption of ciphertexts? */
-        auto fresh_noise = get_noise_budget(encrypted1, secret_key);
-        total_fresh_observed += fresh_noise;
-        array_fresh_observed.push_back(fresh_noise);
+        /* All randomness of this trial comes from (run_seed, trial) */
+        long trial = first_trial + i;
+        seed_ntl_for_trial(run_seed, trial, trial_stream_id(stream_encryption));
 
-        /* What is the HElib estimated noise growth at the fresh encryption of ciphertexts? */
-        auto fresh_helib_est = get_helib_estimated_noise_budget(encrypted1);
-        total_fresh_helib_est += fresh_helib_est;
-        array_fresh_helib_est.push_back(total_fresh_helib_est);
+        /* Encode the values trial+1, ..., trial+8 into plaintexts */
+        for (int leaf = 0; leaf < DeepCircuit::leaves; leaf++)
+        {
+            plains[leaf][0] = trial + 1 + leaf;
+        }
+        if (slot_packed)
+        {
+            TrialRandomStream messages(run_seed, trial, trial_stream_id(stream_messages));
+            for (auto& plain : plains)
+            {
+                fill_slots_uniform(plain, messages, p);
+            }
+        }
 
-        /*  Multiply the ciphertexts pairwise and store the output in encrypted9, ... , encrypted12 */
-        encrypted9.tensorProduct(encrypted1, encrypted2);
-        encrypted10.tensorProduct(encrypted3, encrypted4);
-        encrypted11.tensorProduct(encrypted5, encrypted6);
-        encrypted12.tensorProduct(encrypted7, encrypted8);
+        /*
+        Encrypt the plaintexts, multiply the ciphertexts pairwise level by level (8 -> 4 -> 2 -> 1) and probe the
+        first ciphertext of every level: straight-line code, expanded at compile time
+        */
+        DeepCircuit::run(backend, buffers);
 
-        /* What is the observed noise growth at the first multiplication of ciphertexts? */
-        auto mult1_noise = get_noise_budget(encrypted9, secret_key);
-        total_mult1_observed += mult1_noise;
-        array_mult1_observed.push_back(mult1_noise);
+        /* Observed noise growth, and HElib estimated noise growth, at the fresh encryption of ciphertexts */
+        auto fresh_noise = backend.noise[0];
+        auto fresh_helib_est = backend.helib_est[0];
+        total_fresh_observed += fresh_noise;
+        total_fresh_log_variance += backend.log_variance[0];
+        total_fresh_helib_est += fresh_helib_est;
+        array_fresh_observed.push_back(fresh_noise);
+        array_fresh_helib_est.push_back(fresh_helib_est);
 
-        /* What is the HElib estimated noise growth at the first multiplication of ciphertexts? */
-        auto mult1_helib_est = get_helib_estimated_noise_budget(encrypted9);
+        /* ... at the first multiplication of ciphertexts */
+        auto mult1_noise = backend.noise[1];
+        auto mult1_helib_est = backend.helib_est[1];
+        total_mult1_observed += mult1_noise;
+        total_mult1_log_variance += backend.log_variance[1];
         total_mult1_helib_est += mult1_helib_est;
-        array_mult1_helib_est.push_back(total_mult1_helib_est);
-
-        /*  Multiply the ciphertexts pairwise and store the output in encrypted13, encrypted14 */
-        encrypted13.tensorProduct(encrypted9, encrypted10);
-        encrypted14.tensorProduct(encrypted11, encrypted12);
+        array_mult1_observed.push_back(mult1_noise);
+        array_mult1_helib_est.push_back(mult1_helib_est);
 
-        /* What is the observed noise growth at the second multiplication of ciphertexts? */
-        auto mult2_noise = get_noise_budget(encrypted13, secret_key);
+        /* ... at the second multiplication of ciphertexts */
+        auto mult2_noise = backend.noise[2];
+        auto mult2_helib_est = backend.helib_est[2];
         total_mult2_observed += mult2_noise;
-        array_mult2_observed.push_back(mult2_noise);  
-
-        /* What is the HElib estimated noise growth at the second multiplication of ciphertexts? */
-        auto mult2_helib_est = get_helib_estimated_noise_budget(encrypted13);
+        total_mult2_log_variance += backend.log_variance[2];
         total_mult2_helib_est += mult2_helib_est;
-        array_mult2_helib_est.push_back(total_mult2_helib_est);
-
-        /*  Multiply the ciphertexts encrypted13 and encrypted14 and stored in encrypted15 */
-        encrypted15.tensorProduct(encrypted13, encrypted14);
+        array_mult2_observed.push_back(mult2_noise);
+        array_mult2_helib_est.push_back(mult2_helib_est);
 
-        /* What is the observed noise growth at the third multiplication of ciphertexts? */
-        auto mult3_noise = get_noise_budget(encrypted15, secret_key);
+        /* ... at the third multiplication of ciphertexts */
+        auto mult3_noise = backend.noise[3];
+        auto mult3_helib_est = backend.helib_est[3];
         total_mult3_observed += mult3_noise;
+        total_mult3_log_variance += backend.log_variance[3];
+        total_mult3_helib_est += mult3_helib_est;
         array_mult3_observed.push_back(mult3_noise);
+        array_mult3_helib_est.push_back(mult3_helib_est);
 
-        /* What is the HElib estimated noise growth at the third multiplication of ciphertexts? */
-        auto mult3_helib_est = get_helib_estimated_noise_budget(encrypted15);
-        total_mult3_helib_est += mult3_helib_est;
-        array_mult3_helib_est.push_back(total_mult3_helib_est);
+        for (int stage = 0; stage < DeepCircuit::stages; stage++)
+        {
+            drift_monitor.record(stage, backend.noise[stage], backend.log2_q[stage]);
+            footprints.record(stage, backend.parts[stage], backend.primes[stage], backend.bytes[stage]);
+        }
+
+        /* The planned circuit, on the same fresh ciphertexts: the trial's random stream starts again */
+        if (run_planned)
+        {
+            seed_ntl_for_trial(run_seed, trial, trial_stream_id(stream_encryption));
+            planned_backend.evaluation_seconds = 0;
+            DeepCircuit::run(planned_backend, planned_buffers);
+            for (int stage = 0; stage < DeepCircuit::stages; stage++)
+            {
+                total_planned_observed[stage] += planned_backend.noise[stage];
+            }
+            double root_noise = planned_backend.noise[DeepCircuit::stages - 1];
+            min_planned_root_observed = min(min_planned_root_observed, root_noise);
+            planned_failures += root_noise <= 0;
+            total_default_seconds += backend.evaluation_seconds;
+            total_planned_seconds += planned_backend.evaluation_seconds;
+        }
+        backend.evaluation_seconds = 0;
 
         if(verbose)
         {
@@ -347,44 +1201,102 @@ void test_noise(int trials)
                 // Decrypt: expected result for i=2 is the product
                 // ((3*4)*(5*6))*((7*8)*(9*10)) = 1814400 = 0 mod 3
                 helib::Ptxt<helib::BGV> plaintext15(context);
-                secret_key.Decrypt(plaintext15, encrypted15);
+                secret_key.Decrypt(plaintext15, buffers[DeepCircuit::root]);
                 std::cout << "Decrypted Result: " << plaintext15 << std::endl;
             }
         }
 
+        if (results_writer || statistics)
+        {
+            for (int stage = 0; stage < DeepCircuit::stages; stage++)
+            {
+                record_stage(stage, backend.noise[stage], backend.helib_est[stage], backend.seconds[stage]);
+            }
+            if (results_writer)
+            {
+                results_writer->end_trial();
+            }
+        }
+
+        if (!drift_monitor.end_trial())
+        {
+            cout << "Aborting the run after " << i + 1 << " trials" << endl << endl;
+            trials = i + 1;
+            break;
+        }
+    }
+
+    if (results_writer)
+    {
+        results_writer->close();
+        cout << "Per-trial results written to " << results_path << endl << endl;
     }
 
     /* Compute the mean of the observed noises */
-    auto mean_fresh_observed = total_fresh_observed / trials_copy;
-    auto mean_mult1_observed = total_mult1_observed / trials_copy;
-    auto mean_mult2_observed = total_mult2_observed / trials_copy;
-    auto mean_mult3_observed = total_mult3_observed / trials_copy;
+    auto mean_fresh_observed = total_fresh_observed / trials;
+    auto mean_mult1_observed = total_mult1_observed / trials;
+    auto mean_mult2_observed = total_mult2_observed / trials;
+    auto mean_mult3_observed = total_mult3_observed / trials;
 
     /* Compute the mean of the HElib estimated noises */
-    auto mean_fresh_helib_est = total_fresh_helib_est/ trials_copy;
-    auto mean_mult1_helib_est = total_mult1_helib_est / trials_copy;
-    auto mean_mult2_helib_est = total_mult2_helib_est / trials_copy;
-    auto mean_mult3_helib_est = total_mult3_helib_est / trials_copy;
+    auto mean_fresh_helib_est = total_fresh_helib_est/ trials;
+    auto mean_mult1_helib_est = total_mult1_helib_est / trials;
+    auto mean_mult2_helib_est = total_mult2_helib_est / trials;
+    auto mean_mult3_helib_est = total_mult3_helib_est / trials;
 
     /* Print out the results */
     cout << "After fresh encryption:" << endl;
     cout << "Mean noise budget observed: " << mean_fresh_observed  << endl;
     cout << "Mean HElib estimated noise budget: " << mean_fresh_helib_est << endl;        
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_fresh_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After first multiplication:" << endl;
     cout << "Mean noise budget observed: " << mean_mult1_observed  << endl;
     cout << "Mean HElib estimated noise budget: " << mean_mult1_helib_est << endl;            
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_mult1_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After second multiplication:" << endl;
     cout << "Mean noise budget observed: " << mean_mult2_observed  << endl;    
     cout << "Mean HElib estimated noise budget: " << mean_mult2_helib_est << endl;        
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_mult2_log_variance / trials << endl;
+    }
     cout << endl;
 
     cout << "After third multiplication:" << endl;
     cout << "Mean noise budget observed: " << mean_mult3_observed  << endl;    
     cout << "Mean HElib estimated noise budget: " << mean_mult3_helib_est << endl;        
+    if (slot_packed)
+    {
+        cout << "Mean log2 noise coefficient variance observed: " << total_mult3_log_variance / trials << endl;
+    }
     cout << endl;
 
+    footprints.print();
+
+    if (run_planned)
+    {
+        cout << "Planned circuit:" << endl;
+        for (int stage = 0; stage < DeepCircuit::stages; stage++)
+        {
+            cout << stage_names[stage] << ": mean noise budget observed " << total_planned_observed[stage] / trials
+                 << " (predicted " << plan.predicted_budget[stage] << ", default circuit predicted "
+                 << default_plan.predicted_budget[stage] << ")" << endl;
+        }
+        cout << "Minimum noise budget observed after the third multiplication: " << min_planned_root_observed
+             << ", decryption failures: " << planned_failures << " of " << trials << endl;
+        cout << "Mean evaluation time: default circuit " << total_default_seconds / trials * 1000 << " ms, planned "
+             << total_planned_seconds / trials * 1000 << " ms, speedup " << total_default_seconds / total_planned_seconds
+             << " (predicted " << default_plan.cost / plan.cost << ")" << endl;
+        cout << endl;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,658 @@
+/*
+    HElib random circuit fuzzer
+    Generates random arithmetic circuits of bounded multiplicative depth (additions, multiplications,
+    plaintext multiplications and modulus switches), evaluates them in parallel batches, and compares
+    the noise budget of each output with the average-case prediction of [MP24] (common/bgv_heuristics.h).
+    Results are summarised per circuit shape, listing first the shapes where the model is furthest off.
+    This code requires the following changes to be made to HElib:
+        - make Ctxt::tensorProduct public so we can do homomorphic multiplication without automatically mod switching or relinearizing
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <helib/helib.h>
+
+#include "bgv_heuristics.h"
+#include "counter_rng.h"
+#include "modulus_cache.h"
+#include "worker_scheduler.h"
+
+using namespace std;
+
+/* Operations that can appear in a random circuit */
+enum FuzzOp
+{
+    op_fresh,
+    op_add,
+    op_mult,
+    op_plain_mult,
+    op_mod_switch
+};
+
+/* One node of a random circuit, with the predicted variance of its noise */
+struct FuzzNode
+{
+    FuzzOp op;
+    int left;       // operand node indices, -1 if unused
+    int right;
+    int depth;      // multiplicative depth
+    int level;      // number of modulus switches applied
+    long double variance;
+};
+
+struct FuzzCircuit
+{
+    vector<FuzzNode> nodes; // topologically ordered, the last node is the output
+    vector<bool> needed;    // whether a node is an ancestor of the output
+    string shape;
+    double predicted_budget;
+};
+
+/* Parameters of the generator, shared by all circuits of a run */
+struct FuzzParams
+{
+    double n;
+    double t;
+    int max_depth;
+    int max_ops;
+    double min_predicted_budget;
+    uint32_t max_attempts;       // candidates generated per circuit before giving up
+    vector<double> log_q_levels; // log2 q after 0, 1, 2, ... modulus switches
+};
+
+/* Observed outcome for one circuit */
+struct FuzzResult
+{
+    string shape;
+    double predicted_budget;
+    double observed_budget;
+};
+
+/* Running statistics of (observed - predicted) for one circuit shape */
+struct ShapeSummary
+{
+    long count = 0;
+    double mean_drift = 0;
+    double m2 = 0;
+    double worst_drift = 0;
+    long worst_circuit = -1;
+};
+
+/* Set-up shared by all circuits of a run: context, keys and the prime set at each level */
+struct FuzzSetup
+{
+    unique_ptr<helib::Context> context;
+    unique_ptr<helib::SecKey> secret_key;
+    vector<helib::IndexSet> level_primes;
+    FuzzParams params;
+    unsigned long p;
+    uint64_t run_seed;
+};
+
+/*
+This function generates and evaluates the given number of random circuits, and prints a summary
+of the observed against predicted noise budgets per circuit shape.
+*/
+void fuzz_circuits(long circuits);
+
+/* This function regenerates and evaluates a single circuit of a run, printing it in full. */
+void replay_circuit(long index);
+
+/* Helper functions */
+FuzzSetup make_fuzz_setup();
+FuzzCircuit generate_circuit(uint64_t run_seed, long index, const FuzzParams& params);
+double evaluate_circuit(const FuzzCircuit& circuit, const helib::SecKey& secret_key, const vector<helib::IndexSet>& level_primes,
+    unsigned long p, uint64_t run_seed, long index);
+string describe_circuit(const FuzzCircuit& circuit);
+double get_log2_q(const helib::Ctxt& encrypted);
+double get_noise_budget(const helib::Ctxt& encrypted, const helib::SecKey& secret_key);
+void fill_slots_uniform(helib::Ptxt<helib::BGV>& plain, TrialRandomStream& messages, unsigned long p);
+void seed_ntl_for_trial(uint64_t run_seed, uint64_t trial, uint32_t stream);
+
+/*
+log2 q of the prime set of encrypted. There are only a few distinct prime sets per run, so the value is cached
+per prime set in log2_q_cache, which must be cleared whenever a new context is built.
+*/
+PrimeSetLog2Cache log2_q_cache;
+
+double get_log2_q(const helib::Ctxt& encrypted)
+{
+    const helib::IndexSet& primes = encrypted.getPrimeSet();
+    auto compute = [&]() { return encrypted.getContext().logOfProduct(primes)/log(2.0); };
+    if (primes.card() == 0 || primes.last() >= 64)
+    {
+        return compute();
+    }
+    uint64_t mask = 0;
+    for (long i = primes.first(); i <= primes.last(); i = primes.next(i))
+    {
+        mask |= uint64_t(1) << i;
+    }
+    return log2_q_cache.lookup(mask, compute);
+}
+
+/* Observed noise budget, as in the other HElib harnesses */
+double get_noise_budget(const helib::Ctxt& encrypted, const helib::SecKey& secret_key)
+{
+    NTL::ZZX plaintext, noise_poly;
+    secret_key.Decrypt(plaintext, encrypted, noise_poly);
+    double log_noise = log(helib::largestCoeff(noise_poly))/log(2);
+    double log_q = get_log2_q(encrypted);
+    return log_q - log_noise - 1;
+}
+
+/*
+Fill every slot of plain with an independent uniform message. The slots are sampled together as a uniform
+message polynomial mod p, so that slots of degree greater than one are uniform over their whole field.
+*/
+void fill_slots_uniform(helib::Ptxt<helib::BGV>& plain, TrialRandomStream& messages, unsigned long p)
+{
+    NTL::ZZX message_poly;
+    long phi_m = plain.getContext().getPhiM();
+    for (long j = 0; j < phi_m; j++)
+    {
+        SetCoeff(message_poly, j, long(messages.uniform(p)));
+    }
+    plain.decodeSetData(message_poly);
+}
+
+/*
+HElib samples all encryption and key randomness from NTL's current (thread-local) random stream.
+Reseeding it from the counter-based stream for (run seed, trial) makes each trial reproducible.
+*/
+void seed_ntl_for_trial(uint64_t run_seed, uint64_t trial, uint32_t stream)
+{
+    unsigned char seed[32];
+    TrialRandomStream(run_seed, trial, stream).fill_bytes(seed, sizeof(seed));
+    NTL::SetSeed(seed, sizeof(seed));
+}
+
+/*
+Generate circuit number index of a run. The circuit only depends on (run seed, index). Candidates whose
+predicted output budget is below params.min_predicted_budget are rejected and regenerated, so that every
+circuit can be decrypted. If none of params.max_attempts candidates qualifies (e.g. a short chain or a large t),
+the parameters cannot be met and a runtime_error says so.
+*/
+FuzzCircuit generate_circuit(uint64_t run_seed, long index, const FuzzParams& params)
+{
+    for (uint32_t attempt = 0; attempt < params.max_attempts; attempt++)
+    {
+        TrialRandomStream stream(run_seed, index, trial_stream_id(stream_circuits, attempt));
+        FuzzCircuit circuit;
+
+        int inputs = 2 + int(stream.uniform(3));
+        for (int k = 0; k < inputs; k++)
+        {
+            circuit.nodes.push_back({op_fresh, -1, -1, 0, 0, variance_fresh(params.n, params.t)});
+        }
+
+        int ops = 1 + int(stream.uniform(params.max_ops));
+        for (int k = 0; k < ops; k++)
+        {
+            FuzzOp op = FuzzOp(1 + stream.uniform(4));
+            int left = int(stream.uniform(circuit.nodes.size()));
+            const FuzzNode a = circuit.nodes[left];
+
+            if (op == op_add || op == op_mult)
+            {
+                /* The second operand must be a different node at the same level */
+                vector<int> candidates;
+                for (int j = 0; j < int(circuit.nodes.size()); j++)
+                {
+                    if (j != left && circuit.nodes[j].level == a.level)
+                    {
+                        candidates.push_back(j);
+                    }
+                }
+                if (candidates.empty())
+                {
+                    continue;
+                }
+                int right = candidates[stream.uniform(candidates.size())];
+                const FuzzNode& b = circuit.nodes[right];
+                if (op == op_add)
+                {
+                    circuit.nodes.push_back({op_add, left, right, max(a.depth, b.depth), a.level,
+                        variance_add(a.variance, b.variance)});
+                }
+                else if (max(a.depth, b.depth) < params.max_depth)
+                {
+                    circuit.nodes.push_back({op_mult, left, right, max(a.depth, b.depth) + 1, a.level,
+                        variance_mult(a.variance, b.variance, params.n, params.t)});
+                }
+            }
+            else if (op == op_plain_mult)
+            {
+                circuit.nodes.push_back({op_plain_mult, left, -1, a.depth, a.level,
+                    variance_plain_mult(a.variance, params.n, params.t)});
+            }
+            else if (a.level + 1 < int(params.log_q_levels.size()))
+            {
+                circuit.nodes.push_back({op_mod_switch, left, -1, a.depth, a.level + 1,
+                    variance_mod_switch(params.n, params.t, params.log_q_levels[a.level], params.log_q_levels[a.level + 1], a.variance)});
+            }
+        }
+
+        const FuzzNode& output = circuit.nodes.back();
+        if (output.op == op_fresh)
+        {
+            continue;
+        }
+        double log_bound = log2_alpha_bound_from_variance(output.variance, params.n);
+        circuit.predicted_budget = noise_budget_from_log2_bound_unrounded(log_bound, params.log_q_levels[output.level]);
+        if (circuit.predicted_budget < params.min_predicted_budget)
+        {
+            continue;
+        }
+
+        /* Only the ancestors of the output are evaluated, and only they count towards the shape */
+        circuit.needed.assign(circuit.nodes.size(), false);
+        circuit.needed.back() = true;
+        int counts[5] = {0, 0, 0, 0, 0};
+        for (int k = int(circuit.nodes.size()) - 1; k >= 0; k--)
+        {
+            if (!circuit.needed[k])
+            {
+                continue;
+            }
+            const FuzzNode& node = circuit.nodes[k];
+            counts[node.op]++;
+            if (node.left >= 0)
+            {
+                circuit.needed[node.left] = true;
+            }
+            if (node.right >= 0)
+            {
+                circuit.needed[node.right] = true;
+            }
+        }
+        ostringstream shape;
+        shape << "depth " << output.depth << ": " << counts[op_fresh] << " fresh, " << counts[op_add] << " add, "
+              << counts[op_mult] << " mult, " << counts[op_plain_mult] << " pmult, " << counts[op_mod_switch] << " modswitch";
+        circuit.shape = shape.str();
+        return circuit;
+    }
+    ostringstream message;
+    message << "generate_circuit: no circuit " << index << " with a predicted budget of at least "
+            << params.min_predicted_budget << " in " << params.max_attempts << " attempts (n = " << params.n
+            << ", t = " << params.t << ", log2 q = " << params.log_q_levels.front() << ", max depth "
+            << params.max_depth << ")";
+    throw runtime_error(message.str());
+}
+
+/* Evaluate circuit number index of a run and return the observed noise budget of its output */
+double evaluate_circuit(const FuzzCircuit& circuit, const helib::SecKey& secret_key, const vector<helib::IndexSet>& level_primes,
+    unsigned long p, uint64_t run_seed, long index)
+{
+    const helib::PubKey& public_key = secret_key;
+    const helib::Context& context = public_key.getContext();
+    seed_ntl_for_trial(run_seed, index, trial_stream_id(stream_encryption));
+    TrialRandomStream messages(run_seed, index, trial_stream_id(stream_messages));
+
+    vector<unique_ptr<helib::Ctxt>> values(circuit.nodes.size());
+    for (size_t k = 0; k < circuit.nodes.size(); k++)
+    {
+        if (!circuit.needed[k])
+        {
+            continue;
+        }
+        const FuzzNode& node = circuit.nodes[k];
+        switch (node.op)
+        {
+        case op_fresh: {
+            helib::Ptxt<helib::BGV> plain(context);
+            fill_slots_uniform(plain, messages, p);
+            values[k].reset(new helib::Ctxt(public_key));
+            public_key.Encrypt(*values[k], plain);
+            break;
+        }
+
+        case op_add:
+            values[k].reset(new helib::Ctxt(*values[node.left]));
+            *values[k] += *values[node.right];
+            break;
+
+        case op_mult:
+            values[k].reset(new helib::Ctxt(public_key));
+            values[k]->tensorProduct(*values[node.left], *values[node.right]);
+            break;
+
+        case op_plain_mult: {
+            /* Plaintext with centered uniform coefficients mod p, as assumed by variance_plain_mult */
+            NTL::ZZX constant_poly;
+            long phi_m = context.getPhiM();
+            for (long j = 0; j < phi_m; j++)
+            {
+                SetCoeff(constant_poly, j, long(messages.uniform(p)) - long(p / 2));
+            }
+            values[k].reset(new helib::Ctxt(*values[node.left]));
+            values[k]->multByConstant(constant_poly);
+            break;
+        }
+
+        case op_mod_switch:
+            values[k].reset(new helib::Ctxt(*values[node.left]));
+            values[k]->modDownToSet(level_primes[node.level]);
+            break;
+        }
+    }
+    return get_noise_budget(*values.back(), secret_key);
+}
+
+string describe_circuit(const FuzzCircuit& circuit)
+{
+    const char* names[] = {"fresh", "add", "mult", "pmult", "modswitch"};
+    ostringstream out;
+    for (size_t k = 0; k < circuit.nodes.size(); k++)
+    {
+        if (!circuit.needed[k])
+        {
+            continue;
+        }
+        const FuzzNode& node = circuit.nodes[k];
+        out << "  c" << k << " = " << names[node.op];
+        if (node.left >= 0)
+        {
+            out << "(c" << node.left;
+            if (node.right >= 0)
+            {
+                out << ", c" << node.right;
+            }
+            out << ")";
+        }
+        out << endl;
+    }
+    return out.str();
+}
+
+int main()
+{
+
+    while (true)
+    {
+        cout << "\n HElib random circuit fuzzing:" << endl << endl;
+        cout << "  1. Random Circuit Noise Test" << endl;
+        cout << "  2. Replay Single Circuit" << endl;
+        cout << "  0. Exit" << endl;
+
+        int selection = 0;
+        cout << endl << "Run example: ";
+        if (!(cin >> selection))
+        {
+            cout << "Invalid option." << endl;
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            continue;
+        }
+
+        switch (selection)
+        {
+        case 1: {
+            long circuits;
+            cout << "Circuits: ";
+            if (!(cin >> circuits) || (circuits < 1))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            fuzz_circuits(circuits);
+            break;
+        }
+
+        case 2: {
+            long index;
+            cout << "Circuit: ";
+            if (!(cin >> index) || (index < 0))
+            {
+                cout << "Invalid option." << endl;
+                break;
+            }
+            replay_circuit(index);
+            break;
+        }
+
+        case 0:
+            return 0;
+
+        default:
+            cout << "Invalid option."<< endl;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+FuzzSetup make_fuzz_setup()
+{
+    FuzzSetup setup;
+
+    /* Seed of the whole run: circuit i and its randomness only depend on (run_seed, i) */
+    setup.run_seed = 1;
+
+    /* Select parameters appropriate for our experiment */
+    unsigned long m = 8192; // polynomial modulus n = 4096
+    //unsigned long m = 16384; // polynomial modulus n = 8192
+    //unsigned long m = 32768; // polynomial modulus n = 16384
+    unsigned long p = 3;    // set plaintext modulus t = 3
+    unsigned long s = 1;    // lower bound for number of plaintext slots
+
+    /* So, we set the number of bits in the modulus chain according to HE Standard*/
+    unsigned long bits;
+    if (m == 4096)
+    {
+        bits = 54;
+    }
+    else if (m == 8192)
+    {
+        bits = 109;
+    }
+    else if (m == 16384)
+    {
+        bits = 218;
+    }
+    else
+    {
+        bits = 438;
+    }
+
+    /* Set other parameters to HElib defaults */
+    unsigned long r = 1;    // Hensel lifting, default is 1
+    unsigned long c = 2;    // columns in key switching matrix, default is 2 or 3
+    unsigned long k = 80;   // security parameter, default is 80 (may not correspond to true bit security)
+
+    /* Check that choice of m is ok */
+    long check_m = helib::FindM(k, bits, c, p, r, s, m);
+    if (check_m != m)
+    {
+        cout << "Could not select m = " << m << ". Using m = " << check_m << " instead." << endl;
+        m = check_m;
+    }
+
+    /* Shape of the random circuits */
+    setup.params.max_depth = 3;                 // maximum multiplicative depth
+    setup.params.max_ops = 8;                   // maximum number of operations after the fresh inputs
+    setup.params.min_predicted_budget = 5;      // circuits predicted to leave less budget are regenerated
+    setup.params.max_attempts = 10000;          // candidates per circuit before the parameters are reported as unusable
+
+    /* Store parameters in context and construct chain of moduli */
+    setup.context.reset(new helib::Context(helib::ContextBuilder<helib::BGV>()
+                               .m(m)
+                               .p(p)
+                               .r(r)
+                               .bits(bits)
+                               .c(c)
+                               .build()));
+    log2_q_cache.clear();
+    setup.context->printout();
+    std::cout << std::endl;
+    setup.p = p;
+    setup.params.n = setup.context->getPhiM();
+    setup.params.t = p;
+
+    /* Generate keys */
+    seed_ntl_for_trial(setup.run_seed, KEYGEN_TRIAL, trial_stream_id(stream_keys));
+    setup.secret_key.reset(new helib::SecKey(*setup.context));
+    setup.secret_key->GenSecKey();
+
+    /* Level 0 is the prime set of a fresh ciphertext; each modulus switch drops the last prime */
+    const helib::PubKey& public_key = *setup.secret_key;
+    helib::Ctxt probe(public_key);
+    helib::Ptxt<helib::BGV> zero(*setup.context);
+    public_key.Encrypt(probe, zero);
+    helib::IndexSet primes = probe.getPrimeSet();
+    while (primes.card() > 0)
+    {
+        setup.level_primes.push_back(primes);
+        setup.params.log_q_levels.push_back(setup.context->logOfProduct(primes)/log(2));
+        primes.remove(primes.last());
+    }
+    return setup;
+}
+
+void fuzz_circuits(long circuits)
+{
+    FuzzSetup setup = make_fuzz_setup();
+
+    /*
+    Circuits are evaluated in batches of batch_size, by threads workers pinned to their cores (see
+    common/worker_scheduler.h). Set worker_count to 0 to choose the number of workers from the working set of a
+    circuit: up to 4 fresh inputs and max_ops results, each of up to 3 parts over the fresh ciphertext primes.
+    */
+    long batch_size = 64;
+    unsigned worker_count = 0;
+    size_t ciphertext_bytes = 3 * sizeof(long) * size_t(setup.params.n) * size_t(setup.level_primes[0].card());
+    WorkerScheduler scheduler((4 + setup.params.max_ops) * ciphertext_bytes, worker_count);
+    unsigned threads = scheduler.workers();
+
+    /* Every NUMA node gets its own copy of the secret key, which holds the public and key-switching keys */
+    NodeLocalCopies<helib::SecKey> secret_keys(*setup.secret_key, scheduler.nodes());
+
+    /* Shapes whose mean drift is larger than this (in bits) are flagged */
+    double flag_threshold = 2.0;
+
+    cout << "Run seed: " << setup.run_seed << ", " << circuits << " circuits, " << threads << " threads" << endl;
+    scheduler.print();
+    cout << endl;
+
+    map<string, ShapeSummary> summaries;
+    vector<FuzzResult> batch_results(batch_size);
+    vector<string> errors;
+    auto run_start = chrono::steady_clock::now();
+
+    for (long batch_start = 0; batch_start < circuits; batch_start += batch_size)
+    {
+        long batch_end = min(circuits, batch_start + batch_size);
+        atomic<long> next(batch_start);
+        vector<string> thread_errors(threads);
+        vector<thread> workers;
+        for (unsigned w = 0; w < threads; w++)
+        {
+            workers.emplace_back([&, w]() {
+                try
+                {
+                    scheduler.pin(w);
+                    const helib::SecKey& secret_key = secret_keys.get(scheduler.node_of(w));
+                    for (long index = next++; index < batch_end; index = next++)
+                    {
+                        FuzzCircuit circuit = generate_circuit(setup.run_seed, index, setup.params);
+                        double observed = evaluate_circuit(circuit, secret_key, setup.level_primes, setup.p, setup.run_seed, index);
+                        batch_results[index - batch_start] = {circuit.shape, circuit.predicted_budget, observed};
+                    }
+                }
+                catch (const exception& e)
+                {
+                    thread_errors[w] = e.what();
+                }
+            });
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+        for (auto& error : thread_errors)
+        {
+            if (!error.empty())
+            {
+                cout << "Error in batch starting at circuit " << batch_start << ": " << error << endl;
+                return;
+            }
+        }
+
+        /* Merge in circuit order, so that the summary does not depend on thread scheduling */
+        for (long index = batch_start; index < batch_end; index++)
+        {
+            const FuzzResult& result = batch_results[index - batch_start];
+            ShapeSummary& summary = summaries[result.shape];
+            double drift = result.observed_budget - result.predicted_budget;
+            summary.count++;
+            double delta = drift - summary.mean_drift;
+            summary.mean_drift += delta / summary.count;
+            summary.m2 += delta * (drift - summary.mean_drift);
+            if (summary.worst_circuit < 0 || fabs(drift) > fabs(summary.worst_drift))
+            {
+                summary.worst_drift = drift;
+                summary.worst_circuit = index;
+            }
+        }
+
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - run_start).count();
+        cout << "Circuits " << batch_end << "/" << circuits << ", " << setprecision(3) << batch_end / seconds
+             << " circuits/s, " << summaries.size() << " shapes" << endl;
+    }
+
+    /* Shapes where the model is worst come first */
+    vector<pair<string, ShapeSummary>> sorted(summaries.begin(), summaries.end());
+    sort(sorted.begin(), sorted.end(), [](const pair<string, ShapeSummary>& a, const pair<string, ShapeSummary>& b) {
+        return fabs(a.second.mean_drift) > fabs(b.second.mean_drift);
+    });
+
+    cout << endl << "Observed minus predicted noise budget (bits), per circuit shape:" << endl;
+    cout << setw(10) << "circuits" << setw(12) << "mean" << setw(12) << "std dev" << setw(12) << "worst"
+         << setw(14) << "worst circuit" << "  shape" << endl;
+    for (auto& entry : sorted)
+    {
+        const ShapeSummary& summary = entry.second;
+        double std_dev = summary.count > 1 ? sqrt(summary.m2 / (summary.count - 1)) : 0;
+        cout << setw(10) << summary.count << fixed << setprecision(2) << setw(12) << summary.mean_drift
+             << setw(12) << std_dev << setw(12) << summary.worst_drift << setw(14) << summary.worst_circuit
+             << "  " << entry.first;
+        if (fabs(summary.mean_drift) > flag_threshold)
+        {
+            cout << "  <-- flagged";
+        }
+        cout << defaultfloat << endl;
+    }
+    cout << endl;
+}
+
+void replay_circuit(long index)
+{
+    FuzzSetup setup = make_fuzz_setup();
+    FuzzCircuit circuit;
+    try
+    {
+        circuit = generate_circuit(setup.run_seed, index, setup.params);
+    }
+    catch (const exception& e)
+    {
+        cout << e.what() << endl << endl;
+        return;
+    }
+    double observed = evaluate_circuit(circuit, *setup.secret_key, setup.level_primes, setup.p, setup.run_seed, index);
+
+    cout << "Circuit " << index << " (" << circuit.shape << "):" << endl;
+    cout << describe_circuit(circuit);
+    cout << "Predicted noise budget: " << circuit.predicted_budget << endl;
+    cout << "Observed noise budget: " << observed << endl;
+    cout << endl;
+}
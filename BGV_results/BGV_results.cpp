@@ -0,0 +1,148 @@
+/*
+    Reader for the binary results files of the noise harnesses (see common/noise_results.h)
+    Prints the header of each file and, per stage, the number of trials recorded and the mean observed budget,
+    estimated budget and seconds, read column by column through the memory-mapped NoiseResultsReader.
+    Usage: BGV_results file.bin [file.bin ...]
+           BGV_results --check
+    --check writes a file with known values over several blocks, the last one partial, reads it back and compares
+    every value, so that the writer, the block layout and the reader are exercised together. It exits with a
+    non-zero status on any difference.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "noise_results.h"
+
+using namespace std;
+
+/* Deterministic test values for the round-trip check, distinct for every trial, stage and column */
+double check_value(uint64_t trial, int stage, NoiseResultsColumn column)
+{
+    return double(trial) * 16 + stage + 0.25 * column;
+}
+
+int run_check()
+{
+    const uint64_t trials = 10;
+    const uint64_t first_trial = 1000;
+    const int skipped_stage = 2;        // never recorded: must read back as NaN
+    vector<string> stage_names = {"fresh", "mult1", "mult2", "mult3"};
+    string path = "BGV_results_check_" + to_string(getpid()) + ".bin";
+
+    {
+        NoiseResultsHeader header = make_noise_results_header("check", "round_trip", 4096, 3, 109.5, stage_names,
+            first_trial, 4);
+        NoiseResultsWriter writer(path, header);
+        for (uint64_t trial = 0; trial < trials; trial++)
+        {
+            for (int stage = 0; stage < int(stage_names.size()); stage++)
+            {
+                if (stage != skipped_stage)
+                {
+                    writer.record(stage, check_value(trial, stage, column_observed),
+                        check_value(trial, stage, column_estimate), check_value(trial, stage, column_seconds));
+                }
+            }
+            writer.end_trial();
+        }
+        writer.close();
+    }
+
+    long errors = 0;
+    {
+        NoiseResultsReader reader(path);
+        const NoiseResultsHeader& header = reader.header();
+        if (reader.trials() != trials || reader.block_count() != 3 || reader.block_trial_count(2) != 2
+            || header.first_trial != first_trial || header.n != 4096 || header.t != 3 || header.log_q != 109.5
+            || reader.stage_index("mult3") != 3 || reader.stage_index("none") != -1)
+        {
+            cout << "Header or block layout read back wrong" << endl;
+            errors++;
+        }
+        for (uint64_t trial = 0; trial < trials; trial++)
+        {
+            for (int stage = 0; stage < int(stage_names.size()); stage++)
+            {
+                for (NoiseResultsColumn column : {column_observed, column_estimate, column_seconds})
+                {
+                    double value = reader.value(trial, stage, column);
+                    bool ok = stage == skipped_stage ? std::isnan(value) : value == check_value(trial, stage, column);
+                    if (!ok)
+                    {
+                        cout << "Trial " << trial << ", stage " << stage << ", column " << column << ": read " << value
+                             << endl;
+                        errors++;
+                    }
+                }
+            }
+        }
+        double expected_mean = 0;
+        for (uint64_t trial = 0; trial < trials; trial++)
+        {
+            expected_mean += check_value(trial, 1, column_observed) / trials;
+        }
+        if (fabs(reader.mean(1, column_observed) - expected_mean) > 1e-9 || !std::isnan(reader.mean(skipped_stage,
+            column_observed)))
+        {
+            cout << "Column means read back wrong" << endl;
+            errors++;
+        }
+    }
+    remove(path.c_str());
+
+    cout << (errors == 0 ? "Round trip OK" : "Round trip FAILED") << ": " << trials << " trials, "
+         << stage_names.size() << " stages, blocks of 4" << endl;
+    return errors == 0 ? 0 : 1;
+}
+
+void print_summary(const string& path)
+{
+    NoiseResultsReader reader(path);
+    const NoiseResultsHeader& header = reader.header();
+    cout << path << ": " << header.backend << ", circuit " << header.circuit << ", n = " << header.n << ", t = "
+         << header.t << ", log2 q = " << header.log_q << endl;
+    cout << "Trials " << header.first_trial << " to " << header.first_trial + reader.trials() - 1 << " ("
+         << reader.trials() << " in " << reader.block_count() << " blocks)" << endl;
+    cout << setw(12) << "stage" << setw(12) << "observed" << setw(12) << "estimate" << setw(14) << "seconds" << endl;
+    for (uint32_t stage = 0; stage < header.stage_count; stage++)
+    {
+        cout << setw(12) << header.stage_names[stage] << fixed << setprecision(2) << setw(12)
+             << reader.mean(int(stage), column_observed) << setw(12) << reader.mean(int(stage), column_estimate)
+             << setprecision(6) << setw(14) << reader.mean(int(stage), column_seconds) << defaultfloat << endl;
+    }
+    cout << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: " << argv[0] << " file.bin [file.bin ...] | --check" << endl;
+        return 2;
+    }
+    if (string(argv[1]) == "--check")
+    {
+        return run_check();
+    }
+    int status = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        try
+        {
+            print_summary(argv[i]);
+        }
+        catch (const exception& error)
+        {
+            cout << error.what() << endl;
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,232 @@
+# Importance-sampling estimates of the BGV decryption failure probability, for failure rates far beyond the reach of
+# plain Monte Carlo over harness trials (2^-40 and much smaller)
+# The noise is simulated at polynomial level, as in the harnesses: fresh ciphertexts under a public key b = -a*s + t*e
+# have noise v = m + t*(u*e + e1 + e2*s) in Z[x]/(x^n + 1), with m uniform mod t (centered), u uniform ternary,
+# e, e1, e2 Gaussian with standard deviation SIGMA and s uniform ternary or sparse ternary of Hamming weight h. As in
+# the average-case model, the public key error e is drawn independently for every ciphertext
+# Decryption fails if a coefficient of the noise reaches q/2. By symmetry every coefficient has the same tail, and
+# the failure probability is at most n times that of coefficient 0, which is what is estimated:
+#   - Conditional Gaussian: given the ternary terms (and the other input of a product), coefficient 0 is Gaussian in
+#     the Gaussian terms, with explicit mean and variance, so its tail probability is computed exactly (in the log
+#     domain) rather than sampled
+#   - Variance tilting: the remaining error and secret terms are sampled with a larger spread, Gaussians scaled by
+#     lambda and ternary coefficients nonzero with probability rho > 2/3, pushing samples toward the tail, and every
+#     sample is reweighted by its likelihood ratio. lambda and rho are picked by a short pilot run
+# The estimate comes with a 95% confidence interval from the weighted sample variance, and the effective sample size
+# of the weights. Below MIN_EFFECTIVE_SAMPLES effective samples the tail is beyond what the tilting reaches: a few
+# weights carry the whole sum, so neither the estimate nor its interval mean anything, and the result is reported as
+# not estimable. Everything is carried in log2. Stages: "fresh" and "mult" (the product of two fresh
+# ciphertexts before relinearization, as in the harnesses)
+#
+# Example: the mult stage at n = 4096, t = 3, with a 29-bit modulus (per-coefficient failure rate around 2^-43)
+#   python3 bgv_failure_probability.py --n 4096 --log-q 29 --t 3 --stage mult --samples 20000
+
+###########
+# Imports #
+###########
+
+import argparse
+import time
+
+import numpy as np
+from scipy.special import log_ndtr
+
+from bgv_heuristics_grid import SIGMA, log2_variance_fresh, log2_variance_mult, secret_variance
+
+
+LN2 = np.log(2)
+
+# Fewer effective samples than this, and the estimate is reported as not estimable
+MIN_EFFECTIVE_SAMPLES = 100
+
+
+##################################
+# Polynomials in Z[x]/(x^n + 1) #
+##################################
+
+# Negacyclic products of batches of polynomials (rows), through a length-n FFT of the twisted coefficients
+def negacyclic_multiply(a, b):
+    n = a.shape[-1]
+    twist = np.exp(1j * np.pi * np.arange(n) / n)
+    product = np.fft.ifft(np.fft.fft(a * twist) * np.fft.fft(b * twist))
+    return np.real(product * np.conj(twist))
+
+# Coefficient 0 of the negacyclic products a*b: a_0 b_0 - sum_{j >= 1} a_j b_{n-j}
+def constant_coefficient(a, b):
+    return a[:, 0] * b[:, 0] - np.sum(a[:, 1:] * b[:, :0:-1], axis=1)
+
+
+##########################################
+# Tilted sampling and likelihood ratios #
+##########################################
+
+# Gaussian vectors with standard deviation lambda*SIGMA, and log of the likelihood ratio (untilted over tilted)
+def sample_gaussian(rng, shape, tilt):
+    x = rng.normal(0, tilt * SIGMA, size=shape)
+    log_ratio = shape[-1] * np.log(tilt) - np.sum(x * x, axis=-1) / (2 * SIGMA**2) * (1 - 1 / tilt**2)
+    return x, log_ratio
+
+# Ternary vectors, nonzero with probability rho instead of 2/3 (uniform ternary), and the log likelihood ratio
+def sample_ternary(rng, shape, rho):
+    nonzero = rng.random(shape) < rho
+    x = np.where(nonzero, rng.choice([-1.0, 1.0], size=shape), 0.0)
+    count = np.sum(nonzero, axis=-1)
+    log_ratio = count * np.log((2. / 3) / rho) + (shape[-1] - count) * np.log((1. / 3) / (1 - rho))
+    return x, log_ratio
+
+# The secret key: uniform ternary (tilted like u), or sparse ternary of Hamming weight h (not tilted)
+def sample_secret(rng, batch, n, hamming_weight, rho):
+    if hamming_weight == 0:
+        return sample_ternary(rng, (batch, n), rho)
+    s = np.zeros((batch, n))
+    for row in range(batch):
+        positions = rng.choice(n, size=hamming_weight, replace=False)
+        s[row, positions] = rng.choice([-1.0, 1.0], size=hamming_weight)
+    return s, np.zeros(batch)
+
+def sample_messages(rng, batch, n, t):
+    return rng.integers(0, t, size=(batch, n)).astype(float) - (t // 2)
+
+
+####################################################
+# log of the conditional tail of coefficient 0 #
+####################################################
+
+# log P(|N(mean, sd^2)| >= bound), in the natural log
+def log_gaussian_tail(mean, sd, bound):
+    return np.logaddexp(log_ndtr((mean - bound) / sd), log_ndtr((-mean - bound) / sd))
+
+# One batch of samples: log weight + log conditional tail probability of |coefficient 0| >= q/2, per sample
+def sample_batch(rng, stage, n, t, log_q, hamming_weight, tilt, rho, batch):
+    bound = 2.0**(log_q - 1)
+    s, log_ratio = sample_secret(rng, batch, n, hamming_weight, rho)
+    u1, ratio = sample_ternary(rng, (batch, n), rho)
+    log_ratio = log_ratio + ratio
+    m1 = sample_messages(rng, batch, n, t)
+
+    if stage == "fresh":
+        # v = m + t*(u*e + e1 + e2*s): given u and s, coefficient 0 is Gaussian with variance
+        # t^2 sigma^2 (|u|^2 + 1 + |s|^2), since coeff_0(a*b) is a dotted with a signed permutation of b
+        mean = m1[:, 0]
+        sd = t * SIGMA * np.sqrt(np.sum(u1 * u1, axis=1) + 1 + np.sum(s * s, axis=1))
+    else:
+        # v = v1*v2 with v1 = m1 + t*(u1*e + e1 + e2*s): given v2, u1 and s, coefficient 0 is Gaussian with mean
+        # coeff_0(m1*v2) and variance t^2 sigma^2 (|u1*v2|^2 + |v2|^2 + |s*v2|^2)
+        u2, ratio = sample_ternary(rng, (batch, n), rho)
+        log_ratio = log_ratio + ratio
+        e, ratio = sample_gaussian(rng, (batch, n), tilt)
+        log_ratio = log_ratio + ratio
+        e1, ratio = sample_gaussian(rng, (batch, n), tilt)
+        log_ratio = log_ratio + ratio
+        e2, ratio = sample_gaussian(rng, (batch, n), tilt)
+        log_ratio = log_ratio + ratio
+        m2 = sample_messages(rng, batch, n, t)
+        v2 = m2 + t * (negacyclic_multiply(u2, e) + e1 + negacyclic_multiply(e2, s))
+        mean = constant_coefficient(m1, v2)
+        u1_v2 = negacyclic_multiply(u1, v2)
+        s_v2 = negacyclic_multiply(s, v2)
+        sd = t * SIGMA * np.sqrt(np.sum(u1_v2 * u1_v2, axis=1) + np.sum(v2 * v2, axis=1) + np.sum(s_v2 * s_v2, axis=1))
+    return log_ratio + log_gaussian_tail(mean, sd, bound)
+
+
+###############
+# Estimation #
+###############
+
+# Importance-sampling estimate from natural-log terms: log2 of the estimate, log2 of its standard error, and the
+# effective sample size of the weights. The terms are scaled by the largest before they are exponentiated, so the
+# relative variance does not cancel to 0 when the terms are far below the range of a double
+def summarize(log_terms):
+    count = len(log_terms)
+    shift = np.max(log_terms)
+    if not np.isfinite(shift) or count < 2:
+        return -np.inf, np.inf, 0.0
+    weights = np.exp(log_terms - shift)
+    mean = np.mean(weights)
+    relative_variance = np.var(weights, ddof=1) / (mean * mean)
+    log_mean = shift + np.log(mean)
+    log_standard_error = log_mean + 0.5 * np.log(relative_variance / count) if relative_variance > 0 else -np.inf
+    effective_samples = np.sum(weights)**2 / np.sum(weights * weights)
+    return log_mean / LN2, log_standard_error / LN2, effective_samples
+
+def run_samples(rng, stage, n, t, log_q, hamming_weight, tilt, rho, samples, batch_size):
+    terms = []
+    for start in range(0, samples, batch_size):
+        batch = min(batch_size, samples - start)
+        terms.append(sample_batch(rng, stage, n, t, log_q, hamming_weight, tilt, rho, batch))
+    return np.concatenate(terms)
+
+# log2 of the variance of a noise coefficient in the average-case model of bgv_heuristics_grid.py
+def log2_model_variance(stage, n, t, hamming_weight):
+    log_variance = log2_variance_fresh(n, t, secret_variance(n, hamming_weight))
+    if stage == "mult":
+        log_variance = log2_variance_mult(log_variance, log_variance, n, t)
+    return log_variance
+
+# log2 of the per-coefficient failure probability predicted by the average-case model: a Gaussian tail
+def log2_model_failure(stage, n, t, log_q, hamming_weight):
+    sd = 2.0**(0.5 * log2_model_variance(stage, n, t, hamming_weight))
+    return float(log_gaussian_tail(0.0, sd, 2.0**(log_q - 1))) / LN2
+
+# The tilt with the smallest estimated relative variance, from pilot_samples samples each. The conditional variance is
+# a sum over about n coefficients of u, s and the Gaussians: to reach k standard deviations of the model, inflating
+# it by 1 + delta gains about k^2 delta / 2 in the log tail and costs about n delta^2 (a few vectors tilted by delta),
+# so the best delta is around k^2 / (8n). The tilts tried scale the Gaussians by sqrt(1 + delta) and the nonzero
+# ternary probability by 1 + delta, for delta from 0 to twice that. delta = 0 (plain Monte Carlo) is only tried if
+# the model puts the tail within reach of the samples, above 1 / samples. A pilot with fewer than a tenth of its
+# samples effective is degenerate: its relative error is itself a single-weight estimate, so it ranks after all others
+def choose_tilt(rng, stage, n, t, log_q, hamming_weight, samples, pilot_samples, batch_size):
+    k = 2.0**(log_q - 1 - 0.5 * log2_model_variance(stage, n, t, hamming_weight))
+    fractions = [0, 1. / 32, 1. / 16, 1. / 8, 1. / 4]
+    if log2_model_failure(stage, n, t, log_q, hamming_weight) < -np.log2(samples):
+        fractions = fractions[1:]
+    best = None
+    for delta in k * k / n * np.array(fractions):
+        tilt, rho = np.sqrt(1 + delta), min(2. / 3 * (1 + delta), 0.95)
+        log_terms = run_samples(rng, stage, n, t, log_q, hamming_weight, tilt, rho, pilot_samples, batch_size)
+        log_mean, log_error, effective_samples = summarize(log_terms)
+        score = (effective_samples < pilot_samples / 10, 2.0**(log_error - log_mean))
+        if best is None or score < best[0]:
+            best = (score, tilt, rho)
+    return best[1], best[2]
+
+def estimate_failure(stage, n, t, log_q, hamming_weight=0, samples=20000, pilot_samples=256, batch_size=64, seed=1):
+    rng = np.random.default_rng(seed)
+    start = time.time()
+    tilt, rho = choose_tilt(rng, stage, n, t, log_q, hamming_weight, samples, pilot_samples, batch_size)
+    log_terms = run_samples(rng, stage, n, t, log_q, hamming_weight, tilt, rho, samples, batch_size)
+    log_p, log_error, effective_samples = summarize(log_terms)
+    return {"log2_p": log_p, "log2_standard_error": log_error, "effective_samples": effective_samples,
+            "estimable": effective_samples >= MIN_EFFECTIVE_SAMPLES, "tilt": tilt, "rho": rho, "log2_model_p": log2_model_failure(stage, n, t, log_q, hamming_weight), "seconds": time.time() - start}
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Importance-sampling estimate of the BGV decryption failure probability")
+    parser.add_argument("--n", type=int, default=4096)
+    parser.add_argument("--log-q", type=float, default=109)
+    parser.add_argument("--t", type=int, default=3)
+    parser.add_argument("--stage", choices=["fresh", "mult"], default="mult")
+    parser.add_argument("--hamming-weight", type=int, default=0, help="Hamming weight of a sparse ternary secret, 0 for uniform ternary")
+    parser.add_argument("--samples", type=int, default=20000)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    result = estimate_failure(args.stage, args.n, args.t, args.log_q, args.hamming_weight, args.samples, seed=args.seed)
+    log_p = result["log2_p"]
+    print("stage " + args.stage + ", n = " + str(args.n) + ", log q = " + str(args.log_q) + ", t = " + str(args.t) +
+          ", secret " + ("uniform ternary" if args.hamming_weight == 0 else "Hamming weight " + str(args.hamming_weight)))
+    print("tilt: lambda = %.4f, rho = %.3f" % (result["tilt"], result["rho"]))
+    if result["estimable"]:
+        relative_error = 2.0**(result["log2_standard_error"] - log_p)
+        low = log_p + np.log2(max(1 - 1.96 * relative_error, 1e-300))
+        high = log_p + np.log2(1 + 1.96 * relative_error)
+        print("log2 P(|coefficient| >= q/2), importance sampling: %.2f (95%% CI %.2f to %.2f), relative error %.3f, "
+              "%d samples, effective %.0f" % (log_p, low, high, relative_error, args.samples, result["effective_samples"]))
+    else:
+        print("log2 P(|coefficient| >= q/2), importance sampling: not estimable (%.0f effective of %d samples, fewer "
+              "than %d): the tail is beyond what the tilting reaches" % (result["effective_samples"], args.samples,
+              MIN_EFFECTIVE_SAMPLES))
+    print("log2 P(|coefficient| >= q/2), average-case model:   %.2f" % result["log2_model_p"])
+    if result["estimable"]:
+        print("log2 P(decryption failure) <= %.2f (union bound over the n coefficients)" % (log_p + np.log2(args.n)))
+    print("%.1f s" % result["seconds"])
@@ -0,0 +1,231 @@
+# Vectorized evaluation of the worst-case and average-case BGV noise heuristics over parameter grids
+# The formulas are the [Iliashenko19, CLP20] worst-case bounds and the average-case variances of Figure 5 of
+# [MP24], stated in the linear domain by generate_bgv_heuristics_tables.py (bound_fresh, variance_mult, ...), and
+# evaluated array-at-a-time with NumPy for capacity planning
+# Everything is computed in the log2 domain, so deep circuits and large n do not overflow: moduli only ever enter
+# as log2 q, and products and quotients of bounds and variances become sums and differences of their logs
+# The log2 functions below are also the engine behind the estimates printed by generate_bgv_heuristics_tables.py
+#
+# Example: budgets of the "bgv deep" circuit (a chain of squarings) over a grid, streamed to a CSV file
+#   python3 bgv_heuristics_grid.py --n 4096 8192 16384 32768 --log-q 50:1000:1 --t 3 65537 --depth 0:6 \
+#       --alpha 0.001 0.00001 --out grid.csv
+
+###########
+# Imports #
+###########
+
+import argparse
+import time
+
+import mpmath
+import numpy as np
+from scipy.special import erfcinv
+
+
+SIGMA = 3.19
+TERNARY_SECRET_VARIANCE = 2. / 3
+GRID_COLUMNS = ["n", "log_q", "t", "depth", "alpha", "worst_case_budget", "average_case_budget"]
+
+
+#################################################################
+# Worst-case bounds and average-case variances, in log2 domain #
+#################################################################
+
+# log2 of the fresh bound 6 t sqrt(n sigma^2 (4n/3 + 1) + n/12)
+def log2_bound_fresh(n, t):
+    inside_sqrt = n * SIGMA**2 * ((4./3) * n + 1) + n / 12.
+    return np.log2(6 * t) + 0.5 * np.log2(inside_sqrt)
+
+# log2 of the bound after switching from q to p, t sqrt(3n + 2n^2) + (p/q) bound, given log2 q, log2 p and log2 bound
+def log2_bound_mod_switch(n, t, log_q, log_p, log_bound):
+    return np.logaddexp2(np.log2(t) + 0.5 * np.log2(3 * n + 2 * n * n), log_p - log_q + log_bound)
+
+# Variance of a coefficient of the secret key: uniform ternary, or sparse ternary of Hamming weight h if h > 0
+def secret_variance(n, hamming_weight=0):
+    return np.where(np.asarray(hamming_weight) > 0, np.asarray(hamming_weight, dtype=float) / n, TERNARY_SECRET_VARIANCE)
+
+# log2 of the fresh variance (n (2/3 + secret_variance) + 1) t^2 sigma^2
+def log2_variance_fresh(n, t, secret_variance=TERNARY_SECRET_VARIANCE):
+    return np.log2((n * (2./3 + secret_variance) + 1) * t * t * SIGMA**2)
+
+# log2 of the variance after addition, v1 + v2, given log2 v1 and log2 v2
+def log2_variance_add(log_v1, log_v2):
+    return np.logaddexp2(log_v1, log_v2)
+
+# log2 of the variance after multiplication, n v1 v2 + (v1 + v2) n (t^2 - 1)/12, given log2 v1 and log2 v2
+def log2_variance_mult(log_v1, log_v2, n, t):
+    log_message = np.log2(n * (t * t - 1) / 12.)
+    return np.logaddexp2(np.log2(n) + log_v1 + log_v2, np.logaddexp2(log_v1, log_v2) + log_message)
+
+# log2 of the variance after multiplication by a plaintext uniform mod t, v n (t^2 - 1)/12, given log2 v
+def log2_variance_plain_mult(log_variance, n, t):
+    return log_variance + np.log2(n * (t * t - 1) / 12.)
+
+# log2 of the variance after multiplication by an integer constant, constant^2 v, given log2 v
+def log2_variance_constant_mult(log_variance, constant):
+    return log_variance + 2 * np.log2(np.abs(constant))
+
+# log2 of the variance after switching from q to p, (secret_variance n + 1)(t^2 - 1)/12 + (p/q)^2 v, given log2 q,
+# log2 p and log2 v
+def log2_variance_mod_switch(n, t, log_q, log_p, log_variance, secret_variance=TERNARY_SECRET_VARIANCE):
+    log_rounding = np.log2((1.0/12) * (secret_variance * n + 1) * (t * t - 1))
+    return np.logaddexp2(log_rounding, 2 * (log_p - log_q) + log_variance)
+
+# log2 of erfinv((1 - alpha)^(1/n)) by mpmath, at enough precision to represent (1 - alpha)^(1/n) next to 1
+def log2_erfinv_factor_mpmath(n, alpha):
+    z_estimate = alpha / n
+    digits = 30 + (int(-np.log10(z_estimate)) if z_estimate > 0 else 400)
+    with mpmath.workdps(digits):
+        alpha = mpmath.mpf(alpha)
+        z = -mpmath.expm1(mpmath.log1p(-alpha) / n)
+        return float(mpmath.log(mpmath.erfinv(1 - z), 2))
+
+# log2 of erfinv((1 - alpha)^(1/n)), the factor in the alpha bound
+# erfinv(y) is computed as erfcinv(1 - y), with 1 - y formed without cancellation. Where 1 - y is too small for a
+# double (alpha/n below about 1e-300), or erfcinv fails, mpmath is used instead
+def log2_erfinv_factor(n, alpha):
+    n, alpha = np.broadcast_arrays(np.asarray(n, dtype=float), np.asarray(alpha, dtype=float))
+    z = -np.expm1(np.log1p(-alpha) / n)
+    with np.errstate(divide="ignore", invalid="ignore"):
+        factor = np.atleast_1d(np.log2(erfcinv(z)))
+    failed = np.flatnonzero(~np.isfinite(factor) | (np.atleast_1d(z) <= 1e-300))
+    if failed.size:
+        # mpmath is slow, so it runs once per distinct (n, alpha) pair, not once per grid point
+        factor = factor.copy()
+        flat_n, flat_alpha = np.atleast_1d(n).ravel(), np.atleast_1d(alpha).ravel()
+        pairs, inverse = np.unique(np.column_stack((flat_n[failed], flat_alpha[failed])), axis=0, return_inverse=True)
+        values = np.array([log2_erfinv_factor_mpmath(pair_n, pair_alpha) for pair_n, pair_alpha in pairs])
+        factor.flat[failed] = values[inverse.ravel()]
+    return factor.reshape(n.shape)
+
+# log2 of the alpha bound of [CCH+21]: sqrt(2 variance) * erfinv((1 - alpha)^(1/n)), given log2 variance
+def log2_alpha_bound(log_variance, n, alpha):
+    return 0.5 * (1 + log_variance) + log2_erfinv_factor(n, alpha)
+
+# Noise budget floor(log2 q - log2 bound) - 1, given log2 q and log2 bound
+def noise_budget(log_q, log_bound):
+    return np.floor(log_q - log_bound) - 1
+
+
+###################################
+# Budgets of circuits over a grid #
+###################################
+
+# Worst-case and average-case noise budgets after depth squarings of a fresh ciphertext (the "bgv deep" circuit
+# for depth 3), with a uniform ternary secret, or a sparse ternary one if hamming_weight > 0. All arguments are
+# broadcast against each other; depth may vary across the grid. The worst-case bound assumes any ternary secret
+def deep_circuit_grid(n, log_q, t, depth, alpha=0.001, hamming_weight=0):
+    n, log_q, t, depth, alpha = np.broadcast_arrays(*[np.asarray(a, dtype=float) for a in (n, log_q, t, depth, alpha)])
+    log_bound = log2_bound_fresh(n, t)
+    log_variance = log2_variance_fresh(n, t, secret_variance(n, hamming_weight))
+    for level in range(int(depth.max()) if depth.size else 0):
+        active = depth > level
+        log_bound = np.where(active, 2 * log_bound, log_bound)
+        log_variance = np.where(active, log2_variance_mult(log_variance, log_variance, n, t), log_variance)
+    worst_case = noise_budget(log_q, log_bound)
+    average_case = noise_budget(log_q, log2_alpha_bound(log_variance, n, alpha))
+    return worst_case, average_case
+
+# Worst-case and average-case noise budgets after each stage of the [CLP20] circuit (fresh, add, mult, mod switch
+# from log_q to log_p), as dictionaries of arrays keyed by stage. The secret is as in deep_circuit_grid
+def clp20_grid(n, log_q, log_p, t, alpha=0.001, hamming_weight=0):
+    n, log_q, log_p, t, alpha = np.broadcast_arrays(*[np.asarray(a, dtype=float) for a in (n, log_q, log_p, t, alpha)])
+    s_variance = secret_variance(n, hamming_weight)
+    fresh_bound = log2_bound_fresh(n, t)
+    add_bound = fresh_bound + 1
+    mult_bound = add_bound + fresh_bound
+    mod_switch_bound = log2_bound_mod_switch(n, t, log_q, log_p, mult_bound)
+
+    fresh_variance = log2_variance_fresh(n, t, s_variance)
+    add_variance = fresh_variance + 1
+    mult_variance = log2_variance_mult(add_variance, fresh_variance, n, t)
+    mod_switch_variance = log2_variance_mod_switch(n, t, log_q, log_p, mult_variance, s_variance)
+
+    worst_case = {"fresh": noise_budget(log_q, fresh_bound), "add": noise_budget(log_q, add_bound),
+                  "mult": noise_budget(log_q, mult_bound), "mod_switch": noise_budget(log_p, mod_switch_bound)}
+    average_case = {}
+    for stage, log_variance, log_modulus in (("fresh", fresh_variance, log_q), ("add", add_variance, log_q),
+                                             ("mult", mult_variance, log_q), ("mod_switch", mod_switch_variance, log_p)):
+        average_case[stage] = noise_budget(log_modulus, log2_alpha_bound(log_variance, n, alpha))
+    return worst_case, average_case
+
+
+#########################
+# Streaming grid output #
+#########################
+
+# Points of the cartesian product of the axes, chunk_size points at a time, as a tuple of flat arrays per axis
+def grid_chunks(axes, chunk_size):
+    shape = tuple(len(axis) for axis in axes)
+    total = int(np.prod(shape))
+    for start in range(0, total, chunk_size):
+        indices = np.unravel_index(np.arange(start, min(total, start + chunk_size)), shape)
+        yield tuple(np.asarray(axis)[index] for axis, index in zip(axes, indices))
+
+# Evaluate deep_circuit_grid over the cartesian product of the axes and stream the rows to a CSV file, or to a
+# Parquet file (one row group per chunk) if the path ends in .parquet, which needs pyarrow. Returns the row count
+def write_deep_circuit_grid(path, n, log_q, t, depth, alpha, hamming_weight=0, chunk_size=1 << 18):
+    axes = [np.atleast_1d(np.asarray(a, dtype=float)) for a in (n, log_q, t, depth, alpha)]
+    parquet = path.endswith(".parquet")
+    if parquet:
+        import pyarrow
+        import pyarrow.parquet
+        writer = None
+    else:
+        out = open(path, "w")
+        out.write(",".join(GRID_COLUMNS) + "\n")
+
+    rows = 0
+    try:
+        for chunk in grid_chunks(axes, chunk_size):
+            worst_case, average_case = deep_circuit_grid(*chunk, hamming_weight=hamming_weight)
+            columns = list(chunk) + [worst_case, average_case]
+            if parquet:
+                table = pyarrow.Table.from_arrays([pyarrow.array(c) for c in columns], names=GRID_COLUMNS)
+                if writer is None:
+                    writer = pyarrow.parquet.ParquetWriter(path, table.schema)
+                writer.write_table(table)
+            else:
+                np.savetxt(out, np.column_stack(columns), fmt=["%d", "%.6g", "%d", "%d", "%.6g", "%d", "%d"], delimiter=",")
+            rows += len(chunk[0])
+    finally:
+        if parquet:
+            if writer is not None:
+                writer.close()
+        else:
+            out.close()
+    return rows
+
+
+########################
+# Command-line driver #
+########################
+
+# An axis given as a list of values, where "start:stop:step" (stop inclusive) expands to a range
+def parse_axis(values):
+    points = []
+    for value in values:
+        if ":" in value:
+            parts = [float(part) for part in value.split(":")]
+            start, stop = parts[0], parts[1]
+            step = parts[2] if len(parts) > 2 else 1
+            points.extend(np.arange(start, stop + step / 2, step))
+        else:
+            points.append(float(value))
+    return np.array(points)
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Worst-case and average-case BGV noise budgets of the bgv deep circuit over a parameter grid")
+    parser.add_argument("--n", nargs="+", default=["4096", "8192", "16384", "32768"])
+    parser.add_argument("--log-q", nargs="+", default=["50:900:1"])
+    parser.add_argument("--t", nargs="+", default=["3"])
+    parser.add_argument("--depth", nargs="+", default=["0:4"])
+    parser.add_argument("--alpha", nargs="+", default=["0.001"])
+    parser.add_argument("--hamming-weight", type=int, default=0, help="Hamming weight of a sparse ternary secret, 0 for uniform ternary")
+    parser.add_argument("--out", default="bgv_heuristics_grid.csv", help="output file, .csv or .parquet")
+    args = parser.parse_args()
+
+    start = time.time()
+    rows = write_deep_circuit_grid(args.out, parse_axis(args.n), parse_axis(args.log_q), parse_axis(args.t),
+                                   parse_axis(args.depth), parse_axis(args.alpha), args.hamming_weight)
+    print(str(rows) + " grid points written to " + args.out + " in " + ("%.2f" % (time.time() - start)) + " s")
@@ -0,0 +1,197 @@
+/*
+    Micro-benchmark measurement and reporting for the BGV primitives.
+
+    run_benchmark() times an operation over a number of iterations (after one untimed warm-up), with an
+    untimed set-up step before each iteration, and records the latency of every iteration and the bytes
+    allocated per iteration. Allocations are counted in bench_allocated_bytes, which only moves if the
+    executable replaces the global operator new to add to it (the bench executables do).
+    run_pooled_benchmark() is for operations drawing their temporaries from a memory pool that keeps them
+    for reuse: it counts the bytes in an untimed pass on a new pool and times the iterations on a warm one.
+
+    write_bench_json() writes the results in a layout close to Google Benchmark's JSON output: a
+    "context" object describing the run and a "benchmarks" array with one entry per (operation, n).
+    Times are in nanoseconds. compare_bench.py compares two such files, e.g. before and after a
+    library upgrade.
+*/
+
+#ifndef BENCH_REPORT_H
+#define BENCH_REPORT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+/* Bytes requested from the global operator new since start-up, if the executable counts them */
+inline std::atomic<uint64_t> bench_allocated_bytes{ 0 };
+
+/* Latency statistics, in seconds */
+struct BenchStatistics
+{
+    double mean;
+    double min;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+};
+
+struct BenchResult
+{
+    std::string name;
+    long n;
+    long iterations;
+    BenchStatistics seconds;
+    double bytes_per_iteration;
+};
+
+/* Nearest-rank percentile of sorted values, 0 < percent <= 100 */
+inline double bench_percentile(const std::vector<double>& sorted, double percent)
+{
+    size_t rank = size_t(std::ceil(percent / 100 * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+inline BenchStatistics summarize_latencies(std::vector<double> seconds)
+{
+    if (seconds.empty())
+    {
+        throw std::invalid_argument("summarize_latencies: no measurements");
+    }
+    std::sort(seconds.begin(), seconds.end());
+    double total = 0;
+    for (double s : seconds)
+    {
+        total += s;
+    }
+    return { total / seconds.size(), seconds.front(), bench_percentile(seconds, 50), bench_percentile(seconds, 90),
+             bench_percentile(seconds, 99), seconds.back() };
+}
+
+/* Time op() over iterations runs, calling setup() (untimed) before each one */
+template <class Setup, class Op>
+BenchResult run_benchmark(const std::string& name, long n, long iterations, Setup setup, Op op)
+{
+    setup();
+    op();
+
+    std::vector<double> seconds;
+    seconds.reserve(iterations);
+    uint64_t bytes = 0;
+    for (long i = 0; i < iterations; i++)
+    {
+        setup();
+        uint64_t bytes_before = bench_allocated_bytes.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        op();
+        auto end = std::chrono::steady_clock::now();
+        bytes += bench_allocated_bytes.load(std::memory_order_relaxed) - bytes_before;
+        seconds.push_back(std::chrono::duration<double>(end - start).count());
+    }
+    return { name, n, iterations, summarize_latencies(seconds), double(bytes) / iterations };
+}
+
+/*
+Time op() as run_benchmark does, for an operation whose temporaries come from a memory pool: cold_setup() gives
+it a new pool, on which one untimed pass counts the bytes the operation allocates. The timed iterations then
+run on that pool once warm, so that their latencies do not include the pool's first allocations and page faults.
+*/
+template <class ColdSetup, class Setup, class Op>
+BenchResult run_pooled_benchmark(const std::string& name, long n, long iterations, ColdSetup cold_setup, Setup setup,
+    Op op)
+{
+    cold_setup();
+    setup();
+    uint64_t bytes_before = bench_allocated_bytes.load(std::memory_order_relaxed);
+    op();
+    uint64_t bytes = bench_allocated_bytes.load(std::memory_order_relaxed) - bytes_before;
+
+    BenchResult result = run_benchmark(name, n, iterations, setup, op);
+    result.bytes_per_iteration = double(bytes);
+    return result;
+}
+
+inline void print_bench_result(const BenchResult& result)
+{
+    std::cout << std::left << std::setw(14) << result.name << std::right << std::setw(7) << result.n
+              << std::setw(8) << result.iterations << std::scientific << std::setprecision(3)
+              << std::setw(12) << result.seconds.mean << std::setw(12) << result.seconds.p50
+              << std::setw(12) << result.seconds.p90 << std::setw(12) << result.seconds.p99
+              << std::setw(12) << 1 / result.seconds.mean << std::setw(12) << result.bytes_per_iteration
+              << std::defaultfloat << std::endl;
+}
+
+inline void print_bench_header()
+{
+    std::cout << std::left << std::setw(14) << "operation" << std::right << std::setw(7) << "n" << std::setw(8) << "iters"
+              << std::setw(12) << "mean (s)" << std::setw(12) << "p50 (s)" << std::setw(12) << "p90 (s)"
+              << std::setw(12) << "p99 (s)" << std::setw(12) << "ops/s" << std::setw(12) << "bytes/op" << std::endl;
+}
+
+inline std::string bench_json_string(const std::string& value)
+{
+    std::string out = "\"";
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+inline void write_bench_json(const std::string& path, const std::string& backend, const std::string& library_version,
+    const std::vector<BenchResult>& results)
+{
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (!file)
+    {
+        throw std::runtime_error("write_bench_json: cannot open " + path);
+    }
+
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    char date[32] = "";
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    std::fprintf(file, "{\n  \"context\": {\n");
+    std::fprintf(file, "    \"date\": %s,\n", bench_json_string(date).c_str());
+    std::fprintf(file, "    \"host_name\": %s,\n", bench_json_string(host).c_str());
+    std::fprintf(file, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+    std::fprintf(file, "    \"backend\": %s,\n", bench_json_string(backend).c_str());
+    std::fprintf(file, "    \"library_version\": %s\n  },\n", bench_json_string(library_version).c_str());
+    std::fprintf(file, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        std::string name = backend + "/" + r.name + "/n:" + std::to_string(r.n);
+        std::fprintf(file,
+            "    {\"name\": %s, \"operation\": %s, \"n\": %ld, \"iterations\": %ld, \"time_unit\": \"ns\", "
+            "\"real_time\": %.1f, \"min_time\": %.1f, \"p50_time\": %.1f, \"p90_time\": %.1f, \"p99_time\": %.1f, "
+            "\"max_time\": %.1f, \"items_per_second\": %.6g, \"bytes_per_iteration\": %.1f}%s\n",
+            bench_json_string(name).c_str(), bench_json_string(r.name).c_str(), r.n, r.iterations,
+            r.seconds.mean * 1e9, r.seconds.min * 1e9, r.seconds.p50 * 1e9, r.seconds.p90 * 1e9, r.seconds.p99 * 1e9,
+            r.seconds.max * 1e9, 1 / r.seconds.mean, r.bytes_per_iteration, i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    if (std::fclose(file) != 0)
+    {
+        throw std::runtime_error("write_bench_json: error writing " + path);
+    }
+}
+
+#endif
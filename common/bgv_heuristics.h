@@ -0,0 +1,111 @@
+/*
+    Average-case BGV noise heuristics, for use inside the C++ harnesses.
+
+    These are the variance formulas of Figure 5 of [MP24], as stated by the
+    variance_* and alpha_bound_from_variance functions of
+    generate_bgv_heuristics_tables.py, and should be kept in step with that script.
+    Variances are long double: the variance after a few levels of multiplication is
+    far outside the range of a double. Moduli are passed as log2 q.
+*/
+
+#ifndef BGV_HEURISTICS_H
+#define BGV_HEURISTICS_H
+
+#include <cmath>
+
+const double BGV_SIGMA = 3.19;
+const double BGV_DEFAULT_ALPHA = 0.001;
+
+/* Variance of a coefficient of a uniform ternary secret key; a sparse ternary secret of Hamming weight h has h/n */
+const double BGV_TERNARY_SECRET_VARIANCE = 2.0 / 3;
+
+inline long double variance_fresh(double n, double t, double secret_variance = BGV_TERNARY_SECRET_VARIANCE)
+{
+    long double sigma = BGV_SIGMA;
+    return (n * (2.0L / 3 + secret_variance) + 1) * t * t * sigma * sigma;
+}
+
+inline long double variance_add(long double input_variance_1, long double input_variance_2)
+{
+    return input_variance_1 + input_variance_2;
+}
+
+inline long double variance_mult(long double input_variance_1, long double input_variance_2, double n, double t)
+{
+    long double term1 = n * input_variance_1 * input_variance_2;
+    long double term2 = input_variance_1 * n * (1.0L / 12) * ((long double)t * t - 1);
+    long double term3 = input_variance_2 * n * (1.0L / 12) * ((long double)t * t - 1);
+    return term1 + term2 + term3;
+}
+
+/* Multiplication by a plaintext whose coefficients are uniform mod t (centered) */
+inline long double variance_plain_mult(long double input_variance, double n, double t)
+{
+    return input_variance * n * (1.0L / 12) * ((long double)t * t - 1);
+}
+
+/* Multiplication by a scalar constant, taken centered mod t */
+inline long double variance_constant_mult(long double input_variance, double constant)
+{
+    return (long double)constant * constant * input_variance;
+}
+
+/* Switching from modulus q to modulus p, given as log2 q and log2 p */
+inline long double variance_mod_switch(double n, double t, double log_q, double log_p, long double input_variance,
+    double secret_variance = BGV_TERNARY_SECRET_VARIANCE)
+{
+    long double gamma_squared_input_variance = std::exp2((long double)(2 * (log_p - log_q))) * input_variance;
+    long double output_variance = (1.0L / 12) * (secret_variance * n + 1) * ((long double)t * t - 1);
+    return output_variance + gamma_squared_input_variance;
+}
+
+/*
+Inverse of the complementary error function, for 0 < z < 1, by Newton's method on erfc.
+Working with z = 1 - y rather than y keeps full precision for y close to 1, which is the
+regime of the alpha bound below.
+*/
+inline double inverse_erfc(double z)
+{
+    double x = std::sqrt(-std::log(z));
+    if (z > 0.5)
+    {
+        x = 0;
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        double step = (std::erfc(x) - z) / (2 / std::sqrt(M_PI) * std::exp(-x * x));
+        x += step;
+        if (std::fabs(step) <= 1e-15 * std::fabs(x))
+        {
+            break;
+        }
+    }
+    return x;
+}
+
+/*
+log2 of the bound on the noise given its variance, in the manner of [CCH+21]:
+sqrt(2 variance) * erfinv((1 - alpha)^(1/n)).
+*/
+inline double log2_alpha_bound_from_variance(long double variance, double n, double alpha = BGV_DEFAULT_ALPHA)
+{
+    double z = -std::expm1(std::log1p(-alpha) / n);
+    return double(0.5L * std::log2(2 * variance)) + std::log2(inverse_erfc(z));
+}
+
+/*
+Noise budget remaining given log2 of the noise bound, as get_noise_budget_from_log2 in the python script. Not to be
+confused with the get_noise_budget of the harnesses, which probes the noise of a ciphertext with the secret key.
+*/
+inline double noise_budget_from_log2_bound(double log2_bound, double log_q)
+{
+    return std::floor(log_q - log2_bound) - 1;
+}
+
+/* The same budget without rounding down, which is the quantity the harnesses observe */
+inline double noise_budget_from_log2_bound_unrounded(double log2_bound, double log_q)
+{
+    return log_q - log2_bound - 1;
+}
+
+#endif
@@ -0,0 +1,136 @@
+/*
+    Circuits whose shape is fixed at compile time, expanded into straight-line evaluation.
+
+    MulTree<Depth, Arity> is the complete product tree of Arity^Depth fresh ciphertexts: level 0
+    encrypts the leaves, and every node of level l multiplies Arity consecutive nodes of level l - 1
+    (the bgv deep circuit is MulTree<3, 2>). Every node has its own buffer slot, numbered level by
+    level, so the slots, the operands of every multiplication and the probe points are all constant
+    expressions: run() expands into the same sequence of library calls as the hand-written circuit,
+    with no loop, switch or indirection left in the trial loop.
+
+    The library is a plug-in, a Backend class providing
+        typedef ... Ciphertext;
+        void encrypt(Ciphertext& out, int leaf);
+        void multiply(const Ciphertext& a, const Ciphertext& b, Ciphertext& out);
+        void multiply_inplace(Ciphertext& out, const Ciphertext& b);    // only used if Arity > 2
+        template <int Level> void probe(const Ciphertext& node0, double seconds);
+        template <int Level> void prepare_operand(Ciphertext& node);
+    probe<Level> is called once level Level is complete, on its first node, with the time taken by the
+    operation that produced that node. prepare_operand<Level> is then called on every node of the
+    level before it is used by the next one (e.g. to relinearize); it is not called on the root.
+*/
+
+#ifndef CIRCUIT_KERNEL_H
+#define CIRCUIT_KERNEL_H
+
+#include <array>
+#include <chrono>
+#include <utility>
+
+template <int Depth, int Arity = 2>
+struct MulTree
+{
+    static_assert(Depth >= 0 && Arity >= 2, "MulTree: Depth >= 0 and Arity >= 2");
+
+    static constexpr int power(int base, int exponent)
+    {
+        return exponent == 0 ? 1 : base * power(base, exponent - 1);
+    }
+
+    /* Number of nodes of a level, and slot of its first node */
+    static constexpr int width(int level)
+    {
+        return power(Arity, Depth - level);
+    }
+
+    static constexpr int offset(int level)
+    {
+        return level == 0 ? 0 : offset(level - 1) + width(level - 1);
+    }
+
+    static constexpr int stages = Depth + 1;
+    static constexpr int leaves = width(0);
+    static constexpr int slots = offset(Depth + 1);
+    static constexpr int root = slots - 1;
+
+    template <class Backend>
+    using Buffers = std::array<typename Backend::Ciphertext, slots>;
+
+    /* Buffers initialised from a prototype, for ciphertext types without a default constructor (helib::Ctxt) */
+    template <class Backend>
+    static Buffers<Backend> make_buffers(const typename Backend::Ciphertext& prototype)
+    {
+        return make_buffers<Backend>(prototype, std::make_integer_sequence<int, slots>());
+    }
+
+    /* One evaluation of the circuit */
+    template <class Backend>
+    static void run(Backend& backend, Buffers<Backend>& buffers)
+    {
+        run_level<0>(backend, buffers);
+    }
+
+private:
+    template <class Backend, int... Slot>
+    static Buffers<Backend> make_buffers(const typename Backend::Ciphertext& prototype,
+        std::integer_sequence<int, Slot...>)
+    {
+        return {{((void)Slot, prototype)...}};
+    }
+
+    template <int Level, int Node, class Backend>
+    static void evaluate(Backend& backend, Buffers<Backend>& buffers)
+    {
+        auto& out = std::get<offset(Level) + Node>(buffers);
+        if constexpr (Level == 0)
+        {
+            backend.encrypt(out, Node);
+        }
+        else
+        {
+            constexpr int first_child = offset(Level - 1) + Node * Arity;
+            backend.multiply(std::get<first_child>(buffers), std::get<first_child + 1>(buffers), out);
+            multiply_remaining<first_child>(backend, buffers, out, std::make_integer_sequence<int, Arity - 2>());
+        }
+    }
+
+    /* Children 2, ..., Arity - 1 of a node */
+    template <int FirstChild, class Backend, int... Child>
+    static void multiply_remaining(Backend& backend, Buffers<Backend>& buffers, typename Backend::Ciphertext& out,
+        std::integer_sequence<int, Child...>)
+    {
+        (backend.multiply_inplace(out, std::get<FirstChild + 2 + Child>(buffers)), ...);
+    }
+
+    /* Nodes 1, ..., width - 1 of a level, in order */
+    template <int Level, class Backend, int... Node>
+    static void evaluate_remaining(Backend& backend, Buffers<Backend>& buffers, std::integer_sequence<int, Node...>)
+    {
+        (evaluate<Level, Node + 1>(backend, buffers), ...);
+    }
+
+    template <int Level, class Backend, int... Node>
+    static void prepare_level(Backend& backend, Buffers<Backend>& buffers, std::integer_sequence<int, Node...>)
+    {
+        (backend.template prepare_operand<Level>(std::get<offset(Level) + Node>(buffers)), ...);
+    }
+
+    template <int Level, class Backend>
+    static void run_level(Backend& backend, Buffers<Backend>& buffers)
+    {
+        /* Only the first node of a level is timed, as in the hand-written harnesses */
+        auto start = std::chrono::steady_clock::now();
+        evaluate<Level, 0>(backend, buffers);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        evaluate_remaining<Level>(backend, buffers, std::make_integer_sequence<int, width(Level) - 1>());
+
+        backend.template probe<Level>(std::get<offset(Level)>(buffers), seconds);
+        if constexpr (Level < Depth)
+        {
+            prepare_level<Level>(backend, buffers, std::make_integer_sequence<int, width(Level)>());
+            run_level<Level + 1>(backend, buffers);
+        }
+    }
+};
+
+#endif
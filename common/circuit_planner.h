@@ -0,0 +1,243 @@
+/*
+    Relinearization and modulus-switching plans for product trees (common/circuit_kernel.h).
+
+    After each level of the tree, every node can be switched down by some number of primes and/or
+    relinearized before the next level multiplies it. Switching early makes every later operation
+    cheaper and brings the noise back to the rounding floor, at the price of modulus; skipping
+    relinearization saves a key switch, at the price of larger products (the relinearization keys
+    only cover s^2, so only size-3 ciphertexts can be relinearized). plan_circuit() searches all
+    plans for the cheapest one whose predicted failure probability stays below the target at every
+    node, with
+        - the average-case variances of bgv_heuristics.h (variance_mult, variance_mod_switch), plus
+          the noise added by a key switch with a special modulus (not in [MP24]),
+        - the failure probability of a node: n times the Gaussian tail P(|noise coefficient| >= q/2),
+        - a cost model counting one pointwise product of one prime (n coefficients) as 1 and one
+          NTT of one prime as log2 n: ciphertexts stay in evaluation form, products are pointwise,
+          and a modulus switch or key switch is dominated by its NTTs.
+    The nodes of a level all have the same shape, so a plan is one decision per level.
+*/
+
+#ifndef CIRCUIT_PLANNER_H
+#define CIRCUIT_PLANNER_H
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "bgv_heuristics.h"
+
+struct PlannerModel
+{
+    double n = 0;
+    double t = 0;
+    double secret_variance = BGV_TERNARY_SECRET_VARIANCE;
+    int depth = 0;
+    int arity = 2;
+    std::vector<double> chain_log_q;    // log2 q with 1, 2, ... primes; fresh ciphertexts have all of them
+    int digits = 0;                     // key-switching digits, 0 for one per prime
+    double log_digit = 0;               // log2 of the largest digit
+    int special_primes = 1;
+    double log_special = 0;             // log2 of the special modulus
+    int max_relinearizable_size = 3;
+    double log2_target_failure = -40;
+};
+
+struct LevelPlan
+{
+    int drop_primes = 0;
+    bool relinearize = false;
+};
+
+struct CircuitPlan
+{
+    std::vector<LevelPlan> levels;          // decisions after levels 0, ..., depth - 1
+    bool feasible = false;
+    double cost = 0;                        // in pointwise products of one prime
+    double log2_failure = -std::numeric_limits<double>::infinity();   // worst node
+    std::vector<int> primes;                // at the probe of every level
+    std::vector<int> sizes;                 // ciphertext size at the probe of every level
+    std::vector<double> predicted_budget;   // at the probe of every level
+};
+
+/* log2 of n P(|N(0, variance)| >= q/2), with the asymptotic expansion of erfc where it underflows */
+inline double log2_failure_probability(long double variance, double n, double log_q)
+{
+    double x = double(std::exp2((long double)(log_q - 1)) / std::sqrt(2 * variance));
+    double log2_tail = x < 20 ? std::log2(std::erfc(x)) : -x * x / std::log(2.0) - std::log2(x * std::sqrt(M_PI));
+    return std::log2(n) + log2_tail;
+}
+
+/*
+Noise added by key switching with special modulus P: t (sum of digits d_i times key errors e_i) / P, with d_i
+uniform mod a digit of up to log_digit bits, and the rounding of the division by P, as in variance_mod_switch.
+*/
+inline long double variance_key_switch(double n, double t, int digits, double log_digit, double log_special,
+    double secret_variance = BGV_TERNARY_SECRET_VARIANCE)
+{
+    long double sigma = BGV_SIGMA;
+    long double digit_term = digits * n * sigma * sigma * std::exp2((long double)(2 * (log_digit - log_special))) / 12;
+    long double rounding = (1.0L / 12) * (secret_variance * n + 1);
+    return ((long double)t * t) * (digit_term + rounding);
+}
+
+inline double cost_multiply(int size1, int size2, int primes)
+{
+    return double(size1) * size2 * primes;
+}
+
+/* Dropping one prime: the dropped residue back to coefficients, and into each remaining prime */
+inline double cost_mod_switch(int size, int primes, double log_n)
+{
+    return size * (primes * log_n + 2.0 * primes);
+}
+
+/* The third part to coefficients, each digit into primes + special, two key products, and back down by P */
+inline double cost_relinearize(int primes, int digits, int special, double log_n)
+{
+    return log_n * (primes + double(digits) * (primes + special) + 2.0 * (primes + special)) +
+        2.0 * digits * (primes + special);
+}
+
+/* Predicted cost, failure probability and budgets of a given plan */
+inline CircuitPlan evaluate_plan(const PlannerModel& model, const std::vector<LevelPlan>& levels)
+{
+    CircuitPlan plan;
+    plan.levels = levels;
+    plan.levels.resize(model.depth);
+    double log_n = std::log2(model.n);
+    int primes = int(model.chain_log_q.size());
+    int size = 2;
+    long double variance = variance_fresh(model.n, model.t, model.secret_variance);
+    bool valid = primes > 0;
+    auto log_q = [&]() { return model.chain_log_q[primes - 1]; };
+    auto check = [&]() {
+        plan.log2_failure = std::max(plan.log2_failure, log2_failure_probability(variance, model.n, log_q()));
+    };
+
+    for (int level = 0; valid && level <= model.depth; level++)
+    {
+        double width = std::pow(double(model.arity), model.depth - level);
+        if (level > 0)
+        {
+            /* A node multiplies arity operands of the previous level, one after the other */
+            long double product = variance;
+            int product_size = size;
+            double node_cost = 0;
+            for (int j = 1; j < model.arity; j++)
+            {
+                node_cost += cost_multiply(product_size, size, primes);
+                product = variance_mult(product, variance, model.n, model.t);
+                product_size += size - 1;
+            }
+            plan.cost += width * node_cost;
+            variance = product;
+            size = product_size;
+        }
+        check();
+        plan.primes.push_back(primes);
+        plan.sizes.push_back(size);
+        plan.predicted_budget.push_back(
+            noise_budget_from_log2_bound_unrounded(log2_alpha_bound_from_variance(variance, model.n), log_q()));
+        if (level == model.depth)
+        {
+            break;
+        }
+
+        const LevelPlan& decision = plan.levels[level];
+        if (decision.drop_primes < 0 || decision.drop_primes >= primes)
+        {
+            valid = false;
+            break;
+        }
+        for (int k = 0; k < decision.drop_primes; k++)
+        {
+            plan.cost += width * cost_mod_switch(size, primes, log_n);
+            variance = variance_mod_switch(model.n, model.t, model.chain_log_q[primes - 1],
+                model.chain_log_q[primes - 2], variance, model.secret_variance);
+            primes--;
+            check();
+        }
+        if (decision.relinearize)
+        {
+            if (size != 3 || size > model.max_relinearizable_size)
+            {
+                valid = false;
+                break;
+            }
+            int digits = model.digits > 0 ? std::min(model.digits, primes) : primes;
+            plan.cost += width * cost_relinearize(primes, digits, model.special_primes, log_n);
+            variance += variance_key_switch(model.n, model.t, digits, model.log_digit, model.log_special,
+                model.secret_variance);
+            size = 2;
+            check();
+        }
+    }
+    plan.feasible = valid && plan.log2_failure <= model.log2_target_failure;
+    return plan;
+}
+
+/* Exhaustive search over the decisions of every level; the trees of the harnesses are shallow */
+inline void search_plans(const PlannerModel& model, std::vector<LevelPlan>& levels, int level, CircuitPlan& best)
+{
+    if (level == model.depth)
+    {
+        CircuitPlan plan = evaluate_plan(model, levels);
+        if (plan.feasible && (!best.feasible || plan.cost < best.cost))
+        {
+            best = plan;
+        }
+        return;
+    }
+    for (int drop = 0; drop < int(model.chain_log_q.size()); drop++)
+    {
+        for (int relinearize = 0; relinearize < 2; relinearize++)
+        {
+            levels[level] = {drop, relinearize == 1};
+            search_plans(model, levels, level + 1, best);
+        }
+    }
+}
+
+/* The cheapest feasible plan; if none is feasible, the returned plan has feasible = false */
+inline CircuitPlan plan_circuit(const PlannerModel& model)
+{
+    if (model.depth < 0 || model.arity < 2 || model.chain_log_q.empty())
+    {
+        throw std::invalid_argument("plan_circuit: invalid model");
+    }
+    std::vector<LevelPlan> levels(model.depth);
+    CircuitPlan best;
+    search_plans(model, levels, 0, best);
+    return best;
+}
+
+inline void print_plan(const CircuitPlan& plan, std::ostream& out = std::cout)
+{
+    for (size_t level = 0; level < plan.predicted_budget.size(); level++)
+    {
+        out << "    level " << level << ": " << plan.primes[level] << " primes, size " << plan.sizes[level]
+            << ", predicted budget " << std::fixed << std::setprecision(1) << plan.predicted_budget[level];
+        if (level < plan.levels.size())
+        {
+            out << "; then drop " << plan.levels[level].drop_primes << " primes"
+                << (plan.levels[level].relinearize ? ", relinearize" : "");
+        }
+        out << std::endl;
+    }
+    out << "    predicted cost " << std::setprecision(0) << plan.cost << ", worst log2 failure probability ";
+    if (plan.log2_failure < -10000)
+    {
+        out << "below -10000";
+    }
+    else
+    {
+        out << std::setprecision(1) << plan.log2_failure;
+    }
+    out << std::defaultfloat << std::setprecision(6) << std::endl;
+}
+
+#endif
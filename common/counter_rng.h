@@ -0,0 +1,124 @@
+/*
+    Counter-based random streams for reproducible trials.
+
+    Every random value used by a trial is derived from (run seed, trial index, stream), using the
+    Philox4x32-10 block function of Salmon, Moraes, Dror and Shaw ("Parallel random numbers: as easy
+    as 1, 2, 3", SC 2011). A trial's randomness therefore does not depend on the trials before it or
+    on which thread runs it, so any trial of a large or sharded run can be replayed on its own.
+
+    The run seed is the Philox key. The 128-bit counter holds the trial index (64 bits), the stream
+    identifier (32 bits) and the block index within the stream (32 bits).
+*/
+
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+/* Trial index reserved for key generation, which happens once per run */
+const uint64_t KEYGEN_TRIAL = std::numeric_limits<uint64_t>::max();
+
+/* What a stream is used for; combined with a sub-stream index by trial_stream_id() */
+enum TrialStreamDomain : uint32_t
+{
+    stream_encryption = 1,
+    stream_messages = 2,
+    stream_keys = 3,
+    stream_circuits = 4
+};
+
+inline uint32_t trial_stream_id(TrialStreamDomain domain, uint32_t index = 0)
+{
+    return (uint32_t(domain) << 24) | (index & 0xffffff);
+}
+
+/* The Philox4x32-10 block function */
+inline std::array<uint32_t, 4> philox4x32_10(std::array<uint32_t, 4> counter, std::array<uint32_t, 2> key)
+{
+    const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+    const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+    for (int round = 0; round < 10; round++)
+    {
+        uint64_t p0 = uint64_t(M0) * counter[0];
+        uint64_t p1 = uint64_t(M1) * counter[2];
+        counter = { uint32_t(p1 >> 32) ^ counter[1] ^ key[0], uint32_t(p1),
+                    uint32_t(p0 >> 32) ^ counter[3] ^ key[1], uint32_t(p0) };
+        key[0] += W0;
+        key[1] += W1;
+    }
+    return counter;
+}
+
+/* A stream of random words for one (run seed, trial, stream) triple */
+class TrialRandomStream
+{
+public:
+    TrialRandomStream(uint64_t run_seed, uint64_t trial, uint32_t stream)
+        : key_{ uint32_t(run_seed), uint32_t(run_seed >> 32) }, trial_(trial), stream_(stream)
+    {
+    }
+
+    uint32_t next32()
+    {
+        if (used_ == 4)
+        {
+            buffer_ = philox4x32_10({ uint32_t(trial_), uint32_t(trial_ >> 32), stream_, block_++ }, key_);
+            used_ = 0;
+        }
+        return buffer_[used_++];
+    }
+
+    uint64_t next64()
+    {
+        uint64_t low = next32();
+        return (uint64_t(next32()) << 32) | low;
+    }
+
+    /* Uniform in [0, bound), without modulo bias */
+    uint64_t uniform(uint64_t bound)
+    {
+        if (bound == 0)
+        {
+            return 0;
+        }
+        uint64_t limit = std::numeric_limits<uint64_t>::max() - std::numeric_limits<uint64_t>::max() % bound;
+        uint64_t value;
+        do
+        {
+            value = next64();
+        } while (value >= limit);
+        return value % bound;
+    }
+
+    /* Uniform in [0, 1) with 53 bits of precision */
+    double uniform_real()
+    {
+        return double(next64() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    void fill_bytes(unsigned char* out, size_t count)
+    {
+        while (count > 0)
+        {
+            uint32_t word = next32();
+            size_t take = count < sizeof(word) ? count : sizeof(word);
+            std::memcpy(out, &word, take);
+            out += take;
+            count -= take;
+        }
+    }
+
+private:
+    std::array<uint32_t, 2> key_;
+    uint64_t trial_;
+    uint32_t stream_;
+    uint32_t block_ = 0;
+    std::array<uint32_t, 4> buffer_{};
+    int used_ = 4;
+};
+
+#endif
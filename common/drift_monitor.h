@@ -0,0 +1,158 @@
+/*
+    Online comparison of observed noise budgets with the average-case prediction during a run.
+
+    The harness gives the monitor, for each stage, log2 of the predicted noise bound (e.g. from
+    log2_alpha_bound_from_variance in bgv_heuristics.h), then records the observed noise budget and
+    log2 q of every probe. The drift of a probe is the observed budget minus the predicted budget
+    log2 q - predicted bound - 1, so a positive drift means less noise than predicted. Running means
+    and variances are kept with Welford's method.
+
+    Every report_every trials, end_trial() prints one progress line with the throughput, the
+    estimated time remaining and, per monitored stage, the mean drift with a 95% confidence
+    interval. If an abort threshold is set, end_trial() returns false once the confidence interval
+    of some stage lies entirely beyond the threshold, so that a run with a parameter mistake can be
+    stopped early instead of running to completion.
+*/
+
+#ifndef DRIFT_MONITOR_H
+#define DRIFT_MONITOR_H
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class DriftMonitor
+{
+public:
+    /* abort_threshold_bits <= 0 never aborts */
+    DriftMonitor(const std::vector<std::string>& stage_names, long total_trials, long report_every,
+        double abort_threshold_bits = 0)
+        : stages_(stage_names.size()), total_trials_(total_trials), report_every_(report_every),
+          abort_threshold_(abort_threshold_bits), start_(std::chrono::steady_clock::now())
+    {
+        if (report_every < 1)
+        {
+            throw std::invalid_argument("DriftMonitor: report_every must be positive");
+        }
+        for (size_t s = 0; s < stage_names.size(); s++)
+        {
+            stages_[s].name = stage_names[s];
+        }
+    }
+
+    /* Stages without a prediction are not monitored */
+    void set_prediction(int stage, double predicted_log2_bound)
+    {
+        stages_.at(stage).predicted_log2_bound = predicted_log2_bound;
+    }
+
+    bool has_prediction(int stage) const
+    {
+        return !std::isnan(stages_.at(stage).predicted_log2_bound);
+    }
+
+    void record(int stage, double observed_budget, double log_q)
+    {
+        Stage& s = stages_.at(stage);
+        if (std::isnan(s.predicted_log2_bound) || std::isnan(observed_budget))
+        {
+            return;
+        }
+        double drift = observed_budget - (log_q - s.predicted_log2_bound - 1);
+        s.count++;
+        double delta = drift - s.mean;
+        s.mean += delta / s.count;
+        s.m2 += delta * (drift - s.mean);
+    }
+
+    /* Call once per trial; returns false if the run should be aborted */
+    bool end_trial(std::ostream& out = std::cout)
+    {
+        trials_++;
+        if (trials_ % report_every_ != 0 && trials_ != total_trials_)
+        {
+            return true;
+        }
+        print_progress(out);
+        if (abort_threshold_ <= 0)
+        {
+            return true;
+        }
+        for (const Stage& s : stages_)
+        {
+            if (s.count > 1 && std::fabs(s.mean) - half_width(s) > abort_threshold_)
+            {
+                out << "Drift of stage " << s.name << " is beyond " << abort_threshold_ << " bits" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    long trials() const
+    {
+        return trials_;
+    }
+
+    double mean_drift(int stage) const
+    {
+        const Stage& s = stages_.at(stage);
+        return s.count ? s.mean : std::numeric_limits<double>::quiet_NaN();
+    }
+
+private:
+    struct Stage
+    {
+        std::string name;
+        double predicted_log2_bound = std::numeric_limits<double>::quiet_NaN();
+        long count = 0;
+        double mean = 0;
+        double m2 = 0;
+    };
+
+    /* Half-width of the 95% confidence interval of the mean drift */
+    static double half_width(const Stage& s)
+    {
+        return s.count > 1 ? 1.96 * std::sqrt(s.m2 / (s.count - 1) / s.count) : std::numeric_limits<double>::infinity();
+    }
+
+    void print_progress(std::ostream& out) const
+    {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        double rate = seconds > 0 ? trials_ / seconds : 0;
+        long eta = rate > 0 ? long((total_trials_ - trials_) / rate) : 0;
+        char line[128];
+        std::snprintf(line, sizeof(line), "[%ld/%ld] %.2f trials/s, ETA %ldh%02ldm%02lds | drift (bits):", trials_,
+            total_trials_, rate, eta / 3600, (eta / 60) % 60, eta % 60);
+        out << line;
+        for (const Stage& s : stages_)
+        {
+            if (s.count == 0)
+            {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), " %s %+.2f", s.name.c_str(), s.mean);
+            out << line;
+            if (s.count > 1)
+            {
+                std::snprintf(line, sizeof(line), "+-%.2f", half_width(s));
+                out << line;
+            }
+        }
+        out << std::endl;
+    }
+
+    std::vector<Stage> stages_;
+    long total_trials_;
+    long report_every_;
+    double abort_threshold_;
+    long trials_ = 0;
+    std::chrono::steady_clock::time_point start_;
+};
+
+#endif
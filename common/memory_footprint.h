@@ -0,0 +1,153 @@
+/*
+    Memory footprint of a harness: the shape and size of the ciphertext at every probe point, and the
+    peak resident set of the process.
+
+    Without relinearization the parts of a product tree grow from 2 to 3, 5 and 9 through the levels,
+    and every part holds one 64-bit word per coefficient and prime in both HElib (DoubleCRT) and
+    SEAL, so a ciphertext takes parts * primes * n * 8 bytes in memory. FootprintTable keeps the
+    largest shape seen at every stage, and prints it with
+        - the peak resident set (VmHWM from /proc/self/status, else getrusage),
+        - the bytes held by the library's memory pool, if the harness passes it (SEAL MemoryManager),
+        - the memory available on the machine (MemAvailable from /proc/meminfo), and the number of
+          processes of this peak size that fit in it, the upper bound on workers per node.
+    Outside Linux the /proc values are unknown and printed as such.
+*/
+
+#ifndef MEMORY_FOOTPRINT_H
+#define MEMORY_FOOTPRINT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+/* Bytes of a ciphertext in memory: one 64-bit word per part, prime and coefficient */
+inline size_t ciphertext_bytes(long parts, long primes, long n)
+{
+    return size_t(parts) * size_t(primes) * size_t(n) * sizeof(uint64_t);
+}
+
+/* A "<field>: <value> kB" line of a /proc file, in bytes; 0 if the file or the field is missing */
+inline size_t read_proc_kb(const std::string& path, const std::string& field)
+{
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.compare(0, field.size() + 1, field + ":") == 0)
+        {
+            std::istringstream value(line.substr(field.size() + 1));
+            size_t kb = 0;
+            value >> kb;
+            return kb * 1024;
+        }
+    }
+    return 0;
+}
+
+/* Peak resident set of this process */
+inline size_t peak_rss_bytes()
+{
+    size_t bytes = read_proc_kb("/proc/self/status", "VmHWM");
+    if (bytes == 0)
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+        {
+            bytes = size_t(usage.ru_maxrss) * 1024;     // kB on Linux
+        }
+    }
+    return bytes;
+}
+
+/* Largest peak resident set of the children waited for so far (e.g. the workers of a sweep) */
+inline size_t peak_child_rss_bytes()
+{
+    struct rusage usage;
+    return getrusage(RUSAGE_CHILDREN, &usage) == 0 ? size_t(usage.ru_maxrss) * 1024 : 0;
+}
+
+inline size_t available_memory_bytes()
+{
+    return read_proc_kb("/proc/meminfo", "MemAvailable");
+}
+
+inline std::string format_megabytes(size_t bytes)
+{
+    if (bytes == 0)
+    {
+        return "unknown";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.1f MB", bytes / 1048576.0);
+    return text;
+}
+
+struct CiphertextFootprint
+{
+    long parts = 0;
+    long primes = 0;
+    size_t bytes = 0;
+};
+
+class FootprintTable
+{
+public:
+    FootprintTable(const std::vector<std::string>& stage_names) : stage_names_(stage_names), stages_(stage_names.size())
+    {
+    }
+
+    /* Keeps the largest ciphertext seen at the stage */
+    void record(int stage, long parts, long primes, size_t bytes)
+    {
+        CiphertextFootprint& footprint = stages_.at(stage);
+        footprint.parts = std::max(footprint.parts, parts);
+        footprint.primes = std::max(footprint.primes, primes);
+        footprint.bytes = std::max(footprint.bytes, bytes);
+    }
+
+    const CiphertextFootprint& stage(int stage) const
+    {
+        return stages_.at(stage);
+    }
+
+    /* pool_bytes: bytes allocated by the library's memory pool, 0 if it has none */
+    void print(std::ostream& out = std::cout, size_t pool_bytes = 0) const
+    {
+        char line[128];
+        out << "Memory footprint (largest ciphertext of each stage):" << std::endl;
+        std::snprintf(line, sizeof(line), "%12s %8s %8s %14s", "stage", "parts", "primes", "KB");
+        out << line << std::endl;
+        for (size_t s = 0; s < stages_.size(); s++)
+        {
+            std::snprintf(line, sizeof(line), "%12s %8ld %8ld %14.1f", stage_names_[s].c_str(), stages_[s].parts,
+                stages_[s].primes, stages_[s].bytes / 1024.0);
+            out << line << std::endl;
+        }
+        size_t peak = peak_rss_bytes();
+        size_t available = available_memory_bytes();
+        out << "Peak resident set: " << format_megabytes(peak);
+        if (pool_bytes > 0)
+        {
+            out << ", memory pool: " << format_megabytes(pool_bytes);
+        }
+        out << ", memory available: " << format_megabytes(available);
+        if (peak > 0 && available > 0)
+        {
+            out << " (room for " << available / peak << " processes of this size)";
+        }
+        out << std::endl << std::endl;
+    }
+
+private:
+    std::vector<std::string> stage_names_;
+    std::vector<CiphertextFootprint> stages_;
+};
+
+#endif
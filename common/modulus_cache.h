@@ -0,0 +1,85 @@
+/*
+    Lock-free cache of log2 q per prime set.
+
+    A run only ever sees a handful of distinct prime sets (one per level of the modulus chain), but the
+    noise probes ask for log2 q of a ciphertext's prime set several times per trial. This cache computes
+    each value once and then serves it to any number of threads without taking a lock.
+
+    A prime set is identified by a bitmask of prime indices (bit i is set when prime i is in the set),
+    so only chains of at most 64 primes can be cached; the empty mask is never cached. Entries are
+    claimed with a compare-and-swap on the mask and published with a release store, and a reader that
+    finds an entry still being filled computes the value itself rather than waiting. The cache is not
+    tied to a context: clear() it whenever a new context is built, before any worker threads start.
+*/
+
+#ifndef MODULUS_CACHE_H
+#define MODULUS_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class PrimeSetLog2Cache
+{
+public:
+    PrimeSetLog2Cache() = default;
+    PrimeSetLog2Cache(const PrimeSetLog2Cache&) = delete;
+    PrimeSetLog2Cache& operator=(const PrimeSetLog2Cache&) = delete;
+
+    /* log2 q for the prime set with the given mask, calling compute() only if it is not cached */
+    template <class Compute>
+    double lookup(uint64_t mask, Compute compute)
+    {
+        if (mask == 0)
+        {
+            return compute();
+        }
+        size_t start = size_t((mask * 0x9E3779B97F4A7C15ULL) >> 58);
+        for (size_t probe = 0; probe < capacity; probe++)
+        {
+            Entry& entry = entries_[(start + probe) % capacity];
+            uint64_t key = entry.mask.load(std::memory_order_acquire);
+            if (key == 0)
+            {
+                if (entry.mask.compare_exchange_strong(key, mask, std::memory_order_acq_rel))
+                {
+                    double value = compute();
+                    entry.log2_q = value;
+                    entry.ready.store(true, std::memory_order_release);
+                    return value;
+                }
+                /* key now holds the mask of the thread that claimed the entry first */
+            }
+            if (key == mask)
+            {
+                return entry.ready.load(std::memory_order_acquire) ? entry.log2_q : compute();
+            }
+        }
+        return compute();
+    }
+
+    /* Forget all entries. Not thread-safe. */
+    void clear()
+    {
+        for (Entry& entry : entries_)
+        {
+            entry.ready.store(false, std::memory_order_relaxed);
+            entry.mask.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static const size_t capacity = 64;
+
+    struct Entry
+    {
+        std::atomic<uint64_t> mask{ 0 };
+        std::atomic<bool> ready{ false };
+        double log2_q = 0;
+    };
+
+    std::array<Entry, capacity> entries_;
+};
+
+#endif
@@ -0,0 +1,351 @@
+/*
+    Columnar binary results format for the noise experiments.
+
+    A results file is a fixed-size header describing the parameters of the run, followed by
+    fixed-size blocks of trials. Within a block the data is stored column by column: for each
+    stage, block_trials observed noise budgets, then block_trials estimated noise budgets, then
+    block_trials timings (in seconds). Every block has the same size on disk, so the reader can
+    locate any trial without scanning the file; the last block is padded with NaN.
+
+    NoiseResultsWriter is a buffered, append-only writer: it only ever writes whole blocks at
+    the end of the file. NoiseResultsReader memory-maps a finished file so that a run can be
+    re-analysed without re-running it or parsing text output.
+
+    Values are stored in host byte order.
+*/
+
+#ifndef NOISE_RESULTS_H
+#define NOISE_RESULTS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const int NOISE_RESULTS_MAX_STAGES = 16;
+const uint32_t NOISE_RESULTS_VERSION = 1;
+const uint32_t NOISE_RESULTS_DEFAULT_BLOCK_TRIALS = 4096;
+
+/* The three values recorded per trial and per stage */
+enum NoiseResultsColumn
+{
+    column_observed = 0,
+    column_estimate = 1,
+    column_seconds = 2
+};
+const int NOISE_RESULTS_COLUMNS = 3;
+
+struct NoiseResultsHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t stage_count;
+    uint32_t block_trials;
+    uint32_t reserved;
+    char backend[16];
+    char circuit[32];
+    uint64_t n;
+    uint64_t t;
+    double log_q;
+    uint64_t first_trial;
+    char stage_names[NOISE_RESULTS_MAX_STAGES][24];
+};
+static_assert(sizeof(NoiseResultsHeader) % sizeof(double) == 0, "block columns must stay 8-byte aligned");
+
+/* Size in bytes of one block on disk: a trial count followed by the columns */
+inline size_t noise_results_block_bytes(const NoiseResultsHeader& header)
+{
+    return sizeof(uint64_t) + sizeof(double) * header.stage_count * NOISE_RESULTS_COLUMNS * header.block_trials;
+}
+
+/* Offset (in doubles, from the start of a block's columns) of a given stage and column */
+inline size_t noise_results_column_offset(const NoiseResultsHeader& header, int stage, NoiseResultsColumn column)
+{
+    return (size_t(stage) * NOISE_RESULTS_COLUMNS + size_t(column)) * header.block_trials;
+}
+
+inline NoiseResultsHeader make_noise_results_header(const std::string& backend, const std::string& circuit,
+    uint64_t n, uint64_t t, double log_q, const std::vector<std::string>& stage_names, uint64_t first_trial = 0,
+    uint32_t block_trials = NOISE_RESULTS_DEFAULT_BLOCK_TRIALS)
+{
+    if (stage_names.empty() || stage_names.size() > size_t(NOISE_RESULTS_MAX_STAGES))
+    {
+        throw std::invalid_argument("make_noise_results_header: unsupported number of stages");
+    }
+    if (block_trials == 0)
+    {
+        throw std::invalid_argument("make_noise_results_header: block_trials must be positive");
+    }
+
+    NoiseResultsHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "NOISERES", 8);
+    header.version = NOISE_RESULTS_VERSION;
+    header.stage_count = uint32_t(stage_names.size());
+    header.block_trials = block_trials;
+    std::strncpy(header.backend, backend.c_str(), sizeof(header.backend) - 1);
+    std::strncpy(header.circuit, circuit.c_str(), sizeof(header.circuit) - 1);
+    header.n = n;
+    header.t = t;
+    header.log_q = log_q;
+    header.first_trial = first_trial;
+    for (size_t i = 0; i < stage_names.size(); i++)
+    {
+        std::strncpy(header.stage_names[i], stage_names[i].c_str(), sizeof(header.stage_names[i]) - 1);
+    }
+    return header;
+}
+
+/*
+Buffered append-only writer. Call record() for each stage of the current trial, then end_trial().
+Stages that are not recorded in a trial are stored as NaN.
+*/
+class NoiseResultsWriter
+{
+public:
+    NoiseResultsWriter(const std::string& path, const NoiseResultsHeader& header) : header_(header)
+    {
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_)
+        {
+            throw std::runtime_error("NoiseResultsWriter: cannot open " + path);
+        }
+        block_.assign(header_.stage_count * NOISE_RESULTS_COLUMNS * header_.block_trials,
+            std::numeric_limits<double>::quiet_NaN());
+        write_bytes(&header_, sizeof(header_));
+    }
+
+    NoiseResultsWriter(const NoiseResultsWriter&) = delete;
+    NoiseResultsWriter& operator=(const NoiseResultsWriter&) = delete;
+
+    ~NoiseResultsWriter()
+    {
+        try
+        {
+            close();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    void record(int stage, double observed, double estimate, double seconds)
+    {
+        if (stage < 0 || uint32_t(stage) >= header_.stage_count)
+        {
+            throw std::out_of_range("NoiseResultsWriter: stage out of range");
+        }
+        block_[noise_results_column_offset(header_, stage, column_observed) + trials_in_block_] = observed;
+        block_[noise_results_column_offset(header_, stage, column_estimate) + trials_in_block_] = estimate;
+        block_[noise_results_column_offset(header_, stage, column_seconds) + trials_in_block_] = seconds;
+    }
+
+    void end_trial()
+    {
+        trials_in_block_++;
+        if (trials_in_block_ == header_.block_trials)
+        {
+            write_block();
+        }
+    }
+
+    /* Writes any partially filled block and closes the file. Further records are an error. */
+    void close()
+    {
+        if (!file_)
+        {
+            return;
+        }
+        if (trials_in_block_ > 0)
+        {
+            write_block();
+        }
+        int status = std::fclose(file_);
+        file_ = nullptr;
+        if (status != 0)
+        {
+            throw std::runtime_error("NoiseResultsWriter: error closing file");
+        }
+    }
+
+private:
+    void write_bytes(const void* data, size_t size)
+    {
+        if (std::fwrite(data, 1, size, file_) != size)
+        {
+            throw std::runtime_error("NoiseResultsWriter: write failed");
+        }
+    }
+
+    void write_block()
+    {
+        uint64_t count = trials_in_block_;
+        write_bytes(&count, sizeof(count));
+        write_bytes(block_.data(), block_.size() * sizeof(double));
+        std::fill(block_.begin(), block_.end(), std::numeric_limits<double>::quiet_NaN());
+        trials_in_block_ = 0;
+    }
+
+    NoiseResultsHeader header_;
+    std::FILE* file_ = nullptr;
+    std::vector<double> block_;
+    uint32_t trials_in_block_ = 0;
+};
+
+/* Read-only, memory-mapped view of a results file. */
+class NoiseResultsReader
+{
+public:
+    explicit NoiseResultsReader(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("NoiseResultsReader: cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(NoiseResultsHeader))
+        {
+            ::close(fd);
+            throw std::runtime_error("NoiseResultsReader: " + path + " is not a results file");
+        }
+        size_ = size_t(st.st_size);
+        void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            throw std::runtime_error("NoiseResultsReader: cannot map " + path);
+        }
+        data_ = static_cast<const unsigned char*>(mapped);
+        ::madvise(mapped, size_, MADV_SEQUENTIAL);
+
+        std::memcpy(&header_, data_, sizeof(header_));
+        if (std::memcmp(header_.magic, "NOISERES", 8) != 0 || header_.version != NOISE_RESULTS_VERSION
+            || header_.stage_count == 0 || header_.stage_count > uint32_t(NOISE_RESULTS_MAX_STAGES)
+            || header_.block_trials == 0)
+        {
+            unmap();
+            throw std::runtime_error("NoiseResultsReader: " + path + " has an unsupported header");
+        }
+        block_bytes_ = noise_results_block_bytes(header_);
+        block_count_ = (size_ - sizeof(header_)) / block_bytes_;
+        for (size_t b = 0; b < block_count_; b++)
+        {
+            trials_ += block_trial_count(b);
+        }
+    }
+
+    NoiseResultsReader(const NoiseResultsReader&) = delete;
+    NoiseResultsReader& operator=(const NoiseResultsReader&) = delete;
+
+    ~NoiseResultsReader()
+    {
+        unmap();
+    }
+
+    const NoiseResultsHeader& header() const
+    {
+        return header_;
+    }
+
+    uint64_t trials() const
+    {
+        return trials_;
+    }
+
+    size_t block_count() const
+    {
+        return block_count_;
+    }
+
+    uint64_t block_trial_count(size_t block) const
+    {
+        uint64_t count;
+        std::memcpy(&count, block_start(block), sizeof(count));
+        return count;
+    }
+
+    /* Pointer to the block_trial_count(block) contiguous values of one column of one stage */
+    const double* column(size_t block, int stage, NoiseResultsColumn column) const
+    {
+        const double* columns = reinterpret_cast<const double*>(block_start(block) + sizeof(uint64_t));
+        return columns + noise_results_column_offset(header_, stage, column);
+    }
+
+    /* Value for trial index i, counted from the first trial in the file */
+    double value(uint64_t i, int stage, NoiseResultsColumn column) const
+    {
+        return this->column(size_t(i / header_.block_trials), stage, column)[i % header_.block_trials];
+    }
+
+    int stage_index(const std::string& name) const
+    {
+        for (uint32_t s = 0; s < header_.stage_count; s++)
+        {
+            if (name == header_.stage_names[s])
+            {
+                return int(s);
+            }
+        }
+        return -1;
+    }
+
+    /* Mean of one column over all trials, ignoring NaN entries */
+    double mean(int stage, NoiseResultsColumn column) const
+    {
+        double total = 0;
+        uint64_t count = 0;
+        for (size_t b = 0; b < block_count_; b++)
+        {
+            const double* values = this->column(b, stage, column);
+            uint64_t block_trials = block_trial_count(b);
+            for (uint64_t i = 0; i < block_trials; i++)
+            {
+                if (!std::isnan(values[i]))
+                {
+                    total += values[i];
+                    count++;
+                }
+            }
+        }
+        return count ? total / double(count) : std::numeric_limits<double>::quiet_NaN();
+    }
+
+private:
+    const unsigned char* block_start(size_t block) const
+    {
+        if (block >= block_count_)
+        {
+            throw std::out_of_range("NoiseResultsReader: block out of range");
+        }
+        return data_ + sizeof(header_) + block * block_bytes_;
+    }
+
+    void unmap()
+    {
+        if (data_)
+        {
+            ::munmap(const_cast<unsigned char*>(data_), size_);
+            data_ = nullptr;
+        }
+    }
+
+    NoiseResultsHeader header_;
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+    size_t block_bytes_ = 0;
+    size_t block_count_ = 0;
+    uint64_t trials_ = 0;
+};
+
+#endif
@@ -0,0 +1,51 @@
+/*
+    Running count, mean and sum of squared deviations of a sample (Welford), which merge exactly
+    (Chan et al.), so that statistics gathered in separate processes or runs can be combined.
+    NaN values (e.g. the missing noise estimate of SEAL) are skipped.
+*/
+
+#ifndef RUNNING_STATISTICS_H
+#define RUNNING_STATISTICS_H
+
+#include <cmath>
+#include <cstdint>
+
+/* Count, mean and sum of squared deviations of a sample, mergeable across processes */
+struct RunningStatistics
+{
+    uint64_t count = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(double value)
+    {
+        if (std::isnan(value))
+        {
+            return;
+        }
+        count++;
+        double delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+    }
+
+    void merge(const RunningStatistics& other)
+    {
+        if (other.count == 0)
+        {
+            return;
+        }
+        uint64_t total = count + other.count;
+        double delta = other.mean - mean;
+        mean += delta * other.count / total;
+        m2 += other.m2 + delta * delta * (double(count) * other.count / total);
+        count = total;
+    }
+
+    double standard_deviation() const
+    {
+        return count > 1 ? std::sqrt(m2 / (count - 1)) : 0;
+    }
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*
+    Side-by-side statistics of one circuit run under several schemes (BGV and BFV in SEAL).
+
+    A harness fills one SchemeRun per scheme: for every stage and trial, the noise budget, the
+    latency of the operation and the size of the resulting ciphertext in bytes. print_scheme_comparison()
+    then prints one row per stage, with for each scheme the mean and standard deviation of the budget,
+    its minimum, the mean latency and the ciphertext size, and the latency of every scheme relative to
+    the first.
+*/
+
+#ifndef SCHEME_COMPARISON_H
+#define SCHEME_COMPARISON_H
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "running_statistics.h"
+
+struct SchemeStage
+{
+    std::string name;
+    RunningStatistics budget;
+    double min_budget = std::numeric_limits<double>::infinity();
+    RunningStatistics seconds;
+    RunningStatistics bytes;
+};
+
+struct SchemeRun
+{
+    std::string scheme;
+    std::vector<SchemeStage> stages;
+
+    SchemeRun() = default;
+
+    SchemeRun(const std::string& scheme_name, const std::vector<std::string>& stage_names) : scheme(scheme_name)
+    {
+        for (const std::string& name : stage_names)
+        {
+            stages.push_back(SchemeStage());
+            stages.back().name = name;
+        }
+    }
+
+    void record(int stage, double budget, double seconds, double bytes)
+    {
+        SchemeStage& s = stages.at(stage);
+        s.budget.add(budget);
+        s.min_budget = std::min(s.min_budget, budget);
+        s.seconds.add(seconds);
+        s.bytes.add(bytes);
+    }
+};
+
+/* The runs must have the same stages, in the same order */
+inline void print_scheme_comparison(const std::vector<SchemeRun>& runs, std::ostream& out = std::cout)
+{
+    if (runs.empty())
+    {
+        return;
+    }
+    char line[256];
+    out << "Scheme comparison: noise budget mean (sd) [min], latency in microseconds, ciphertext KB" << std::endl;
+    std::snprintf(line, sizeof(line), "%-12s", "stage");
+    out << line;
+    for (const SchemeRun& run : runs)
+    {
+        std::snprintf(line, sizeof(line), " | %-40s", run.scheme.c_str());
+        out << line;
+    }
+    out << std::endl;
+    for (size_t s = 0; s < runs[0].stages.size(); s++)
+    {
+        std::snprintf(line, sizeof(line), "%-12s", runs[0].stages[s].name.c_str());
+        out << line;
+        double reference_seconds = runs[0].stages[s].seconds.mean;
+        for (const SchemeRun& run : runs)
+        {
+            const SchemeStage& stage = run.stages.at(s);
+            std::snprintf(line, sizeof(line), " | %6.1f (%4.1f) [%4.0f] %9.1f us %7.1f KB x%-5.2f", stage.budget.mean,
+                stage.budget.standard_deviation(), stage.min_budget, stage.seconds.mean * 1e6, stage.bytes.mean / 1024,
+                reference_seconds > 0 ? stage.seconds.mean / reference_seconds : 0.0);
+            out << line;
+        }
+        out << std::endl;
+    }
+    out << std::endl;
+}
+
+#endif
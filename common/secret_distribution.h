@@ -0,0 +1,90 @@
+/*
+    Secret key distributions for the harnesses.
+
+    secret_default keeps the library's own key generation. The other distributions are sampled here,
+    from a counter-based stream (common/counter_rng.h), and imported into the library by the harness:
+        - secret_uniform_ternary: every coefficient uniform in {-1, 0, 1}
+        - secret_sparse_ternary: exactly h coefficients uniform in {-1, 1}, at uniformly random positions
+    The variance of a secret coefficient, 2/3 or h/n, is the secret_variance argument of variance_fresh
+    and variance_mod_switch in bgv_heuristics.h. The default key is predicted as uniform ternary, as before.
+*/
+
+#ifndef SECRET_DISTRIBUTION_H
+#define SECRET_DISTRIBUTION_H
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "bgv_heuristics.h"
+#include "counter_rng.h"
+
+enum SecretDistribution
+{
+    secret_default,
+    secret_uniform_ternary,
+    secret_sparse_ternary
+};
+
+inline const char* secret_distribution_name(SecretDistribution distribution)
+{
+    switch (distribution)
+    {
+    case secret_uniform_ternary:
+        return "uniform ternary";
+    case secret_sparse_ternary:
+        return "sparse ternary";
+    default:
+        return "library default";
+    }
+}
+
+/* Variance of a coefficient of the secret, for the predictions */
+inline double secret_coefficient_variance(SecretDistribution distribution, long n, long hamming_weight)
+{
+    if (distribution == secret_sparse_ternary)
+    {
+        return double(hamming_weight) / n;
+    }
+    return BGV_TERNARY_SECRET_VARIANCE;
+}
+
+/* The n coefficients of a secret drawn from distribution, which must not be secret_default */
+inline std::vector<int> sample_ternary_secret(SecretDistribution distribution, long n, long hamming_weight,
+    TrialRandomStream& stream)
+{
+    std::vector<int> coefficients(n, 0);
+    if (distribution == secret_uniform_ternary)
+    {
+        for (long j = 0; j < n; j++)
+        {
+            coefficients[j] = int(stream.uniform(3)) - 1;
+        }
+    }
+    else if (distribution == secret_sparse_ternary)
+    {
+        if (hamming_weight < 1 || hamming_weight > n)
+        {
+            throw std::invalid_argument("sample_ternary_secret: Hamming weight must be in [1, n]");
+        }
+        /* The first hamming_weight positions of a partial Fisher-Yates shuffle */
+        std::vector<long> positions(n);
+        for (long j = 0; j < n; j++)
+        {
+            positions[j] = j;
+        }
+        for (long j = 0; j < hamming_weight; j++)
+        {
+            long k = j + long(stream.uniform(n - j));
+            std::swap(positions[j], positions[k]);
+            coefficients[positions[j]] = stream.uniform(2) ? 1 : -1;
+        }
+    }
+    else
+    {
+        throw std::invalid_argument("sample_ternary_secret: the default secret is sampled by the library");
+    }
+    return coefficients;
+}
+
+#endif
@@ -0,0 +1,377 @@
+/*
+    Multi-process sweeps: a local coordinator hands work units to worker processes.
+
+    A sweep is a list of work units, each a parameter set (an index into the caller's list of
+    configurations) and a range of trials. run_sweep() forks the worker processes, each connected to
+    the coordinator by a socket pair, and gives every idle worker the next pending unit. A worker runs
+    the unit with the caller's function and sends back one StageStatistics per stage: counts, means
+    and sums of squared deviations, which merge exactly (Chan et al.) into the statistics of the
+    whole sweep. Since trial i only depends on (run seed, i), how the trials are split into units and
+    which worker runs a unit do not change the results; units are merged in unit order, so neither
+    does the order in which they finish.
+
+    A worker that dies (crash, kill, out of memory) is reaped and replaced, and its unit goes back to
+    the front of the queue, up to max_attempts times per unit. fault_rate makes workers exit
+    abruptly before that fraction of units, to exercise the reassignment without a cluster.
+
+    Messages are raw structs in host byte order, as both ends are the same binary on the same host.
+*/
+
+#ifndef SWEEP_COORDINATOR_H
+#define SWEEP_COORDINATOR_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "running_statistics.h"
+
+/* The three values recorded per trial and per stage, as in noise_results.h */
+struct StageStatistics
+{
+    RunningStatistics observed;
+    RunningStatistics estimate;
+    RunningStatistics seconds;
+
+    void add(double observed_budget, double estimated_budget, double operation_seconds)
+    {
+        observed.add(observed_budget);
+        estimate.add(estimated_budget);
+        seconds.add(operation_seconds);
+    }
+
+    void merge(const StageStatistics& other)
+    {
+        observed.merge(other.observed);
+        estimate.merge(other.estimate);
+        seconds.merge(other.seconds);
+    }
+};
+
+struct SweepUnit
+{
+    uint32_t config;
+    uint64_t first_trial;
+    uint64_t trials;
+};
+
+struct SweepOptions
+{
+    unsigned workers = 2;
+    int max_attempts = 3;
+    double fault_rate = 0;
+};
+
+struct SweepResult
+{
+    std::vector<std::vector<StageStatistics>> configs;  // merged statistics per configuration and stage
+    std::vector<size_t> failed_units;                   // units that failed max_attempts times
+    long worker_deaths = 0;
+};
+
+/* Runs one unit in a worker process, returning its statistics per stage */
+typedef std::function<std::vector<StageStatistics>(const SweepUnit&)> SweepWorkFunction;
+
+/* Units of up to trials_per_unit trials covering trials 0, ..., trials_per_config - 1 of every configuration */
+inline std::vector<SweepUnit> make_sweep_units(size_t configs, uint64_t trials_per_config, uint64_t trials_per_unit)
+{
+    std::vector<SweepUnit> units;
+    for (size_t config = 0; config < configs; config++)
+    {
+        for (uint64_t first = 0; first < trials_per_config; first += trials_per_unit)
+        {
+            units.push_back({uint32_t(config), first, std::min(trials_per_unit, trials_per_config - first)});
+        }
+    }
+    return units;
+}
+
+inline bool sweep_read_all(int fd, void* data, size_t size)
+{
+    char* out = static_cast<char*>(data);
+    while (size > 0)
+    {
+        ssize_t got = read(fd, out, size);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return false;
+        }
+        out += got;
+        size -= size_t(got);
+    }
+    return true;
+}
+
+/* MSG_NOSIGNAL: a dead peer shows up as a failed write instead of SIGPIPE */
+inline bool sweep_write_all(int fd, const void* data, size_t size)
+{
+    const char* in = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, in, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        in += sent;
+        size -= size_t(sent);
+    }
+    return true;
+}
+
+/* Body of a worker process: runs units until the coordinator closes the socket */
+inline void sweep_worker_loop(int fd, const SweepWorkFunction& work, double fault_rate)
+{
+    std::mt19937_64 faults(uint64_t(getpid()) * 0x9e3779b97f4a7c15ULL);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for (;;)
+    {
+        uint64_t unit_index;
+        SweepUnit unit;
+        if (!sweep_read_all(fd, &unit_index, sizeof(unit_index)) || !sweep_read_all(fd, &unit, sizeof(unit)))
+        {
+            _exit(0);
+        }
+        if (fault_rate > 0 && uniform(faults) < fault_rate)
+        {
+            _exit(3);
+        }
+        std::vector<StageStatistics> statistics;
+        try
+        {
+            statistics = work(unit);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Sweep worker " << getpid() << ": " << e.what() << std::endl;
+            _exit(2);
+        }
+        uint64_t stage_count = statistics.size();
+        if (!sweep_write_all(fd, &unit_index, sizeof(unit_index)) || !sweep_write_all(fd, &stage_count, sizeof(stage_count)) ||
+            !sweep_write_all(fd, statistics.data(), stage_count * sizeof(StageStatistics)))
+        {
+            _exit(0);
+        }
+    }
+}
+
+inline SweepResult run_sweep(const std::vector<SweepUnit>& units, size_t configs, const SweepWorkFunction& work,
+    const SweepOptions& options, std::ostream& log = std::cout)
+{
+    struct Worker
+    {
+        pid_t pid;
+        int fd;
+        long unit;  // in flight, -1 if idle
+    };
+    std::vector<Worker> workers;
+    std::deque<size_t> pending;
+    for (size_t u = 0; u < units.size(); u++)
+    {
+        pending.push_back(u);
+    }
+    std::vector<int> attempts(units.size(), 0);
+    std::vector<std::vector<StageStatistics>> unit_results(units.size());
+    std::vector<bool> done(units.size(), false);
+    SweepResult result;
+    size_t finished = 0;
+
+    auto spawn = [&]() -> bool {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            return false;
+        }
+        std::cout.flush();
+        std::cerr.flush();
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        if (pid == 0)
+        {
+            close(fds[0]);
+            for (const Worker& other : workers)
+            {
+                close(other.fd);
+            }
+            sweep_worker_loop(fds[1], work, options.fault_rate);
+            _exit(0);
+        }
+        close(fds[1]);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        workers.push_back({pid, fds[0], -1});
+        return true;
+    };
+
+    /* Reap a dead worker and put its unit back in the queue, or give up on the unit */
+    auto retire = [&](size_t w) {
+        Worker worker = workers[w];
+        close(worker.fd);
+        int status = 0;
+        waitpid(worker.pid, &status, 0);
+        result.worker_deaths++;
+        if (worker.unit >= 0)
+        {
+            size_t u = size_t(worker.unit);
+            log << "Worker " << worker.pid << " died on unit " << u << " (attempt " << attempts[u] << ")";
+            if (attempts[u] < options.max_attempts)
+            {
+                pending.push_front(u);
+                log << ", reassigning it" << std::endl;
+            }
+            else
+            {
+                result.failed_units.push_back(u);
+                finished++;
+                log << ", giving up on it" << std::endl;
+            }
+        }
+        workers.erase(workers.begin() + w);
+    };
+
+    for (unsigned w = 0; w < std::max(1u, options.workers); w++)
+    {
+        if (!spawn())
+        {
+            break;
+        }
+    }
+
+    while (finished < units.size())
+    {
+        /* Keep the pool full while there is work left */
+        while (workers.size() < std::max(1u, options.workers) && !pending.empty() && spawn())
+        {
+        }
+        if (workers.empty())
+        {
+            log << "Could not start any sweep worker" << std::endl;
+            break;
+        }
+
+        /* Hand pending units to idle workers */
+        for (size_t w = 0; w < workers.size(); w++)
+        {
+            if (workers[w].unit >= 0 || pending.empty())
+            {
+                continue;
+            }
+            uint64_t unit_index = pending.front();
+            pending.pop_front();
+            attempts[unit_index]++;
+            workers[w].unit = long(unit_index);
+            if (!sweep_write_all(workers[w].fd, &unit_index, sizeof(unit_index)) ||
+                !sweep_write_all(workers[w].fd, &units[unit_index], sizeof(SweepUnit)))
+            {
+                retire(w);
+                w--;
+            }
+        }
+
+        std::vector<pollfd> polls;
+        for (const Worker& worker : workers)
+        {
+            polls.push_back({worker.fd, POLLIN, 0});
+        }
+        if (poll(polls.data(), polls.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            log << "poll failed" << std::endl;
+            break;
+        }
+
+        /* Collect results, from the back so that retiring a worker does not shift the ones still to visit */
+        for (size_t w = workers.size(); w-- > 0;)
+        {
+            if (polls[w].revents == 0)
+            {
+                continue;
+            }
+            uint64_t unit_index = 0, stage_count = 0;
+            std::vector<StageStatistics> statistics;
+            bool ok = sweep_read_all(workers[w].fd, &unit_index, sizeof(unit_index)) &&
+                sweep_read_all(workers[w].fd, &stage_count, sizeof(stage_count)) &&
+                long(unit_index) == workers[w].unit && stage_count < 1024;
+            if (ok)
+            {
+                statistics.resize(stage_count);
+                ok = sweep_read_all(workers[w].fd, statistics.data(), stage_count * sizeof(StageStatistics));
+            }
+            if (!ok)
+            {
+                retire(w);
+                continue;
+            }
+            workers[w].unit = -1;
+            if (!done[unit_index])
+            {
+                done[unit_index] = true;
+                unit_results[unit_index] = statistics;
+                finished++;
+            }
+        }
+    }
+
+    /* Closing the sockets tells the remaining workers to exit */
+    for (const Worker& worker : workers)
+    {
+        close(worker.fd);
+    }
+    for (const Worker& worker : workers)
+    {
+        int status = 0;
+        waitpid(worker.pid, &status, 0);
+    }
+
+    /* Merge in unit order, so that the result does not depend on which unit finished first */
+    result.configs.resize(configs);
+    for (size_t u = 0; u < units.size(); u++)
+    {
+        if (!done[u])
+        {
+            continue;
+        }
+        std::vector<StageStatistics>& merged = result.configs.at(units[u].config);
+        if (merged.size() < unit_results[u].size())
+        {
+            merged.resize(unit_results[u].size());
+        }
+        for (size_t s = 0; s < unit_results[u].size(); s++)
+        {
+            merged[s].merge(unit_results[u][s]);
+        }
+    }
+    return result;
+}
+
+#endif
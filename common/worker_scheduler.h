@@ -0,0 +1,296 @@
+/*
+    Placement of trial workers on the machine.
+
+    At large n a trial's ciphertexts take several MB, so where the workers run matters: two workers on
+    the SMT siblings of one core share its L2, and a worker on one socket reading key material
+    allocated on the other crosses the interconnect for every key switch. WorkerScheduler reads the
+    CPU, cache and NUMA topology from sysfs (Linux; elsewhere every CPU is treated as one node), and
+        - chooses the number of workers from the per-trial working set: every logical CPU if the
+          working set fits in L2, otherwise one worker per physical core,
+        - spreads the workers over the NUMA nodes, on distinct physical cores first,
+        - pins each worker to its CPU (pin(), called by the worker thread itself).
+    The last level cache is not used: it is shared by all the cores of a socket, and at the n where
+    placement matters the working sets of the workers of a socket exceed it together, whatever their
+    number, so capping the workers by it would leave cores idle without keeping the trials in cache.
+    NodeLocalCopies keeps one copy of read-only data (e.g. the secret key and its key-switching
+    matrices) per NUMA node, made by the first worker of that node, so that Linux's first-touch
+    policy places it in that node's memory.
+*/
+
+#ifndef WORKER_SCHEDULER_H
+#define WORKER_SCHEDULER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct LogicalCpu
+{
+    int cpu;
+    int node;       // index into the NUMA nodes, 0, 1, ...
+    int package;
+    int core;       // core_id within the package; SMT siblings share it
+};
+
+struct CpuTopology
+{
+    std::vector<LogicalCpu> cpus;   // the CPUs this process may run on
+    int nodes = 1;
+    size_t l2_bytes = 0;            // per core, 0 if unknown
+};
+
+/* Parse a sysfs CPU or node list such as "0-3,8,10-11" */
+inline std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> values;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ','))
+    {
+        int first, last;
+        if (std::sscanf(range.c_str(), "%d-%d", &first, &last) == 2)
+        {
+            for (int value = first; value <= last; value++)
+            {
+                values.push_back(value);
+            }
+        }
+        else if (std::sscanf(range.c_str(), "%d", &first) == 1)
+        {
+            values.push_back(first);
+        }
+    }
+    return values;
+}
+
+inline bool read_sysfs(const std::string& path, std::string& value)
+{
+    std::ifstream in(path);
+    return bool(std::getline(in, value));
+}
+
+/* A sysfs cache size such as "1024K" or "32M", in bytes */
+inline size_t parse_cache_size(const std::string& size)
+{
+    size_t value = 0;
+    char unit = 0;
+    if (std::sscanf(size.c_str(), "%zu%c", &value, &unit) < 1)
+    {
+        return 0;
+    }
+    return unit == 'K' ? value << 10 : unit == 'M' ? value << 20 : unit == 'G' ? value << 30 : value;
+}
+
+inline CpuTopology read_cpu_topology()
+{
+    CpuTopology topology;
+    std::vector<int> allowed;
+#ifdef __linux__
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &mask))
+            {
+                allowed.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (allowed.empty())
+    {
+        for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+        {
+            allowed.push_back(int(cpu));
+        }
+    }
+
+    /* Node of every CPU, with node ids renumbered 0, 1, ... */
+    std::map<int, int> node_of_cpu;
+    std::string line;
+    if (read_sysfs("/sys/devices/system/node/online", line))
+    {
+        std::vector<int> node_ids = parse_cpu_list(line);
+        for (size_t k = 0; k < node_ids.size(); k++)
+        {
+            std::string cpulist;
+            if (read_sysfs("/sys/devices/system/node/node" + std::to_string(node_ids[k]) + "/cpulist", cpulist))
+            {
+                for (int cpu : parse_cpu_list(cpulist))
+                {
+                    node_of_cpu[cpu] = int(k);
+                }
+            }
+        }
+        topology.nodes = std::max<int>(1, int(node_ids.size()));
+    }
+
+    std::set<int> used_nodes;
+    for (int cpu : allowed)
+    {
+        std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        LogicalCpu info = {cpu, node_of_cpu.count(cpu) ? node_of_cpu[cpu] : 0, 0, cpu};
+        if (read_sysfs(base + "physical_package_id", line))
+        {
+            info.package = std::stoi(line);
+        }
+        if (read_sysfs(base + "core_id", line))
+        {
+            info.core = std::stoi(line);
+        }
+        topology.cpus.push_back(info);
+        used_nodes.insert(info.node);
+    }
+
+    /* L2 of the first CPU; data and unified caches only */
+    std::string cache = "/sys/devices/system/cpu/cpu" + std::to_string(allowed[0]) + "/cache/index";
+    for (int index = 0; read_sysfs(cache + std::to_string(index) + "/level", line); index++)
+    {
+        std::string type, size;
+        if (std::stoi(line) != 2 || !read_sysfs(cache + std::to_string(index) + "/type", type) ||
+            type == "Instruction" || !read_sysfs(cache + std::to_string(index) + "/size", size))
+        {
+            continue;
+        }
+        topology.l2_bytes = parse_cache_size(size);
+    }
+    return topology;
+}
+
+class WorkerScheduler
+{
+public:
+    /* worker_count = 0 chooses the number of workers from working_set_bytes, the working set of one trial */
+    explicit WorkerScheduler(size_t working_set_bytes, unsigned worker_count = 0)
+        : topology_(read_cpu_topology()), working_set_bytes_(working_set_bytes)
+    {
+        /* Distinct physical cores first, then their SMT siblings, each round-robin over the nodes */
+        std::vector<std::vector<LogicalCpu>> first_siblings(topology_.nodes), other_siblings(topology_.nodes);
+        std::set<std::pair<int, int>> seen_cores;
+        for (const LogicalCpu& cpu : topology_.cpus)
+        {
+            bool first = seen_cores.insert({cpu.package, cpu.core}).second;
+            (first ? first_siblings : other_siblings)[cpu.node].push_back(cpu);
+        }
+        for (auto* group : {&first_siblings, &other_siblings})
+        {
+            for (size_t i = 0; ; i++)
+            {
+                bool any = false;
+                for (auto& node_cpus : *group)
+                {
+                    if (i < node_cpus.size())
+                    {
+                        order_.push_back(node_cpus[i]);
+                        any = true;
+                    }
+                }
+                if (!any)
+                {
+                    break;
+                }
+            }
+        }
+        physical_cores_ = seen_cores.size();
+
+        if (worker_count == 0)
+        {
+            /* SMT siblings share L2: if a trial does not fit in it, two trials on one core evict each other */
+            bool fits_l2 = topology_.l2_bytes == 0 || working_set_bytes <= topology_.l2_bytes;
+            worker_count = unsigned(fits_l2 ? order_.size() : physical_cores_);
+        }
+        workers_ = std::max(1u, worker_count);
+    }
+
+    unsigned workers() const
+    {
+        return workers_;
+    }
+
+    int nodes() const
+    {
+        return topology_.nodes;
+    }
+
+    /* NUMA node of a worker; workers beyond the number of CPUs wrap around */
+    int node_of(unsigned worker) const
+    {
+        return order_[worker % order_.size()].node;
+    }
+
+    /* Pin the calling thread, which runs the given worker, to that worker's CPU; returns false if not supported */
+    bool pin(unsigned worker) const
+    {
+#ifdef __linux__
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(order_[worker % order_.size()].cpu, &mask);
+        return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+#else
+        (void)worker;
+        return false;
+#endif
+    }
+
+    void print(std::ostream& out = std::cout) const
+    {
+        out << "Workers: " << workers_ << " on " << topology_.cpus.size() << " CPUs (" << physical_cores_
+            << " cores, " << topology_.nodes << " NUMA nodes); working set " << (working_set_bytes_ >> 10)
+            << " KB per trial, L2 " << (topology_.l2_bytes >> 10) << " KB" << std::endl;
+    }
+
+private:
+    CpuTopology topology_;
+    size_t working_set_bytes_;
+    std::vector<LogicalCpu> order_;
+    size_t physical_cores_ = 0;
+    unsigned workers_ = 1;
+};
+
+/*
+One copy of read-only data per NUMA node. The copy for a node is made by the first worker of that node to ask for
+it, after that worker has been pinned, so that first-touch places it in the node's memory. With a single node the
+original is shared and nothing is copied.
+*/
+template <class T>
+class NodeLocalCopies
+{
+public:
+    NodeLocalCopies(const T& original, int nodes) : original_(original), copies_(nodes), once_(nodes)
+    {
+    }
+
+    const T& get(int node)
+    {
+        if (copies_.size() <= 1)
+        {
+            return original_;
+        }
+        std::call_once(once_.at(node), [&]() { copies_[node].reset(new T(original_)); });
+        return *copies_[node];
+    }
+
+private:
+    const T& original_;
+    std::vector<std::unique_ptr<T>> copies_;
+    std::vector<std::once_flag> once_;
+};
+
+#endif
@@ -0,0 +1,73 @@
+# A script for comparing two micro-benchmark JSON files written by BGV_bench (HElib) or 4_bgv_basics_bench.cpp (SEAL)
+# For example, to catch performance regressions when moving to a new version of HElib or SEAL:
+#   python3 compare_bench.py BGV_bench_HElib_before.json BGV_bench_HElib_after.json
+# Exits with status 1 if any benchmark is slower than the threshold allows
+
+###########
+# Imports #
+###########
+
+import argparse
+import json
+import sys
+
+
+#####################
+# Reading the files #
+#####################
+
+# Map from benchmark name (e.g. "HElib/encrypt/n:4096") to its entry
+def load_benchmarks(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data["context"], {entry["name"]: entry for entry in data["benchmarks"]}
+
+
+#######################
+# Comparing the files #
+#######################
+
+# Relative change of after with respect to before, positive when after is larger
+def relative_change(before, after):
+    if before == 0:
+        return 0.0
+    return (after - before) / before
+
+def compare(before_path, after_path, metric, threshold):
+    before_context, before = load_benchmarks(before_path)
+    after_context, after = load_benchmarks(after_path)
+    print("before: " + before_context["backend"] + " " + before_context["library_version"] + " (" + before_context["date"] + ")")
+    print("after:  " + after_context["backend"] + " " + after_context["library_version"] + " (" + after_context["date"] + ")")
+    print("")
+    print("%-32s %14s %14s %9s %14s %9s" % ("benchmark", metric + " before", metric + " after", "change", "bytes after", "change"))
+
+    regressions = []
+    for name in before:
+        if name not in after:
+            print("%-32s only in before" % name)
+            continue
+        time_change = relative_change(before[name][metric], after[name][metric])
+        bytes_change = relative_change(before[name]["bytes_per_iteration"], after[name]["bytes_per_iteration"])
+        flag = ""
+        if time_change > threshold:
+            flag = "  <-- slower"
+            regressions.append(name)
+        print("%-32s %14.0f %14.0f %+8.1f%% %14.0f %+8.1f%%%s" % (name, before[name][metric], after[name][metric],
+              100 * time_change, after[name]["bytes_per_iteration"], 100 * bytes_change, flag))
+    for name in after:
+        if name not in before:
+            print("%-32s only in after" % name)
+
+    print("")
+    print(str(len(regressions)) + " benchmark(s) slower by more than " + str(100 * threshold) + "%")
+    return regressions
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Compare two BGV micro-benchmark JSON files")
+    parser.add_argument("before")
+    parser.add_argument("after")
+    parser.add_argument("--metric", default="p50_time", help="time field to compare (real_time is the mean)")
+    parser.add_argument("--threshold", type=float, default=0.10, help="relative slowdown flagged as a regression")
+    args = parser.parse_args()
+    sys.exit(1 if compare(args.before, args.after, args.metric, args.threshold) else 0)
@@ -10,6 +10,9 @@ from math import sqrt
 from math import floor
 from math import log
 from scipy.special import erfinv
+from bgv_heuristics_grid import log2_bound_fresh, log2_bound_mod_switch
+from bgv_heuristics_grid import log2_variance_fresh, log2_variance_add, log2_variance_mult, log2_variance_mod_switch
+from bgv_heuristics_grid import log2_variance_plain_mult, log2_variance_constant_mult, log2_alpha_bound
 
 
 ############################################################################
@@ -43,11 +46,16 @@ def bound_mod_switch(n, t, q, p, input_bound):
 # Average-case variances after operations, as presented in Figure 5 #
 #####################################################################
 
-def variance_fresh(n, t):
+# The secret key coefficients have variance secret_variance: 2/3 for a uniform ternary secret, h/n for a sparse
+# ternary secret of Hamming weight h (see secret_variance_hamming_weight)
+def variance_fresh(n, t, secret_variance=2.0/3):
     sigma = 3.19
-    output_variance = ((4.0/3) * n + 1) * t * t * sigma * sigma
+    output_variance = (n * (2.0/3 + secret_variance) + 1) * t * t * sigma * sigma
     return output_variance
 
+def secret_variance_hamming_weight(n, h):
+    return float(h) / n
+
 def variance_add(input_variance_1, input_variance_2):
     return input_variance_1 + input_variance_2
 
@@ -57,9 +65,17 @@ def variance_mult(input_variance_1, input_variance_2, n, t):
     term3 = input_variance_2 * n * (1./12) * (t * t -1)
     return term1 + term2 + term3
 
-def variance_mod_switch(n, t, q, p, input_variance):
+# Multiplication by a plaintext whose coefficients are uniform mod t (centered), giving |m| \approx n*(t^2-1)/12
+def variance_plain_mult(input_variance, n, t):
+    return input_variance * n * (1./12) * (t * t - 1)
+
+# Multiplication by a scalar constant (centered mod t)
+def variance_constant_mult(input_variance, constant):
+    return constant * constant * input_variance
+
+def variance_mod_switch(n, t, q, p, input_variance, secret_variance=2.0/3):
     gamma_squared_input_variance = (p/q) * (p/q) * input_variance
-    output_variance = (1.0/12) * ((2.0/3) * n + 1) * (t * t - 1)
+    output_variance = (1.0/12) * (secret_variance * n + 1) * (t * t - 1)
     output_variance += gamma_squared_input_variance
     return output_variance
 
@@ -80,54 +96,102 @@ def get_noise_budget(bound, q):
     return output
 
 
+#####################################################################################
+# Log-domain engine: the estimates below evaluate the formulas above on log2 values #
+#####################################################################################
+
+# Moduli only enter as log2 q (exact for Python integers of any size), and bounds and variances are carried as
+# their log2, using the functions of bgv_heuristics_grid.py. Products such as (p/q)*(p/q)*input_variance and
+# input_variance_1*input_variance_2 become sums, so nothing overflows at any depth or n, and erfinv near 1 is
+# computed as erfcinv of (1-alpha)^(1/n) subtracted from 1 without cancellation, falling back to mpmath if needed
+
+def log2_modulus(q):
+    return log(q, 2)
+
+# Given log2 of the bound on the noise, the noise budget remaining, as get_noise_budget
+def get_noise_budget_from_log2(log_bound, log_q):
+    return floor(log_q - float(log_bound)) - 1
+
+# Given log2 of the variance of the noise, the average-case noise budget remaining, as
+# get_noise_budget(alpha_bound_from_variance(variance, n), q)
+def get_average_case_budget_from_log2(log_variance, n, log_q, alpha=0.001):
+    return get_noise_budget_from_log2(log2_alpha_bound(log_variance, n, alpha), log_q)
+
+# The formulas above are the reference for the log2 engine: at parameters where they do not overflow, both must agree
+# to rounding error, and give the same budgets. Checked before the tables are printed
+def check_log2_engine(n=4096, t=3, q=2**109, p=2**55, constant=1024, secret_variance=2.0/3):
+    log_q, log_p = log2_modulus(q), log2_modulus(p)
+    fresh_bound = bound_fresh(n, t)
+    fresh = variance_fresh(n, t, secret_variance)
+    add = variance_add(fresh, fresh)
+    mult = variance_mult(add, fresh, n, t)
+    pairs = [
+        ("bound_fresh", fresh_bound, log2_bound_fresh(n, t)),
+        ("bound_mod_switch", bound_mod_switch(n, t, q, p, fresh_bound ** 2),
+            log2_bound_mod_switch(n, t, log_q, log_p, 2 * log2_bound_fresh(n, t))),
+        ("variance_fresh", fresh, log2_variance_fresh(n, t, secret_variance)),
+        ("variance_add", add, log2_variance_add(log(fresh, 2), log(fresh, 2))),
+        ("variance_mult", mult, log2_variance_mult(log(add, 2), log(fresh, 2), n, t)),
+        ("variance_plain_mult", variance_plain_mult(fresh, n, t), log2_variance_plain_mult(log(fresh, 2), n, t)),
+        ("variance_constant_mult", variance_constant_mult(fresh, constant),
+            log2_variance_constant_mult(log(fresh, 2), constant)),
+        ("variance_mod_switch", variance_mod_switch(n, t, q, p, mult, secret_variance),
+            log2_variance_mod_switch(n, t, log_q, log_p, log(mult, 2), secret_variance)),
+        ("alpha_bound_from_variance", alpha_bound_from_variance(mult, n), log2_alpha_bound(log(mult, 2), n, 0.001)),
+    ]
+    for name, linear, log2_value in pairs:
+        if abs(log(linear, 2) - float(log2_value)) > 1e-9 * max(1, abs(log(linear, 2))):
+            raise AssertionError(name + ": log2 engine gives " + str(float(log2_value)) + ", formula " + str(log(linear, 2)))
+    if get_noise_budget(alpha_bound_from_variance(mult, n), q) != get_average_case_budget_from_log2(log(mult, 2), n, log_q):
+        raise AssertionError("get_noise_budget: log2 engine and formula disagree")
+
+
 ###########################################################################
 # Estimates of worst-case and average-case heuristics for [CLP20] circuit #
 ###########################################################################
 
-# Variance of the output ciphertext after evaluating the [CLP20] circuit
-def variance_after_clp20_computation(n, t, q, p):
-    fresh = variance_fresh(n, t)
-    add = variance_add(fresh, fresh)
-    mult = variance_mult(add, fresh, n, t)
+# log2 of the variance of the output ciphertext after each stage of the [CLP20] circuit
+def log2_variance_after_clp20_computation(n, t, q, p, secret_variance=2.0/3):
+    fresh = log2_variance_fresh(n, t, secret_variance)
+    add = log2_variance_add(fresh, fresh)
+    mult = log2_variance_mult(add, fresh, n, t)
 
     if (n > 2048):
-        mod_switch = variance_mod_switch(n, t, q, p, mult)
+        mod_switch = log2_variance_mod_switch(n, t, log2_modulus(q), log2_modulus(p), mult, secret_variance)
         return fresh, add, mult, mod_switch
     else:
         return fresh, add, mult
 
 # Top-level function for noise budget predicted for average-case approach
-def average_case_clp20(n, t, q, p):
+def average_case_clp20(n, t, q, p, secret_variance=2.0/3):
+    log_q = log2_modulus(q)
     if (n > 2048):
-        fresh_ctext_variance, add_ctext_variance, mult_ctext_variance, mod_switch_variance = variance_after_clp20_computation(n, t, q, p)
+        fresh_ctext_variance, add_ctext_variance, mult_ctext_variance, mod_switch_variance = log2_variance_after_clp20_computation(n, t, q, p, secret_variance)
     else:
-        fresh_ctext_variance, add_ctext_variance, mult_ctext_variance = variance_after_clp20_computation(n, t, q, p)
+        fresh_ctext_variance, add_ctext_variance, mult_ctext_variance = log2_variance_after_clp20_computation(n, t, q, p, secret_variance)
 
-    fresh_ctext_bound = alpha_bound_from_variance(fresh_ctext_variance, n)
-    add_ctext_bound = alpha_bound_from_variance(add_ctext_variance, n)
-    mult_ctext_bound = alpha_bound_from_variance(mult_ctext_variance, n)
-    fresh_noise_budget = get_noise_budget(fresh_ctext_bound, q)
-    add_noise_budget = get_noise_budget(add_ctext_bound, q)
-    mult_noise_budget = get_noise_budget(mult_ctext_bound, q)
+    fresh_noise_budget = get_average_case_budget_from_log2(fresh_ctext_variance, n, log_q)
+    add_noise_budget = get_average_case_budget_from_log2(add_ctext_variance, n, log_q)
+    mult_noise_budget = get_average_case_budget_from_log2(mult_ctext_variance, n, log_q)
 
     if (n > 2048):
-        mod_switch_bound = alpha_bound_from_variance(mod_switch_variance, n)
-        mod_switch_noise_budget = get_noise_budget(mod_switch_bound, p)
+        mod_switch_noise_budget = get_average_case_budget_from_log2(mod_switch_variance, n, log2_modulus(p))
         return fresh_noise_budget, add_noise_budget, mult_noise_budget, mod_switch_noise_budget
     else:
         return fresh_noise_budget, add_noise_budget, mult_noise_budget
 
 # Top-level function for noise budget predicted for worst-case approach
 def worst_case_clp20(n, t, q, p):
-    fresh = bound_fresh(n, t)
-    add = bound_add(fresh, fresh)
-    mult = bound_mult(add, fresh)
-    fresh_budget = get_noise_budget(fresh, q)
-    add_budget = get_noise_budget(add, q)
-    mult_budget = get_noise_budget(mult, q)
+    log_q = log2_modulus(q)
+    fresh = log2_bound_fresh(n, t)
+    add = fresh + 1 # bound_add(fresh, fresh)
+    mult = add + fresh # bound_mult(add, fresh)
+    fresh_budget = get_noise_budget_from_log2(fresh, log_q)
+    add_budget = get_noise_budget_from_log2(add, log_q)
+    mult_budget = get_noise_budget_from_log2(mult, log_q)
     if (n > 2048):
-        mod_switch = bound_mod_switch(n, t, q, p, mult)
-        mod_switch_budget = get_noise_budget(mod_switch, p)
+        mod_switch = log2_bound_mod_switch(n, t, log_q, log2_modulus(p), mult)
+        mod_switch_budget = get_noise_budget_from_log2(mod_switch, log2_modulus(p))
         return fresh_budget, add_budget, mult_budget, mod_switch_budget 
     else:
         return fresh_budget, add_budget, mult_budget
@@ -137,40 +201,63 @@ def worst_case_clp20(n, t, q, p):
 # Estimates of worst-case and average-case heuristics for "bgv deep" circuit #
 ##############################################################################
 
-# Variance of the output ciphertext after evaluating the "bgv deep" circuit
-def variance_after_bgv_deep(n, t, q, p):
-    fresh = variance_fresh(n, t)
-    mult1 = variance_mult(fresh, fresh, n, t)
-    mult2 = variance_mult(mult1, mult1, n, t)
-    mult3 = variance_mult(mult2, mult2, n, t)
+# log2 of the variance of the output ciphertext after each level of the "bgv deep" circuit
+def log2_variance_after_bgv_deep(n, t, q, p, secret_variance=2.0/3):
+    fresh = log2_variance_fresh(n, t, secret_variance)
+    mult1 = log2_variance_mult(fresh, fresh, n, t)
+    mult2 = log2_variance_mult(mult1, mult1, n, t)
+    mult3 = log2_variance_mult(mult2, mult2, n, t)
     return fresh, mult1, mult2, mult3
 
 # Top-level function for noise budget predicted for average-case approach
-def average_case_bgv_deep(n, t, q, p):
-    fresh, mult1_var, mult2_var, mult3_var = variance_after_bgv_deep(n, t, q, p)
-    fresh_bound =  alpha_bound_from_variance(fresh, n)
-    mult1_bound = alpha_bound_from_variance(mult1_var, n)
-    mult2_bound = alpha_bound_from_variance(mult2_var, n)
-    mult3_bound = alpha_bound_from_variance(mult3_var, n)
-    fresh_budget = get_noise_budget(fresh_bound, q)
-    mult1_budget = get_noise_budget(mult1_bound, q)
-    mult2_budget = get_noise_budget(mult2_bound, q)
-    mult3_budget = get_noise_budget(mult3_bound, q)
+def average_case_bgv_deep(n, t, q, p, secret_variance=2.0/3):
+    log_q = log2_modulus(q)
+    fresh, mult1_var, mult2_var, mult3_var = log2_variance_after_bgv_deep(n, t, q, p, secret_variance)
+    fresh_budget = get_average_case_budget_from_log2(fresh, n, log_q)
+    mult1_budget = get_average_case_budget_from_log2(mult1_var, n, log_q)
+    mult2_budget = get_average_case_budget_from_log2(mult2_var, n, log_q)
+    mult3_budget = get_average_case_budget_from_log2(mult3_var, n, log_q)
     return fresh_budget, mult1_budget, mult2_budget, mult3_budget
 
 # Top-level function for noise budget predicted for worst-case approach
 def worst_case_bgv_deep(n, t, q):
-    fresh = bound_fresh(n, t)
-    mult1 = bound_mult(fresh, fresh)
-    mult2 = bound_mult(mult1, mult1)
-    mult3 = bound_mult(mult2, mult2)
-    fresh_budget = get_noise_budget(fresh, q)
-    mult1_budget = get_noise_budget(mult1, q)
-    mult2_budget = get_noise_budget(mult2, q)
-    mult3_budget = get_noise_budget(mult3, q)
+    log_q = log2_modulus(q)
+    fresh = log2_bound_fresh(n, t)
+    mult1 = 2 * fresh # bound_mult(fresh, fresh)
+    mult2 = 2 * mult1
+    mult3 = 2 * mult2
+    fresh_budget = get_noise_budget_from_log2(fresh, log_q)
+    mult1_budget = get_noise_budget_from_log2(mult1, log_q)
+    mult2_budget = get_noise_budget_from_log2(mult2, log_q)
+    mult3_budget = get_noise_budget_from_log2(mult3, log_q)
     return fresh_budget, mult1_budget, mult2_budget, mult3_budget
 
 
+#########################################################################################
+# Estimates of average-case heuristics for plaintext and constant multiplication stages #
+#########################################################################################
+
+# log2 of the variance after multiplying a fresh ciphertext by a uniform plaintext, and by the constant
+def log2_variance_after_plain_mults(n, t, constant):
+    fresh = log2_variance_fresh(n, t)
+    plain_mult = log2_variance_plain_mult(fresh, n, t)
+    constant_mult = log2_variance_constant_mult(fresh, constant)
+    return fresh, plain_mult, constant_mult
+
+# Top-level function for noise budget predicted for average-case approach
+# The constant is the scalar of the harness: (t-1)/2, the largest centered value mod t, in SEAL, and
+# the unreduced integer 1024 in HElib, where (t-1)/2 = 1 at t = 3 would not grow the noise
+def average_case_plain_mults(n, t, q, constant=None):
+    log_q = log2_modulus(q)
+    if constant is None:
+        constant = (t - 1) // 2
+    fresh_var, plain_mult_var, constant_mult_var = log2_variance_after_plain_mults(n, t, constant)
+    fresh_budget = get_average_case_budget_from_log2(fresh_var, n, log_q)
+    plain_mult_budget = get_average_case_budget_from_log2(plain_mult_var, n, log_q)
+    constant_mult_budget = get_average_case_budget_from_log2(constant_mult_var, n, log_q)
+    return fresh_budget, plain_mult_budget, constant_mult_budget
+
+
 ######################################################
 # Parameters used in implementations of the circuits #
 ######################################################
@@ -184,6 +271,7 @@ n_32768 = 32768
 
 # HElib parameters
 t_helib = 3
+cmult_constant_helib = 1024
 q_2048_helib = 18014398492704769 # log q = 54
 p_2048_helib = 0 # mod switch not supported for n = 2048
 q_4096_helib = 649037106476272273878613017231361 # log q = 109
@@ -212,6 +300,8 @@ p_32768_SEAL = 2**770
 # Generate results tables #
 ###########################
 
+check_log2_engine()
+
 # Table 1: HElib, [CLP20] circuit, worst-case
 print("HElib, [CLP20] circuit, worst-case (Table 1, column [CLP20]):")
 print("n: " + str(n_2048))
@@ -294,4 +384,60 @@ print("n: " + str(n_16384))
 print(average_case_bgv_deep(n_16384, t_16384_SEAL, q_16384_SEAL, p_16384_SEAL))
 print("n: " + str(n_32768))
 print(average_case_bgv_deep(n_32768, t_32768_SEAL, q_32768_SEAL, p_32768_SEAL))
-print("\n")
\ No newline at end of file
+print("\n")
+
+# HElib, plaintext and constant multiplication stages, average-case
+print("HElib, plaintext and constant multiplication of a fresh ciphertext, average-case (fresh, pmult, cmult):")
+print("n: " + str(n_2048))
+print(average_case_plain_mults(n_2048, t_helib, q_2048_helib, cmult_constant_helib))
+print("n: " + str(n_4096))
+print(average_case_plain_mults(n_4096, t_helib, q_4096_helib, cmult_constant_helib))
+print("n: " + str(n_8192))
+print(average_case_plain_mults(n_8192, t_helib, q_8192_helib, cmult_constant_helib))
+print("n: " + str(n_16384))
+print(average_case_plain_mults(n_16384, t_helib, q_16384_helib, cmult_constant_helib))
+print("\n")
+
+# SEAL, plaintext and constant multiplication stages, average-case
+print("SEAL, plaintext and constant multiplication of a fresh ciphertext, average-case (fresh, pmult, cmult):")
+print("n: " + str(n_4096))
+print(average_case_plain_mults(n_4096, t_4096_SEAL, q_4096_SEAL))
+print("n: " + str(n_8192))
+print(average_case_plain_mults(n_8192, t_8192_SEAL, q_8192_SEAL))
+print("n: " + str(n_16384))
+print(average_case_plain_mults(n_16384, t_16384_SEAL, q_16384_SEAL))
+print("n: " + str(n_32768))
+print(average_case_plain_mults(n_32768, t_32768_SEAL, q_32768_SEAL))
+print("\n")
+
+# Sparse ternary secrets, average-case: the [CLP20] and bgv deep circuits with a secret of Hamming weight h = 64, as
+# set by secret_distribution and secret_hamming_weight in the harnesses (the tables above are for uniform ternary)
+h_sparse = 64
+print("HElib, [CLP20] circuit, average-case, sparse ternary secret of Hamming weight " + str(h_sparse) + ":")
+print("n: " + str(n_4096))
+print(average_case_clp20(n_4096, t_helib, q_4096_helib, p_4096_helib, secret_variance_hamming_weight(n_4096, h_sparse)))
+print("n: " + str(n_8192))
+print(average_case_clp20(n_8192, t_helib, q_8192_helib, p_8192_helib, secret_variance_hamming_weight(n_8192, h_sparse)))
+print("n: " + str(n_16384))
+print(average_case_clp20(n_16384, t_helib, q_16384_helib, p_16384_helib, secret_variance_hamming_weight(n_16384, h_sparse)))
+print("\n")
+
+print("HElib, bgv deep circuit, average-case, sparse ternary secret of Hamming weight " + str(h_sparse) + ":")
+print("n: " + str(n_4096))
+print(average_case_bgv_deep(n_4096, t_helib, q_4096_helib, p_4096_helib, secret_variance_hamming_weight(n_4096, h_sparse)))
+print("n: " + str(n_8192))
+print(average_case_bgv_deep(n_8192, t_helib, q_8192_helib, p_8192_helib, secret_variance_hamming_weight(n_8192, h_sparse)))
+print("n: " + str(n_16384))
+print(average_case_bgv_deep(n_16384, t_helib, q_16384_helib, p_16384_helib, secret_variance_hamming_weight(n_16384, h_sparse)))
+print("\n")
+
+print("SEAL, [CLP20] circuit, average-case, sparse ternary secret of Hamming weight " + str(h_sparse) + ":")
+print("n: " + str(n_4096))
+print(average_case_clp20(n_4096, t_4096_SEAL, q_4096_SEAL, p_4096_SEAL, secret_variance_hamming_weight(n_4096, h_sparse)))
+print("n: " + str(n_8192))
+print(average_case_clp20(n_8192, t_8192_SEAL, q_8192_SEAL, p_8192_SEAL, secret_variance_hamming_weight(n_8192, h_sparse)))
+print("n: " + str(n_16384))
+print(average_case_clp20(n_16384, t_16384_SEAL, q_16384_SEAL, p_16384_SEAL, secret_variance_hamming_weight(n_16384, h_sparse)))
+print("n: " + str(n_32768))
+print(average_case_clp20(n_32768, t_32768_SEAL, q_32768_SEAL, p_32768_SEAL, secret_variance_hamming_weight(n_32768, h_sparse)))
+print("\n")